@@ -8,6 +8,8 @@
  */
 #include <stdlib.h>
 #include <stdbool.h>
+#include <string.h>
+#include <errno.h>
 #include "rbtree.h"
 
 /* Implementation of red-black trees; ordered binary trees
@@ -64,7 +66,7 @@ static rbtree_node_t *outside_child(rbtree_node_t *node);
 static rbtree_node_t *ankle(rbtree_node_t *node);
 static rbtree_node_t *near_nieph(rbtree_node_t *node);
 static rbtree_node_t *far_nieph(rbtree_node_t *node);
-static rbtree_node_t *successor(rbtree_node_t *node);
+static rbtree_node_t *successor(rbtree_t *tree, rbtree_node_t *node);
 static rbtree_node_t *set_child(rbtree_t *tree, rbtree_node_t *node,
                                 rbtree_node_t *child, bool left_child);
 static rbtree_node_t *set_lchild(rbtree_t *tree, rbtree_node_t *node,
@@ -72,34 +74,448 @@ static rbtree_node_t *set_lchild(rbtree_t *tree, rbtree_node_t *node,
 static rbtree_node_t *set_rchild(rbtree_t *tree, rbtree_node_t *node,
                                            rbtree_node_t *child);
 static rbtree_node_t *new_node(rbtree_t *tree, void *vnode);
+static void free_node(rbtree_t *tree, rbtree_node_t *node);
+static void release_node(rbtree_t *tree, rbtree_node_t *node);
+static void set_color(rbtree_t *tree, rbtree_node_t *node, char color);
 
 static bool is_left_child(rbtree_node_t *node);
 static bool is_red_node(rbtree_node_t *node);
 static bool is_root_node(rbtree_node_t *node);
 static bool is_inside_child(rbtree_node_t *node);
-
-static void init_node(rbtree_node_t *node, void *vnode);
-
-void rbtree_init(rbtree_t *tree, rbtree_cmp_t *cmp) {
+static bool is_inline(rbtree_t *tree);
+
+static void init_node(rbtree_t *tree, rbtree_node_t *node, void *vnode);
+static void push_shift(rbtree_t *tree, rbtree_node_t *node);
+static size_t subtree_size(rbtree_t *tree, rbtree_node_t *node);
+static int black_height(rbtree_node_t *node);
+static void update_size(rbtree_t *tree, rbtree_node_t *node);
+static void update_max_extent(rbtree_t *tree, rbtree_node_t *node);
+static void add_size(rbtree_t *tree, rbtree_node_t *node, long delta);
+static void remove_node(rbtree_t *tree, rbtree_node_t *node);
+static rbtree_node_t *first_node(rbtree_t *tree);
+static void cache_forget(rbtree_t *tree, rbtree_node_t *node);
+static int txn_reserve(rbtree_t *tree);
+static int txn_reserve_read(rbtree_t *tree);
+static void log_node(rbtree_t *tree, rbtree_node_t *node);
+static void log_shift(rbtree_t *tree, void *data, long delta);
+
+RBTREE_API void rbtree_init(rbtree_t *tree, rbtree_cmp_t *cmp) {
     tree->root   = NULL;
     tree->cmp    = cmp;
     tree->malloc = malloc;
     tree->free   = free;
+    tree->shift  = NULL;
+    tree->extent = NULL;
+    tree->shift_offset  = 0;
+    tree->size_offset   = 0;
+    tree->extent_offset = 0;
+
+    tree->alloc     = NULL;
+    tree->dealloc   = NULL;
+    tree->alloc_ctx = NULL;
+
+    tree->trace     = NULL;
+    tree->trace_ctx = NULL;
+    tree->iter_ids  = 0;
+
+    tree->key_size   = 0;
+    tree->value_size = 0;
+
+    tree->hash         = NULL;
+    tree->cache        = NULL;
+    tree->cache_sets   = 0;
+    tree->cache_hits   = 0;
+    tree->cache_misses = 0;
+
+    tree->undo       = NULL;
+    tree->undo_len   = 0;
+    tree->undo_cap   = 0;
+    tree->undo_root  = NULL;
+    tree->txn_open   = 0;
+    tree->txn_failed = 0;
 }
 
-void rbtree_set_malloc_free(rbtree_t *tree, rbtree_malloc_t *malloc, rbtree_free_t *free) {
+RBTREE_API void rbtree_init_inline(rbtree_t *tree, rbtree_cmp_t *cmp,
+                                   size_t key_size, size_t value_size) {
+    rbtree_init(tree, cmp);
+
+    tree->key_size   = key_size;
+    tree->value_size = value_size;
+}
+
+RBTREE_API void rbtree_set_malloc_free(rbtree_t *tree, rbtree_malloc_t *malloc, rbtree_free_t *free) {
     tree->malloc = malloc;
     tree->free   = free;
 }
 
+RBTREE_API void rbtree_set_allocator(rbtree_t *tree, rbtree_alloc_t *alloc,
+                                     rbtree_dealloc_t *dealloc, void *ctx) {
+    tree->alloc     = alloc;
+    tree->dealloc   = dealloc;
+    tree->alloc_ctx = ctx;
+}
+
+RBTREE_API size_t rbtree_node_size(rbtree_t *tree) {
+    size_t size = sizeof(rbtree_node_t) + tree->key_size + tree->value_size;
+
+    /* optional fields, each one after those added before it */
+    if (tree->shift_offset >= size)  size = tree->shift_offset + sizeof(long);
+    if (tree->size_offset >= size)   size = tree->size_offset + sizeof(size_t);
+    if (tree->extent_offset >= size) size = tree->extent_offset + sizeof(size_t);
+
+    return size;
+}
+
+/* return the offset of a new optional field at the end of each node, or
+ * 0 if there are nodes already, or an allocator sized for them, or a
+ * transaction logging them.
+ */
+static size_t add_field(rbtree_t *tree) {
+    size_t end = rbtree_node_size(tree);
+
+    if (tree->root != NULL || tree->alloc != NULL || tree->txn_open) return 0;
+
+    return (end + sizeof(size_t) - 1) / sizeof(size_t) * sizeof(size_t);
+}
+
+/* the pending shift for node and its subtree. */
+static long *pending_shift(rbtree_t *tree, rbtree_node_t *node) {
+    return (long *) ((char *) node + tree->shift_offset);
+}
+
+/* the number of nodes in node's subtree, including node. */
+static size_t *kept_size(rbtree_t *tree, rbtree_node_t *node) {
+    return (size_t *) ((char *) node + tree->size_offset);
+}
+
+RBTREE_API int rbtree_set_shift(rbtree_t *tree, rbtree_shift_t *shift) {
+    if (shift != NULL && tree->shift_offset == 0
+        && (tree->shift_offset = add_field(tree)) == 0) return -1;
+
+    tree->shift = shift;
+
+    return 0;
+}
+
+RBTREE_API int rbtree_set_ranks(rbtree_t *tree) {
+    if (tree->size_offset == 0
+        && (tree->size_offset = add_field(tree)) == 0) return -1;
+
+    return 0;
+}
+
+/* bring the max extents of node's subtree up to date */
+static void set_max_extents(rbtree_t *tree, rbtree_node_t *node) {
+    if (node == NULL) return;
+
+    set_max_extents(tree, node->lchild);
+    set_max_extents(tree, node->rchild);
+    update_max_extent(tree, node);
+}
+
+/* the largest extent in node's subtree, kept after its key and value. */
+static size_t *max_extent(rbtree_t *tree, rbtree_node_t *node) {
+    return (size_t *) ((char *) node + tree->extent_offset);
+}
+
+RBTREE_API int rbtree_set_extent(rbtree_t *tree, rbtree_extent_t *extent) {
+    if (tree->txn_open) return -1;
+
+    if (extent != NULL && tree->extent_offset == 0
+        && (tree->extent_offset = add_field(tree)) == 0) return -1;
+
+    tree->extent = extent;
+    set_max_extents(tree, tree->root);
+
+    return 0;
+}
+
+RBTREE_API void rbtree_set_trace(rbtree_t *tree, rbtree_trace_hook_t *hook, void *ctx) {
+    tree->trace     = hook;
+    tree->trace_ctx = ctx;
+}
+
+RBTREE_API int rbtree_set_cache(rbtree_t *tree, rbtree_hash_t *hash, size_t entries) {
+    size_t sets = 1;
+
+    if (tree->cache != NULL) tree->free(tree->cache);
+
+    tree->cache        = NULL;
+    tree->cache_sets   = 0;
+    tree->cache_hits   = 0;
+    tree->cache_misses = 0;
+
+    if (entries == 0) return 0;
+
+    while (2 * sets < entries) sets *= 2;
+
+    if ((tree->cache = (rbtree_node_t **) tree->malloc(2 * sets * sizeof(rbtree_node_t *))) == NULL)
+        return -1;
+
+    tree->hash       = hash;
+    tree->cache_sets = sets;
+    rbtree_cache_clear(tree);
+
+    return 0;
+}
+
+RBTREE_API void rbtree_cache_clear(rbtree_t *tree) {
+    if (tree->cache != NULL)
+        memset(tree->cache, 0, 2 * tree->cache_sets * sizeof(rbtree_node_t *));
+}
+
+RBTREE_API void rbtree_cache_stats(rbtree_t *tree, unsigned long *hits, unsigned long *misses) {
+    *hits   = tree->cache_hits;
+    *misses = tree->cache_misses;
+}
+
+/* the two cache entries where data can go */
+static rbtree_node_t **cache_set(rbtree_t *tree, void *data) {
+    return &tree->cache[2 * (tree->hash(data) & (tree->cache_sets - 1))];
+}
+
+/* a node is about to be freed; drop it from the cache. */
+static void cache_forget(rbtree_t *tree, rbtree_node_t *node) {
+    rbtree_node_t **set;
+
+    if (tree->cache == NULL) return;
+
+    set = cache_set(tree, node->data);
+
+    if (set[1] == node) set[1] = NULL;
+    if (set[0] == node) { set[0] = set[1]; set[1] = NULL; }
+}
+
+/* transactions.
+ *
+ * while a transaction is open, a copy of each node goes into the undo
+ * log before the node is changed, and each call of tree->shift() on a
+ * user key is logged too.  new nodes are logged, and nodes to be freed
+ * are logged instead of freed.  abort walks the log backwards, copying
+ * each node back and shifting keys back, then frees the new nodes;
+ * commit frees the logged ones.
+ *
+ * each operation first makes sure the log has room for the most it
+ * can log, so it fails before changing anything if memory runs out.  a
+ * write that fails marks the transaction failed, so that it can't be
+ * committed without it; a read only writes to push pending key shifts
+ * down, so it reserves room only with lazy shifting, and a read that
+ * fails changes nothing and leaves the transaction as it was.
+ */
+
+enum { UNDO_NODE, UNDO_NEW, UNDO_FREE, UNDO_SHIFT };
+
+typedef struct {
+    int kind;
+    rbtree_node_t *node;
+    void *data;     /* UNDO_SHIFT */
+    long delta;
+} undo_t;           /* followed by a copy of the node, for UNDO_NODE */
+
+static size_t undo_record_size(rbtree_t *tree) {
+    size_t size = sizeof(undo_t) + rbtree_node_size(tree);
+
+    return (size + sizeof(undo_t) - 1) / sizeof(undo_t) * sizeof(undo_t);
+}
+
+static undo_t *undo_record(rbtree_t *tree, size_t i) {
+    return (undo_t *) (tree->undo + i * undo_record_size(tree));
+}
+
+/* the most records one operation can log:  a few for each node on a
+ * path from the root (no path is more than twice the black-height, plus
+ * one), and a few more for the rotations at the end of a fix-up.
+ */
+static size_t undo_reserve(rbtree_t *tree) {
+    size_t depth = 2 * (size_t) black_height(tree->root) + 4;
+
+    return 16 * depth + 64;
+}
+
+static int undo_grow(rbtree_t *tree, size_t cap) {
+    unsigned char *undo = (unsigned char *) tree->malloc(cap * undo_record_size(tree));
+
+    if (undo == NULL) return -1;
+
+    if (tree->undo != NULL) {
+        memcpy(undo, tree->undo, tree->undo_len * undo_record_size(tree));
+        tree->free(tree->undo);
+    }
+
+    tree->undo     = undo;
+    tree->undo_cap = cap;
+
+    return 0;
+}
+
+static int undo_room(rbtree_t *tree) {
+    size_t need = tree->undo_len + undo_reserve(tree);
+
+    if (need <= tree->undo_cap) return 0;
+
+    return undo_grow(tree, need > 2 * tree->undo_cap ? need : 2 * tree->undo_cap);
+}
+
+/* make room in the log for one more write; 0 if there's no
+ * transaction.
+ */
+static int txn_reserve(rbtree_t *tree) {
+    if (!tree->txn_open || undo_room(tree) == 0) return 0;
+
+    tree->txn_failed = 1;
+    return -1;
+}
+
+/* the same for a read; on failure, set errno to ENOMEM. */
+static int txn_reserve_read(rbtree_t *tree) {
+    if (!tree->txn_open || tree->shift == NULL || undo_room(tree) == 0) return 0;
+
+    errno = ENOMEM;
+    return -1;
+}
+
+static undo_t *txn_log(rbtree_t *tree, int kind, rbtree_node_t *node) {
+    undo_t *record;
+
+    /* every path that logs reserves room first, so this can't happen;
+     * if it did, the transaction could no longer be undone
+     */
+    if (tree->undo_len == tree->undo_cap && undo_grow(tree, 2 * tree->undo_cap + 1) != 0) {
+        tree->txn_failed = 1;
+        return NULL;
+    }
+
+    record = undo_record(tree, tree->undo_len++);
+    record->kind = kind;
+    record->node = node;
+
+    return record;
+}
+
+/* node is about to change. */
+static void log_node(rbtree_t *tree, rbtree_node_t *node) {
+    undo_t *record;
+
+    if (!tree->txn_open || node == NULL) return;
+
+    /* a node changed twice in a row needs only the first copy */
+    if (tree->undo_len > 0) {
+        record = undo_record(tree, tree->undo_len - 1);
+        if (record->kind == UNDO_NODE && record->node == node) return;
+    }
+
+    if ((record = txn_log(tree, UNDO_NODE, node)) != NULL)
+        memcpy(record + 1, node, rbtree_node_size(tree));
+}
+
+/* the key of data is about to be shifted by delta. */
+static void log_shift(rbtree_t *tree, void *data, long delta) {
+    undo_t *record;
+
+    if (!tree->txn_open) return;
+
+    if ((record = txn_log(tree, UNDO_SHIFT, NULL)) != NULL) {
+        record->data  = data;
+        record->delta = delta;
+    }
+}
+
+static void txn_end(rbtree_t *tree) {
+    if (tree->undo != NULL) tree->free(tree->undo);
+
+    tree->undo     = NULL;
+    tree->undo_len = 0;
+    tree->undo_cap = 0;
+    tree->txn_open = 0;
+}
+
+RBTREE_API int rbtree_txn_begin(rbtree_t *tree) {
+    if (tree->txn_open) return -1;
+
+    tree->txn_open   = 1;
+    tree->txn_failed = 0;
+    tree->undo_len   = 0;
+    tree->undo_root  = tree->root;
+
+    if (undo_room(tree) != 0) {
+        txn_end(tree);
+        return -1;
+    }
+
+    return 0;
+}
+
+RBTREE_API int rbtree_txn_commit(rbtree_t *tree) {
+    size_t i;
+
+    if (!tree->txn_open) return -1;
+
+    if (tree->txn_failed) {
+        rbtree_txn_abort(tree);
+        return -1;
+    }
+
+    for (i = 0; i < tree->undo_len; ++i) {
+        undo_t *record = undo_record(tree, i);
+
+        if (record->kind == UNDO_FREE) release_node(tree, record->node);
+    }
+
+    txn_end(tree);
+
+    return 0;
+}
+
+RBTREE_API void rbtree_txn_abort(rbtree_t *tree) {
+    size_t i;
+
+    if (!tree->txn_open) return;
+
+    for (i = tree->undo_len; i-- > 0; ) {
+        undo_t *record = undo_record(tree, i);
+
+        switch (record->kind) {
+            case UNDO_NODE:
+                memcpy(record->node, record + 1, rbtree_node_size(tree));
+                break;
+
+            case UNDO_SHIFT:
+                tree->shift(record->data, -record->delta);
+                break;
+
+            case UNDO_NEW:
+                release_node(tree, record->node);
+                break;
+        }
+    }
+
+    tree->root = tree->undo_root;
+
+    /* cached nodes may hold other values now */
+    rbtree_cache_clear(tree);
+    txn_end(tree);
+}
+
+#define TRACE(tree, op, data) do {                                   \
+    if ((tree)->trace != NULL) (tree)->trace((tree)->trace_ctx, (op), (data)); \
+} while (0)
+
 static void rotateUpNode(rbtree_t *tree, rbtree_node_t *node) {
     bool left_child = is_left_child(node);
     rbtree_node_t *p  = parent(node);
     rbtree_node_t *gp = grandparent(node);
 
+    /* node and p swap subtrees, so neither may carry a pending shift */
+    push_shift(tree, p);
+    push_shift(tree, node);
+
     set_child(tree, p,    inside_child(node), left_child);
     set_child(tree, gp,   node,               is_left_child(p));
     set_child(tree, node, p,                  !left_child);
+
+    /* p is now below node */
+    update_size(tree, p);
+    update_size(tree, node);
 }
 
 /*       nodeB:c1                 nodeA:c1
@@ -129,8 +545,9 @@ static void rotateUpNode(rbtree_t *tree, rbtree_node_t *node) {
 static void rotateUp(rbtree_t *tree, rbtree_node_t *node) {
     rbtree_node_t *p = parent(node);
     char pc          = p->color;
-    p->color         = node->color;
-    node->color      = pc;
+
+    set_color(tree, p, node->color);
+    set_color(tree, node, pc);
 
     rotateUpNode(tree, node);
 }
@@ -142,7 +559,9 @@ static rbtree_node_t *rec_rbtree_find(rbtree_t *tree, rbtree_node_t *node,
     if (node == NULL)
         return NULL;
 
-    else if ((rel = tree->cmp(search->data, node->data)) == 0)
+    push_shift(tree, node);
+
+    if ((rel = tree->cmp(search->data, node->data)) == 0)
         return node;
 
     else if (rel < 0)
@@ -152,10 +571,48 @@ static rbtree_node_t *rec_rbtree_find(rbtree_t *tree, rbtree_node_t *node,
         return rec_rbtree_find(tree, node->rchild, search);
 }
 
-void *rbtree_find(rbtree_t *tree, void *vsearch) {
+/* a hit costs a hash and a compare.  a hit in the second entry of a
+ * set moves it to the first, and a miss that finds a node puts it first.
+ */
+static rbtree_node_t *cached_find(rbtree_t *tree, rbtree_node_t *search) {
+    rbtree_node_t **set = cache_set(tree, search->data), *found;
+
+    if (set[0] != NULL && tree->cmp(search->data, set[0]->data) == 0) {
+        ++tree->cache_hits;
+        return set[0];
+    }
+
+    if (set[1] != NULL && tree->cmp(search->data, set[1]->data) == 0) {
+        ++tree->cache_hits;
+
+        found  = set[1];
+        set[1] = set[0];
+        return set[0] = found;
+    }
+
+    ++tree->cache_misses;
+
+    if ((found = rec_rbtree_find(tree, tree->root, search)) != NULL) {
+        set[1] = set[0];
+        set[0] = found;
+    }
+
+    return found;
+}
+
+RBTREE_API void *rbtree_find(rbtree_t *tree, void *vsearch) {
     rbtree_node_t search, *found;
+
+    TRACE(tree, RBTREE_TRACE_FIND, vsearch);
+
+    if (txn_reserve_read(tree) != 0) return NULL;
+
     search.data = vsearch;
-    found = rec_rbtree_find(tree, tree->root, &search);
+
+    if (tree->cache != NULL)
+        found = cached_find(tree, &search);
+    else
+        found = rec_rbtree_find(tree, tree->root, &search);
 
     if (found == NULL) 
         return NULL;
@@ -163,6 +620,103 @@ void *rbtree_find(rbtree_t *tree, void *vsearch) {
        return found->data;
 }
 
+RBTREE_API int rbtree_find_is_read_only(rbtree_t *tree) {
+    return tree->shift == NULL && tree->cache == NULL && tree->trace == NULL
+           && !tree->txn_open;
+}
+
+RBTREE_API void *rbtree_find_first_fit(rbtree_t *tree, size_t size) {
+    rbtree_node_t *node = tree->root;
+
+    if (tree->extent == NULL || txn_reserve_read(tree) != 0) return NULL;
+
+    if (node == NULL || *max_extent(tree, node) < size) return NULL;
+
+    /* go left whenever the left subtree has a fit, since its values
+     * come first; else the node itself fits, or the right subtree has
+     * the fit that this subtree is known to hold.
+     */
+    for (;;) {
+        push_shift(tree, node);
+
+        if (node->lchild != NULL && *max_extent(tree, node->lchild) >= size)
+            node = node->lchild;
+
+        else if (tree->extent(node->data) >= size)
+            return node->data;
+
+        else
+            node = node->rchild;
+    }
+}
+
+RBTREE_API void rbtree_update_extent(rbtree_t *tree, void *data) {
+    rbtree_node_t search, *node;
+
+    if (tree->extent == NULL || txn_reserve(tree) != 0) return;
+
+    search.data = data;
+
+    for (node = rec_rbtree_find(tree, tree->root, &search); node != NULL; node = parent(node))
+        update_max_extent(tree, node);
+}
+
+/* a red-black tree of N nodes is at most 2 log2(N + 1) deep, and N fits
+ * in a pointer.
+ */
+#define MAX_DEPTH (2 * 8 * sizeof(void *))
+
+RBTREE_API size_t rbtree_find_sorted_batch(rbtree_t *tree, void **keys, size_t n, void **out) {
+    /* the path from the root to the finger, and for each node on it the
+     * nearest ancestors below and above it in order (NULL if none);
+     * the node's subtree holds only values between those two.
+     */
+    rbtree_node_t *path[MAX_DEPTH], *low[MAX_DEPTH], *high[MAX_DEPTH];
+    size_t i, found = 0;
+    int depth = 0;
+
+    path[0] = tree->root;
+    low[0]  = high[0] = NULL;
+
+    for (i = 0; i < n; ++i) {
+        void *key = keys[i];
+        rbtree_node_t *node;
+        int rel;
+
+        TRACE(tree, RBTREE_TRACE_FIND, key);
+
+        out[i] = NULL;
+
+        if (txn_reserve_read(tree) != 0) continue;
+
+        /* climb until key is strictly inside the subtree's bounds */
+        while (depth > 0 && ((low[depth]  != NULL && tree->cmp(key, low[depth]->data)  <= 0)
+                          || (high[depth] != NULL && tree->cmp(key, high[depth]->data) >= 0)))
+            --depth;
+
+        for (node = path[depth]; node != NULL; node = path[++depth]) {
+            push_shift(tree, node);
+
+            if ((rel = tree->cmp(key, node->data)) == 0) {
+                out[i] = node->data;
+                ++found;
+                break;
+            }
+
+            if ((rel < 0 ? node->lchild : node->rchild) == NULL)
+                break;
+
+            path[depth + 1] = rel < 0 ? node->lchild : node->rchild;
+            low[depth + 1]  = rel < 0 ? low[depth] : node;
+            high[depth + 1] = rel < 0 ? node : high[depth];
+        }
+    }
+
+    return found;
+}
+
+#undef MAX_DEPTH
+
 static rbtree_node_t *tree_insert(rbtree_t *tree, rbtree_node_t *node,
         void *new_data) {
     int cmp;
@@ -173,6 +727,7 @@ static rbtree_node_t *tree_insert(rbtree_t *tree, rbtree_node_t *node,
         return tree->root = newNode;
     }
 
+    push_shift(tree, node);
     cmp = tree->cmp(new_data, node->data);
 
     if (cmp < 0) {
@@ -204,7 +759,7 @@ static bool violatesRedProperty(rbtree_node_t *node) {
  */
 static void restoreRedProperty(rbtree_t *tree, rbtree_node_t *fixme) {
     if (is_root_node(parent(fixme))) {
-        parent(fixme)->color = 'b';
+        set_color(tree, parent(fixme), 'b');
 
     /* if both parent and ankle are red, they can both be made black
      * and grandparent can be made red.  this will fix the red-property
@@ -213,9 +768,9 @@ static void restoreRedProperty(rbtree_t *tree, rbtree_node_t *fixme) {
      */
 
     } else if (is_red_node(ankle(fixme))) {
-        parent(fixme)->color      = 'b';
-        ankle(fixme)->color       = 'b';
-        grandparent(fixme)->color = 'r';
+        set_color(tree, parent(fixme),      'b');
+        set_color(tree, ankle(fixme),       'b');
+        set_color(tree, grandparent(fixme), 'r');
 
         if (violatesRedProperty(grandparent(fixme)))
             restoreRedProperty(tree, grandparent(fixme));
@@ -243,15 +798,27 @@ static void restoreRedProperty(rbtree_t *tree, rbtree_node_t *fixme) {
     }
 }
 
-void *rbtree_insert(rbtree_t *tree, void *vnode) {
-    rbtree_node_t *x = tree_insert(tree, tree->root, vnode);
+RBTREE_API void *rbtree_insert(rbtree_t *tree, void *vnode) {
+    rbtree_node_t *x;
+
+    TRACE(tree, RBTREE_TRACE_INSERT, vnode);
+
+    if (txn_reserve(tree) != 0) return NULL;
+
+    x = tree_insert(tree, tree->root, vnode);
 
     if (x == NULL) return NULL;  /* can happen if malloc fails.. */
 
+    /* sizes must be right before any rotations */
+    update_max_extent(tree, x);
+    add_size(tree, parent(x), 1);
+
     if (violatesRedProperty(x))
         restoreRedProperty(tree, x);
 
-    return vnode;
+    if (is_red_node(tree->root)) set_color(tree, tree->root, 'b');
+
+    return x->data;
 }
 
 /* black-depth of fixme is one less than black-depth of sibling.
@@ -274,10 +841,10 @@ static void restoreBlackProperty(rbtree_t *tree, rbtree_node_t *fixme) {
      */
 
     if (!is_red_node(near_nieph(fixme)) && !is_red_node(far_nieph(fixme))) {
-        sibling(fixme)->color = 'r';
+        set_color(tree, sibling(fixme), 'r');
 
         if (is_red_node(parent(fixme))) {
-            parent(fixme)->color = 'b';
+            set_color(tree, parent(fixme), 'b');
 
         } else if (!is_root_node(parent(fixme))) {
             restoreBlackProperty(tree, parent(fixme));
@@ -297,20 +864,81 @@ static void restoreBlackProperty(rbtree_t *tree, rbtree_node_t *fixme) {
         rotateUp(tree, sibling(fixme));
 
         /* node that was our far nieph is now our ankle.. */
-        ankle(fixme)->color = 'b';
+        set_color(tree, ankle(fixme), 'b');
+    }
+}
+
+/* a node's pending shift applies to the node and to its whole subtree.
+ * apply it to the node's own key and hand it down to the children.
+ */
+static void push_shift(rbtree_t *tree, rbtree_node_t *node) {
+    long delta;
+
+    if (node == NULL || tree->shift_offset == 0) return;
+    if ((delta = *pending_shift(tree, node)) == 0) return;
+
+    log_node(tree, node);
+    log_node(tree, node->lchild);
+    log_node(tree, node->rchild);
+    log_shift(tree, node->data, delta);
+
+    tree->shift(node->data, delta);
+
+    if (node->lchild != NULL) *pending_shift(tree, node->lchild) += delta;
+    if (node->rchild != NULL) *pending_shift(tree, node->rchild) += delta;
+
+    *pending_shift(tree, node) = 0;
+}
+
+RBTREE_API void rbtree_shift_keys(rbtree_t *tree, void *from, long delta) {
+    rbtree_node_t *node = tree->root;
+
+    if (tree->shift == NULL) return;
+
+    /* cached nodes may be under a pending shift, with stale keys */
+    rbtree_cache_clear(tree);
+
+    if (txn_reserve(tree) != 0) return;
+
+    /* if node is >= from, so is its entire right subtree; shift node
+     * now, leave a pending shift on the right subtree, and look for
+     * more shiftable nodes on the left.
+     */
+    while (node != NULL) {
+        push_shift(tree, node);
+
+        if (tree->cmp(node->data, from) >= 0) {
+            log_shift(tree, node->data, delta);
+            tree->shift(node->data, delta);
+
+            if (node->rchild != NULL) {
+                log_node(tree, node->rchild);
+                *pending_shift(tree, node->rchild) += delta;
+            }
+
+            node = node->lchild;
+
+        } else {
+            node = node->rchild;
+        }
     }
 }
 
-void *rbtree_delete(rbtree_t *tree, void *vnode) {
-    rbtree_node_t *delete_me, *childOrNull, search;
+RBTREE_API void *rbtree_delete(rbtree_t *tree, void *vnode) {
+    rbtree_node_t *delete_me, search;
     void *user_data;
 
+    TRACE(tree, RBTREE_TRACE_DELETE, vnode);
+
+    if (txn_reserve(tree) != 0) return NULL;
+
     search.data = vnode;
     delete_me = rec_rbtree_find(tree, tree->root, &search);
 
     if (delete_me == NULL) { return NULL; }
 
-    user_data = delete_me->data;
+    /* an inline value dies with its node.. */
+    user_data = is_inline(tree) ? vnode : delete_me->data;
 
     /* ensure delete_me has at least one NULL child node.
      * if delete_me has two non-null child nodes, exchange
@@ -319,28 +947,245 @@ void *rbtree_delete(rbtree_t *tree, void *vnode) {
      */
 
     if (delete_me->lchild != NULL && delete_me->rchild != NULL) {
-        delete_me->data = successor(delete_me)->data;
-        delete_me       = successor(delete_me);
+        rbtree_node_t *next = successor(tree, delete_me);
+
+        log_node(tree, delete_me);
+
+        if (is_inline(tree))
+            memcpy(delete_me->payload, next->payload, tree->key_size + tree->value_size);
+        else
+            delete_me->data = next->data;
+
+        delete_me = next;
     }
 
-    if (!is_root_node(delete_me) && !is_red_node(delete_me)) {
+    remove_node(tree, delete_me);
+    cache_forget(tree, delete_me);
+    free_node(tree, delete_me);
+
+    return user_data;
+}
+
+/* take a node with at most one child out of the tree, without freeing it. */
+static void remove_node(rbtree_t *tree, rbtree_node_t *node) {
+    rbtree_node_t *childOrNull;
+
+    if (!is_root_node(node) && !is_red_node(node)) {
         /* in case anybody is looking, create required violation
          * of the black property
          */
-        delete_me->color = 'w';
-        restoreBlackProperty(tree, delete_me);
+        set_color(tree, node, 'w');
+        restoreBlackProperty(tree, node);
     }
 
-    childOrNull = delete_me->lchild != NULL ? delete_me->lchild
-                                            : delete_me->rchild;
+    childOrNull = node->lchild != NULL ? node->lchild
+                                       : node->rchild;
 
-    set_child(tree, parent(delete_me),
+    set_child(tree, parent(node),
                     childOrNull,
-                    is_left_child(delete_me));
+                    is_left_child(node));
 
-    tree->free(delete_me);
+    add_size(tree, parent(node), -1);
 
-    return user_data;
+    /* a red child may have moved up to the root */
+    if (is_red_node(tree->root)) set_color(tree, tree->root, 'b');
+}
+
+/* number of black nodes on each path from node down to a NULL child */
+static int black_height(rbtree_node_t *node) {
+    int height = 0;
+
+    for (; node != NULL; node = node->lchild)
+        if (!is_red_node(node)) ++height;
+
+    return height;
+}
+
+/* return the root of a tree holding left, then pivot, then right.
+ * every value in left must be <= pivot, and pivot <= every value in
+ * right.  left and right are valid red-black trees (or NULL) that don't
+ * belong to tree; their nodes and pivot become part of the result.
+ *
+ * the shorter tree hangs next to a node of the same black-height on
+ * the taller tree's facing spine, under a new red parent (pivot).  that
+ * is an insert as far as the rest of the tree can tell, and the usual
+ * red property repair finishes the job.  O(log(N)) time.
+ */
+static rbtree_node_t *join(rbtree_t *tree, rbtree_node_t *left,
+                           rbtree_node_t *pivot, rbtree_node_t *right) {
+    rbtree_node_t *root = tree->root, *tall, *node, *above = NULL;
+    bool left_taller;
+    int height, goal;
+
+    /* black roots can only help */
+    if (left  != NULL) set_color(tree, left,  'b');
+    if (right != NULL) set_color(tree, right, 'b');
+
+    left_taller = black_height(left) >= black_height(right);
+    tall   = left_taller ? left : right;
+    height = black_height(tall);
+    goal   = black_height(left_taller ? right : left);
+
+    /* walk down the facing spine to the first black node (or NULL)
+     * whose black-height matches the shorter tree.
+     */
+    for (node = tall; height > goal || is_red_node(node); ) {
+        push_shift(tree, node);
+        if (!is_red_node(node)) --height;
+
+        above = node;
+        node  = left_taller ? node->rchild : node->lchild;
+    }
+
+    push_shift(tree, node);
+    init_node(tree, pivot, pivot->data);
+
+    if (left_taller) {
+        set_lchild(tree, pivot, node);
+        set_rchild(tree, pivot, right);
+    } else {
+        set_lchild(tree, pivot, left);
+        set_rchild(tree, pivot, node);
+    }
+    update_size(tree, pivot);
+
+    tree->root = tall;
+    set_child(tree, above, pivot, !left_taller);
+
+    add_size(tree, above, tree->size_offset == 0 ? 0
+                          : (long) (subtree_size(tree, pivot) - subtree_size(tree, node)));
+
+    if (is_root_node(pivot))
+        set_color(tree, pivot, 'b');
+
+    else if (violatesRedProperty(pivot))
+        restoreRedProperty(tree, pivot);
+
+    set_color(tree, tree->root, 'b');
+
+    node = tree->root;
+    tree->root = root;
+
+    return node;
+}
+
+/* split the subtree at node into the values < key and those >= key. */
+static void split(rbtree_t *tree, rbtree_node_t *node, void *key,
+                  rbtree_node_t **left, rbtree_node_t **right) {
+    rbtree_node_t *lchild, *rchild;
+
+    if (node == NULL) {
+        *left = *right = NULL;
+        return;
+    }
+
+    push_shift(tree, node);
+
+    lchild = node->lchild;
+    rchild = node->rchild;
+    if (lchild != NULL) lchild->parent = NULL;
+    if (rchild != NULL) rchild->parent = NULL;
+
+    if (tree->cmp(node->data, key) < 0) {
+        split(tree, rchild, key, left, right);
+        *left = join(tree, lchild, node, *left);
+
+    } else {
+        split(tree, lchild, key, left, right);
+        *right = join(tree, *right, node, rchild);
+    }
+}
+
+RBTREE_API int rbtree_split(rbtree_t *tree, void *key, rbtree_t *right) {
+    rbtree_node_t *left;
+
+    if (tree->txn_open) return -1;
+
+    *right = *tree;
+    split(tree, tree->root, key, &left, &right->root);
+    tree->root = left;
+
+    rbtree_cache_clear(tree);
+    right->cache        = NULL;
+    right->cache_sets   = 0;
+    right->cache_hits   = 0;
+    right->cache_misses = 0;
+
+    right->undo       = NULL;
+    right->undo_len   = 0;
+    right->undo_cap   = 0;
+    right->undo_root  = NULL;
+    right->txn_failed = 0;
+
+    return 0;
+}
+
+RBTREE_API int rbtree_join(rbtree_t *tree, rbtree_t *right) {
+    rbtree_node_t *pivot;
+
+    if (tree->txn_open || right->txn_open) return -1;
+
+    if ((pivot = first_node(right)) == NULL) return 0;
+
+    /* the smallest node of right is the pivot */
+    remove_node(right, pivot);
+
+    tree->root  = join(tree, tree->root, pivot, right->root);
+    right->root = NULL;
+
+    rbtree_cache_clear(right);
+
+    return 0;
+}
+
+/* link nodes[0..n) into a balanced subtree.  the halves differ in size
+ * by at most one, so every NULL link is at depth floor(log2(n)) or one
+ * above it; the nodes at that depth are red and the rest black (but a
+ * lone root is black).
+ */
+static rbtree_node_t *build(rbtree_t *tree, rbtree_node_t **nodes, size_t n,
+                            int depth, int red_depth) {
+    size_t mid = n / 2;
+    rbtree_node_t *node;
+
+    if (n == 0) return NULL;
+
+    node        = nodes[mid];
+    node->color = depth == red_depth && depth > 0 ? 'r' : 'b';
+
+    set_lchild(tree, node, build(tree, nodes, mid, depth + 1, red_depth));
+    set_rchild(tree, node, build(tree, nodes + mid + 1, n - mid - 1, depth + 1, red_depth));
+    update_size(tree, node);
+
+    return node;
+}
+
+RBTREE_API int rbtree_build(rbtree_t *tree, void **values, size_t n) {
+    rbtree_node_t **nodes;
+    size_t i;
+    int red_depth = 0;
+
+    if (tree->root != NULL || tree->txn_open) return -1;
+    if (n == 0) return 0;
+
+    if ((nodes = (rbtree_node_t **) tree->malloc(n * sizeof(rbtree_node_t *))) == NULL)
+        return -1;
+
+    for (i = 0; i < n; ++i) {
+        if ((nodes[i] = new_node(tree, values[i])) == NULL) {
+            while (i > 0) free_node(tree, nodes[--i]);
+
+            tree->free(nodes);
+            return -1;
+        }
+    }
+
+    while (((size_t) 2 << red_depth) <= n) ++red_depth;
+
+    tree->root = build(tree, nodes, n, 0, red_depth);
+    tree->free(nodes);
+
+    return 0;
 }
 
 static rbtree_node_t *first_node(rbtree_t *tree) {
@@ -348,36 +1193,138 @@ static rbtree_node_t *first_node(rbtree_t *tree) {
     if (tree->root == NULL) { return NULL; }
 
     node = tree->root;
-    while (node->lchild != NULL) { node = node->lchild; }
+    push_shift(tree, node);
+    while (node->lchild != NULL) {
+        node = node->lchild;
+        push_shift(tree, node);
+    }
 
     return node;
 }
 
-rbtree_iter_t rbtree_iter(rbtree_t *tree) {
+RBTREE_API rbtree_iter_t rbtree_iter(rbtree_t *tree) {
     rbtree_iter_t iter;
 
-    iter.next_node = first_node(tree);
+    /* only a traced tree counts its iterators; others may be shared by
+     * several reading threads
+     */
+    iter.id = tree->trace != NULL ? ++tree->iter_ids : 0;
+
+    TRACE(tree, RBTREE_TRACE_ITER, &iter);
+
+    iter.next_node = txn_reserve_read(tree) == 0 ? first_node(tree) : NULL;
     iter.tree = tree;
 
     return iter;
 }
 
-void *rbtree_iter_next(rbtree_iter_t *iter) {
+RBTREE_API void *rbtree_iter_next(rbtree_iter_t *iter) {
     void *result;
 
+    TRACE(iter->tree, RBTREE_TRACE_ITER_NEXT, iter);
+
     if (iter->next_node == NULL) { return NULL; }
 
+    if (txn_reserve_read(iter->tree) != 0) { return iter->next_node = NULL; }
+
     /* we will return the data pointed to by the current node; remember it. */
     result = iter->next_node->data;
 
     /* find the node that will be returned the next time we are called */
-    iter->next_node = successor(iter->next_node);
+    iter->next_node = successor(iter->tree, iter->next_node);
 
     return result;
 }
 
-void *rbtree_first(rbtree_t *tree) {
-    rbtree_node_t *node = first_node(tree);
+RBTREE_API size_t rbtree_size(rbtree_t *tree) {
+    return subtree_size(tree, tree->root);
+}
+
+RBTREE_API rbtree_node_t *rbtree_node_at(rbtree_t *tree, size_t index) {
+    rbtree_node_t *node = tree->root;
+
+    if (txn_reserve_read(tree) != 0) return NULL;
+
+    /* the left subtree holds the first subtree_size(lchild) values */
+    while (node != NULL) {
+        size_t left;
+
+        push_shift(tree, node);
+        left = subtree_size(tree, node->lchild);
+
+        if (index == left)
+            return node;
+
+        else if (index < left)
+            node = node->lchild;
+
+        else {
+            index -= left + 1;
+            node = node->rchild;
+        }
+    }
+
+    return NULL;
+}
+
+RBTREE_API size_t rbtree_node_rank(rbtree_t *tree, rbtree_node_t *node) {
+    size_t rank;
+
+    if (node == NULL) return rbtree_size(tree);
+
+    /* count what's to our left, on the way up to the root */
+    rank = subtree_size(tree, node->lchild);
+
+    for (; !is_root_node(node); node = parent(node)) {
+        if (!is_left_child(node))
+            rank += subtree_size(tree, sibling(node)) + 1;
+    }
+
+    return rank;
+}
+
+RBTREE_API rbtree_node_t *rbtree_node_next(rbtree_t *tree, rbtree_node_t *node) {
+    if (txn_reserve_read(tree) != 0) return NULL;
+
+    return node == NULL ? first_node(tree) : successor(tree, node);
+}
+
+RBTREE_API rbtree_node_t *rbtree_node_prev(rbtree_t *tree, rbtree_node_t *node) {
+    rbtree_node_t *result;
+
+    if (node == NULL)
+        return rbtree_node_at(tree, rbtree_size(tree) - 1);
+
+    if (txn_reserve_read(tree) != 0) return NULL;
+
+    /* mirror image of successor() */
+    if (node->lchild != NULL) {
+        result = node->lchild;
+        push_shift(tree, result);
+
+        while (result->rchild != NULL) {
+            result = result->rchild;
+            push_shift(tree, result);
+        }
+
+    } else {
+        result = node;
+        while (result != NULL && is_left_child(result))
+            result = parent(result);
+
+        result = parent(result);
+    }
+    return result;
+}
+
+RBTREE_API void *rbtree_first(rbtree_t *tree) {
+    rbtree_node_t *node;
+
+    TRACE(tree, RBTREE_TRACE_FIRST, NULL);
+
+    if (txn_reserve_read(tree) != 0) { return NULL; }
+
+    node = first_node(tree);
     if (node == NULL) { return NULL; }
 
     return node->data;
@@ -446,20 +1393,30 @@ static bool is_left_child(rbtree_node_t *node) {
            : parent(node)->lchild == node;
 }
 
+static bool is_inline(rbtree_t *tree) {
+    return tree->key_size + tree->value_size > 0;
+}
+
 static bool is_root_node(rbtree_node_t *node) {
     return node != NULL && parent(node) == NULL;
 }
 
-static rbtree_node_t *successor(rbtree_node_t *node) {
+/* nodes on the path from the root to node must have no pending shift;
+ * the nodes we descend through on the way to the successor are pushed.
+ */
+static rbtree_node_t *successor(rbtree_t *tree, rbtree_node_t *node) {
     rbtree_node_t *result;
 
     if (node == NULL) return NULL;
 
     if (node->rchild != NULL) {
         result = node->rchild;
+        push_shift(tree, result);
 
-        while (result->lchild != NULL)
+        while (result->lchild != NULL) {
             result = result->lchild;
+            push_shift(tree, result);
+        }
 
     } else {
         result = node;
@@ -471,25 +1428,57 @@ static rbtree_node_t *successor(rbtree_node_t *node) {
     return result;
 }
 
-static void init_node(rbtree_node_t *node, void *vnode) {
+static void init_node(rbtree_t *tree, rbtree_node_t *node, void *vnode) {
     node->parent = NULL;
     node->lchild = node->rchild = NULL;
     node->color  = 'r';
     node->data   = vnode;
+
+    if (tree->shift_offset != 0) *pending_shift(tree, node) = 0;
+    if (tree->size_offset != 0)  *kept_size(tree, node) = 1;
 }
 
 static rbtree_node_t *new_node(rbtree_t *tree, void *vnode) {
-    rbtree_node_t *x = (rbtree_node_t *) tree->malloc(sizeof(rbtree_node_t));
+    rbtree_node_t *x;
+
+    if (tree->alloc != NULL)
+        x = (rbtree_node_t *) tree->alloc(tree->alloc_ctx, rbtree_node_size(tree));
+    else
+        x = (rbtree_node_t *) tree->malloc(rbtree_node_size(tree));
+
+    if (x != NULL && is_inline(tree)) {
+        memcpy(x->payload, vnode, tree->key_size + tree->value_size);
+        init_node(tree, x, x->payload);
 
-    if (x != NULL) {
-        init_node(x, vnode);
+    } else if (x != NULL) {
+        init_node(tree, x, vnode);
     }
 
+    if (x != NULL && tree->txn_open) txn_log(tree, UNDO_NEW, x);
+
     return x;
 }
 
+/* in a transaction, the node is freed at commit. */
+static void free_node(rbtree_t *tree, rbtree_node_t *node) {
+    if (tree->txn_open)
+        txn_log(tree, UNDO_FREE, node);
+    else
+        release_node(tree, node);
+}
+
+static void release_node(rbtree_t *tree, rbtree_node_t *node) {
+    if (tree->alloc != NULL)
+        tree->dealloc(tree->alloc_ctx, node);
+    else
+        tree->free(node);
+}
+
 static rbtree_node_t *set_child(rbtree_t *tree, rbtree_node_t *node,
                                 rbtree_node_t *child, bool left_child) {
+    log_node(tree, node);
+    log_node(tree, child);
+
     if (node == NULL)
         tree->root = child;
 
@@ -514,3 +1503,59 @@ static rbtree_node_t *set_rchild(rbtree_t *tree, rbtree_node_t *node,
                                            rbtree_node_t *child) {
     return set_child(tree, node, child, false);
 }
+
+/* O(1) with rbtree_set_ranks(); else the nodes are counted. */
+static size_t subtree_size(rbtree_t *tree, rbtree_node_t *node) {
+    if (node == NULL) return 0;
+
+    if (tree->size_offset != 0) return *kept_size(tree, node);
+
+    return subtree_size(tree, node->lchild) + subtree_size(tree, node->rchild) + 1;
+}
+
+static void set_color(rbtree_t *tree, rbtree_node_t *node, char color) {
+    log_node(tree, node);
+    node->color = color;
+}
+
+static void update_size(rbtree_t *tree, rbtree_node_t *node) {
+    if (tree->size_offset != 0) {
+        log_node(tree, node);
+        *kept_size(tree, node) = subtree_size(tree, node->lchild)
+                                 + subtree_size(tree, node->rchild) + 1;
+    }
+    update_max_extent(tree, node);
+}
+
+/* add delta to the size of node and each of its ancestors, whose
+ * subtrees changed below them.
+ */
+static void add_size(rbtree_t *tree, rbtree_node_t *node, long delta) {
+    if (tree->size_offset == 0 && tree->extent == NULL) return;
+
+    for (; node != NULL; node = parent(node)) {
+        if (tree->size_offset != 0) {
+            log_node(tree, node);
+            *kept_size(tree, node) += delta;
+        }
+        update_max_extent(tree, node);
+    }
+}
+
+static void update_max_extent(rbtree_t *tree, rbtree_node_t *node) {
+    size_t max;
+
+    if (tree->extent == NULL) return;
+
+    max = tree->extent(node->data);
+
+    if (node->lchild != NULL && *max_extent(tree, node->lchild) > max)
+        max = *max_extent(tree, node->lchild);
+    if (node->rchild != NULL && *max_extent(tree, node->rchild) > max)
+        max = *max_extent(tree, node->rchild);
+
+    log_node(tree, node);
+    *max_extent(tree, node) = max;
+}
+
+#undef TRACE
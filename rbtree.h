@@ -16,47 +16,309 @@ extern "C" {
 #include <stdlib.h>
 #include <unistd.h>
 
+/* define RBTREE_HEADER_ONLY before including rbtree.h to compile the
+ * implementation into the including file as static inline functions.
+ * the compiler can then inline rbtree_find() and friends into their
+ * callers, and when the tree's cmp function is known at the call site,
+ * call it directly or inline it too.  rbtree.o is not needed for such
+ * a file (but is for the other rbtree_*.c modules).
+ *
+ * the implementation's internal helpers (parent(), sibling(), ..) become
+ * static functions in the including file, so their names are taken.
+ */
+#ifdef RBTREE_HEADER_ONLY
+#define RBTREE_API static inline
+#else
+#define RBTREE_API
+#endif
+
 typedef int (rbtree_cmp_t)(const void *, const void *);
 
 typedef void *(rbtree_malloc_t)(size_t size);
 typedef void  (rbtree_free_t)(void *ptr);
 
+typedef void *(rbtree_alloc_t)(void *ctx, size_t size);
+typedef void  (rbtree_dealloc_t)(void *ctx, void *ptr);
+
+typedef void (rbtree_shift_t)(void *data, long delta);
+
+typedef size_t (rbtree_hash_t)(const void *data);
+
+typedef size_t (rbtree_extent_t)(const void *data);
+
+/* public operations, as reported to a trace hook */
+typedef enum {
+    RBTREE_TRACE_FIND,
+    RBTREE_TRACE_INSERT,
+    RBTREE_TRACE_DELETE,
+    RBTREE_TRACE_FIRST,
+    RBTREE_TRACE_ITER,
+    RBTREE_TRACE_ITER_NEXT
+} rbtree_trace_op_t;
+
+typedef void (rbtree_trace_hook_t)(void *ctx, rbtree_trace_op_t op, const void *data);
+
 #include "rbtree_private.h"
 
 /* initialize a red-black tree with user-provided comparison function */
-void rbtree_init(rbtree_t *tree, rbtree_cmp_t *cmp);
+RBTREE_API void rbtree_init(rbtree_t *tree, rbtree_cmp_t *cmp);
+
+/* initialize a red-black tree that stores fixed-size user data values
+ * inside its own nodes.  each value is key_size bytes of key followed by
+ * value_size bytes of value, and cmp compares two such values.
+ *
+ * rbtree_insert() copies key_size + value_size bytes from the value it is
+ * given into a new node, and returns a pointer to the copy.  pointers
+ * returned by rbtree_insert(), rbtree_find(), etc. point into the tree's
+ * nodes, and are valid until the next rbtree_delete().  rbtree_delete()
+ * returns its argument if a value was deleted.
+ */
+RBTREE_API void rbtree_init_inline(rbtree_t *tree, rbtree_cmp_t *cmp,
+                                   size_t key_size, size_t value_size);
 
 /* set optional custom malloc and free functions for internals of rbtree implementation */ 
-void rbtree_set_malloc_free(rbtree_t *tree, rbtree_malloc_t *malloc, rbtree_free_t *free);
+RBTREE_API void rbtree_set_malloc_free(rbtree_t *tree, rbtree_malloc_t *malloc, rbtree_free_t *free);
+
+/* set optional allocator for internals of rbtree implementation that is
+ * passed a context pointer on each call (a memory segment, a pool, ..).
+ * overrides the malloc and free functions.  pass NULL alloc to go back
+ * to malloc and free.
+ */
+RBTREE_API void rbtree_set_allocator(rbtree_t *tree, rbtree_alloc_t *alloc,
+                                     rbtree_dealloc_t *dealloc, void *ctx);
+
+/* return the size of each allocation made for the tree's internals.
+ * on a 64-bit machine a node takes 40 bytes:  the value pointer, three
+ * links and the color.  an inline tree adds key_size + value_size, and
+ * each of rbtree_set_shift(), rbtree_set_ranks() and rbtree_set_extent()
+ * 8 bytes more (rounded up to a multiple of 8).
+ *
+ * those three make every node bigger, so trees that don't call them
+ * don't pay for them.  the first call of each must be made while the
+ * tree is empty and not in a transaction, before an allocator is set
+ * for it (rbtree_set_allocator(), rbtree_set_pool()).
+ */
+RBTREE_API size_t rbtree_node_size(rbtree_t *tree);
+
+/* enable lazy key shifting.  shift(data, delta) must add delta to
+ * the key of the user data value "data".  each node keeps a pending
+ * shift for its subtree.  return 0, or -1 if the nodes have no room
+ * for one (see rbtree_node_size()).
+ */
+RBTREE_API int rbtree_set_shift(rbtree_t *tree, rbtree_shift_t *shift);
+
+/* add delta to the key of every user data value that is >= from.
+ * keys are shifted lazily, so this takes O(log(N)) time.
+ *
+ * requires rbtree_set_shift().  the shift must preserve the order of
+ * the tree; i.e., a negative delta must not move any shifted key
+ * below an unshifted one.
+ */
+RBTREE_API void rbtree_shift_keys(rbtree_t *tree, void *from, long delta);
+
+/* keep, in each node, the largest extent(data) of the values in its
+ * subtree, for rbtree_find_first_fit().  extent(data) is typically the
+ * length of a free block whose address is the key.
+ *
+ * the first call must be made while the nodes can still grow (see
+ * rbtree_node_size()).  after that it may be called at any time but in
+ * a transaction; the tree's nodes are brought up to date in O(N) time.
+ * pass NULL extent to stop.  return 0, or -1 if the tree is in a
+ * transaction, or its nodes have no room for a max extent.
+ */
+RBTREE_API int rbtree_set_extent(rbtree_t *tree, rbtree_extent_t *extent);
+
+/* return the first value in the tree whose extent is >= size, or NULL
+ * if there is none.  requires rbtree_set_extent().  O(log(N)) time.
+ */
+RBTREE_API void *rbtree_find_first_fit(rbtree_t *tree, size_t size);
+
+/* call after changing the extent of data, a value in the tree, in place.
+ * O(log(N)) time.
+ */
+RBTREE_API void rbtree_update_extent(rbtree_t *tree, void *data);
+
+/* set optional hook that is called on entry to each public operation,
+ * with the user data value it was passed; for rbtree_iter() and
+ * rbtree_iter_next(), the rbtree_iter_t instead, whose id field numbers
+ * the iterators made while tracing, and for rbtree_first(), NULL.
+ * pass NULL hook to stop tracing.  see rbtree_trace.h.
+ */
+RBTREE_API void rbtree_set_trace(rbtree_t *tree, rbtree_trace_hook_t *hook, void *ctx);
+
+/* keep a cache of about "entries" recently found nodes, so that finds of
+ * popular keys skip the descent through the tree.  hash(data) must give
+ * equal values equal hashes, and should spread its result over all the
+ * low bits.  the cache is 2-way set associative: each key has two places
+ * it can go, and the more recently used one is kept.
+ *
+ * pass 0 entries to turn the cache off and free it.  return 0, or -1 if
+ * the cache can't be allocated.
+ *
+ * deletes forget the nodes they free, but rbtree_shift_keys() and
+ * rbtree_split() simply empty the cache, as rbtree_join() does for the
+ * tree it empties.  a find writes to the cache, so with a cache a tree
+ * can't be searched by several threads at once.
+ */
+RBTREE_API int rbtree_set_cache(rbtree_t *tree, rbtree_hash_t *hash, size_t entries);
+
+/* forget every node in the cache. */
+RBTREE_API void rbtree_cache_clear(rbtree_t *tree);
+
+/* report the finds that hit and missed the cache, since it was set. */
+RBTREE_API void rbtree_cache_stats(rbtree_t *tree, unsigned long *hits, unsigned long *misses);
 
 /* binary search for a node equal to vsearch.  if not found, return NULL. */
-void *rbtree_find(rbtree_t *tree, void *vsearch);
+RBTREE_API void *rbtree_find(rbtree_t *tree, void *vsearch);
+
+/* return 1 if rbtree_find() writes nothing to tree, so that several
+ * threads may search it at once:  it has no lazy key shifting, cache or
+ * trace hook, and no open transaction.  else return 0.
+ */
+RBTREE_API int rbtree_find_is_read_only(rbtree_t *tree);
+
+/* find each of n search values, as rbtree_find(), and set out[i] to the
+ * value found for keys[i] or NULL.  return the number found.
+ *
+ * when the keys are sorted, each search starts where the last one ended
+ * rather than at the root; it climbs only as far as needed to reach a
+ * subtree that can hold the key.  a sorted batch of n keys then takes
+ * O(n log(N/n)) compares rather than O(n log(N)).  unsorted keys work
+ * too, but gain nothing.
+ */
+RBTREE_API size_t rbtree_find_sorted_batch(rbtree_t *tree, void **keys, size_t n, void **out);
 
 /* return smallest user data value in the tree, or NULL if tree is empty. */
-void *rbtree_first(rbtree_t *tree);
+RBTREE_API void *rbtree_first(rbtree_t *tree);
 
 /* delete node equal to z from the tree; return deleted value,
  * or NULL if nothing was deleted.
  */
-void *rbtree_delete(rbtree_t *tree, void *z);
+RBTREE_API void *rbtree_delete(rbtree_t *tree, void *z);
 
 /* insert node x into the tree; on any failure (i.e., internal
  * malloc fails), return NULL.  otherwise, return inserted value.
  */
-void *rbtree_insert(rbtree_t *tree, void *x);
+RBTREE_API void *rbtree_insert(rbtree_t *tree, void *x);
+
+/* transactions:  make a group of inserts, deletes and key shifts take
+ * effect together, or not at all.
+ *
+ * while a transaction is open, each change to the tree's nodes is
+ * recorded in an undo log, and the nodes of deleted values are freed
+ * only at commit.  rbtree_txn_abort() puts the tree back as it was at
+ * rbtree_txn_begin() in time proportional to the changes made since:
+ * deleted values are back, inserted ones are gone, shifted keys are
+ * shifted back.
+ *
+ * in a transaction, an insert, delete or key shift also fails (returns
+ * NULL, or for rbtree_shift_keys() does nothing) if the undo log can't
+ * grow, and rbtree_txn_commit() then aborts instead.  with lazy key
+ * shifting, finds and iteration may push pending shifts down, so they
+ * need log room too:  if they can't get it they return NULL with errno
+ * set to ENOMEM, and the transaction is unharmed.  so to tell that from
+ * a miss, set errno to 0 before the call.
+ *
+ * transactions don't nest, and rbtree_split(), rbtree_join(),
+ * rbtree_build(), rbtree_set_extent() and batches (rbtree_batch.h) fail
+ * in one.  the trace hook sees the operations of aborted transactions
+ * too.
+ *
+ * Usage:
+ *     rbtree_txn_begin(&tree);
+ *     if (rbtree_delete(&tree, &old) == NULL || rbtree_insert(&tree, &new) == NULL)
+ *         rbtree_txn_abort(&tree);
+ *     else
+ *         rbtree_txn_commit(&tree);
+ */
+
+/* start a transaction.  return 0, or -1 if one is already open or memory
+ * ran out.
+ */
+RBTREE_API int rbtree_txn_begin(rbtree_t *tree);
+
+/* keep the transaction's changes.  return 0, or -1 if there is no
+ * transaction, or an operation in it failed for lack of undo log memory
+ * (the transaction is then aborted).
+ */
+RBTREE_API int rbtree_txn_commit(rbtree_t *tree);
+
+/* undo the transaction's changes. */
+RBTREE_API void rbtree_txn_abort(rbtree_t *tree);
+
+/* move the values of tree that are >= key into right, and keep those
+ * that are < key.  right is set up like tree (same cmp, allocator, ..);
+ * whatever it held before is forgotten.  no nodes are allocated or
+ * freed.  O(log(N)) time per level of the tree, O(log(N)^2) in all.
+ * return 0, or -1 (and do nothing) if tree is in a transaction.
+ */
+RBTREE_API int rbtree_split(rbtree_t *tree, void *key, rbtree_t *right);
+
+/* move all values of right to the end of tree, leaving right empty.
+ * every value in right must be >= every value in tree, and the two
+ * trees must allocate their nodes the same way, with the same optional
+ * fields (see rbtree_node_size()).  O(log(N)) time.
+ * return 0, or -1 (and do nothing) if either tree is in a transaction.
+ */
+RBTREE_API int rbtree_join(rbtree_t *tree, rbtree_t *right);
+
+/* fill an empty tree with the n values, which must be in order, in O(N)
+ * time.  return 0, or -1 if the tree isn't empty, is in a transaction,
+ * or a node can't be allocated (the tree is then left empty).
+ */
+RBTREE_API int rbtree_build(rbtree_t *tree, void **values, size_t n);
 
 /* return an iterator for the elements in the tree */
-rbtree_iter_t rbtree_iter(rbtree_t *tree);
+RBTREE_API rbtree_iter_t rbtree_iter(rbtree_t *tree);
 
 /* return the next node in the tree.
  * NULL return value signals traversal is complete.
  *
  * please don't insert or delete nodes while iteration is happening..
  */
-void *rbtree_iter_next(rbtree_iter_t *iter);
+RBTREE_API void *rbtree_iter_next(rbtree_iter_t *iter);
+
+/* keep, in each node, the size of its subtree, for rbtree_size() and
+ * the position lookups below.  the nodes must have room for it (see
+ * rbtree_node_size()).  return 0, or -1 if they don't.
+ */
+RBTREE_API int rbtree_set_ranks(rbtree_t *tree);
+
+/* return the number of user data values in the tree.  O(1) time with
+ * rbtree_set_ranks(), else O(N).
+ */
+RBTREE_API size_t rbtree_size(rbtree_t *tree);
+
+/* node-level access, for iterators that can move both ways and jump.
+ * with rbtree_set_ranks(), a node can be found from its position, and
+ * its position from the node, in O(log(N)) time; without, in O(N).
+ * a node's user data value is node->data.
+ *
+ * NULL stands for the position one past the last node.  positions
+ * count from 0 in sorted order.
+ *
+ * nodes stay valid until they are deleted, but an rbtree_delete()
+ * may move another value into the node of the one deleted.
+ */
+
+/* return the node at position index, or NULL if index >= size. */
+RBTREE_API rbtree_node_t *rbtree_node_at(rbtree_t *tree, size_t index);
+
+/* return the position of node; rbtree_size() if node is NULL. */
+RBTREE_API size_t rbtree_node_rank(rbtree_t *tree, rbtree_node_t *node);
+
+/* return the node after node (the first node if node is NULL), or NULL. */
+RBTREE_API rbtree_node_t *rbtree_node_next(rbtree_t *tree, rbtree_node_t *node);
+
+/* return the node before node (the last node if node is NULL), or NULL. */
+RBTREE_API rbtree_node_t *rbtree_node_prev(rbtree_t *tree, rbtree_node_t *node);
 
 #ifdef __cplusplus
 }
 #endif
 
+#ifdef RBTREE_HEADER_ONLY
+#include "rbtree.c"
+#endif
+
 #endif
@@ -0,0 +1,327 @@
+/* rbtree.hpp, Copyright (C) 2016, Greg Johnson
+ * Released under the terms of the GNU GPL v2.0.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ */
+#ifndef RBTREE_HPP
+#define RBTREE_HPP
+
+#include <cstddef>
+#include <functional>
+#include <iterator>
+#include "rbtree.h"
+
+/* C++ interface to red-black trees (C++17; ranges need C++20).
+ *
+ * rbtree::tree<T, Compare> wraps an rbtree_t holding pointers to T.
+ * like the C interface, it does not own the values it holds.
+ * its iterators visit the values in order; they are bidirectional.
+ * its nodes keep their subtree sizes (rbtree_set_ranks()), which give
+ * O(log(N)) jumps by position, through tree.nth(i) and
+ * tree.index_of(it), and through the range tree.ranked(), whose
+ * iterators carry their position.  those are
+ * random access iterators whose difference and comparison are O(1), and
+ * whose jumps (it + n, it[n]) take O(log(N)) time; so the parallel
+ * algorithms (std::for_each(std::execution::par, ..), std::reduce, ..)
+ * can split a tree into pieces for their threads without walking it
+ * first.  threads may traverse a tree at the same time as long as no one
+ * modifies it and there are no pending key shifts.
+ *
+ * rbtree::frozen_map<K, V, N, Compare> is a read-only ordered map that
+ * is built at compile time, for lookup tables that are known when the
+ * program is built.  it needs no construction at startup.
+ *
+ * both order their elements with Compare, a "less than" function object
+ * as for std::map, so a table can move between the two by changing its
+ * type.  Compare must be default-constructible; the tree makes one each
+ * time it compares two elements.
+ *
+ * Usage:
+ *     rbtree::tree<my_data_t, my_less_t> tree;
+ *     tree.insert(&my_data);
+ *     found = tree.find(search);
+ *     for (my_data_t &data : tree) { .. }
+ *
+ *     constexpr auto opcodes = rbtree::make_frozen_map<std::string_view, int>({
+ *         {"add", 1}, {"sub", 2}, {"mul", 3},
+ *     });
+ *     const int *op = opcodes.find("sub");
+ */
+
+namespace rbtree {
+
+/* turn a "less than" function object into an rbtree_cmp_t. */
+template <class T, class Compare>
+int compare(const void *v1, const void *v2) {
+    const T &t1 = *static_cast<const T *>(v1);
+    const T &t2 = *static_cast<const T *>(v2);
+    Compare less;
+
+    return less(t1, t2) ? -1 : less(t2, t1) ? 1 : 0;
+}
+
+template <class T, class Compare = std::less<T>>
+class tree {
+  public:
+    class iterator {
+      public:
+        using iterator_category = std::bidirectional_iterator_tag;
+        using value_type        = T;
+        using difference_type   = std::ptrdiff_t;
+        using pointer           = T *;
+        using reference         = T &;
+
+        iterator() = default;
+
+        reference operator*() const { return *static_cast<T *>(node_->data); }
+        pointer operator->() const { return static_cast<T *>(node_->data); }
+
+        iterator &operator++() { node_ = rbtree_node_next(tree_, node_); return *this; }
+        iterator &operator--() { node_ = rbtree_node_prev(tree_, node_); return *this; }
+        iterator operator++(int) { iterator it = *this; ++*this; return it; }
+        iterator operator--(int) { iterator it = *this; --*this; return it; }
+
+        friend bool operator==(const iterator &a, const iterator &b) { return a.node_ == b.node_; }
+        friend bool operator!=(const iterator &a, const iterator &b) { return a.node_ != b.node_; }
+
+      private:
+        friend class tree;
+
+        iterator(rbtree_t *tree, rbtree_node_t *node) : tree_(tree), node_(node) {}
+
+        rbtree_t *tree_      = nullptr;
+        rbtree_node_t *node_ = nullptr;     /* nullptr is end() */
+    };
+
+    /* an iterator that also knows its position; see ranked(). */
+    class rank_iterator {
+      public:
+        using iterator_category = std::random_access_iterator_tag;
+        using value_type        = T;
+        using difference_type   = std::ptrdiff_t;
+        using pointer           = T *;
+        using reference         = T &;
+
+        rank_iterator() = default;
+
+        reference operator*() const { return *static_cast<T *>(node_->data); }
+        pointer operator->() const { return static_cast<T *>(node_->data); }
+        reference operator[](difference_type n) const { return *(*this + n); }
+
+        rank_iterator &operator++() { node_ = rbtree_node_next(tree_, node_); ++index_; return *this; }
+        rank_iterator &operator--() { node_ = rbtree_node_prev(tree_, node_); --index_; return *this; }
+        rank_iterator operator++(int) { rank_iterator it = *this; ++*this; return it; }
+        rank_iterator operator--(int) { rank_iterator it = *this; --*this; return it; }
+
+        rank_iterator &operator+=(difference_type n) {
+            if (n == 1) return ++*this;
+            if (n == -1) return --*this;
+            if (n != 0) node_ = rbtree_node_at(tree_, index_ += n);
+            return *this;
+        }
+        rank_iterator &operator-=(difference_type n) { return *this += -n; }
+
+        friend rank_iterator operator+(rank_iterator it, difference_type n) { return it += n; }
+        friend rank_iterator operator+(difference_type n, rank_iterator it) { return it += n; }
+        friend rank_iterator operator-(rank_iterator it, difference_type n) { return it -= n; }
+
+        friend difference_type operator-(const rank_iterator &a, const rank_iterator &b) {
+            return a.index_ - b.index_;
+        }
+
+        friend bool operator==(const rank_iterator &a, const rank_iterator &b) { return a.index_ == b.index_; }
+        friend bool operator!=(const rank_iterator &a, const rank_iterator &b) { return a.index_ != b.index_; }
+        friend bool operator<(const rank_iterator &a, const rank_iterator &b) { return a.index_ < b.index_; }
+        friend bool operator>(const rank_iterator &a, const rank_iterator &b) { return b < a; }
+        friend bool operator<=(const rank_iterator &a, const rank_iterator &b) { return !(b < a); }
+        friend bool operator>=(const rank_iterator &a, const rank_iterator &b) { return !(a < b); }
+
+      private:
+        friend class tree;
+
+        rank_iterator(rbtree_t *tree, rbtree_node_t *node, difference_type index)
+            : tree_(tree), node_(node), index_(index) {}
+
+        rbtree_t *tree_        = nullptr;
+        rbtree_node_t *node_   = nullptr;   /* nullptr past the end */
+        difference_type index_ = 0;
+    };
+
+    /* the values by position, for algorithms that want random access. */
+    class ranked_range {
+      public:
+        rank_iterator begin() const { return begin_; }
+        rank_iterator end() const { return end_; }
+
+      private:
+        friend class tree;
+
+        ranked_range(rank_iterator begin, rank_iterator end) : begin_(begin), end_(end) {}
+
+        rank_iterator begin_, end_;
+    };
+
+    tree() {
+        rbtree_init(&tree_, &compare<T, Compare>);
+        rbtree_set_ranks(&tree_);
+    }
+
+    tree(const tree &) = delete;
+    tree &operator=(const tree &) = delete;
+
+    /* nodes don't point back at their rbtree_t, so moving is a copy.
+     * other keeps its settings, but not the nodes, cache, trace hook or
+     * open transaction, which are ours now.
+     */
+    tree(tree &&other) : tree_(other.tree_) {
+        other.tree_.root         = nullptr;
+        other.tree_.cache        = nullptr;
+        other.tree_.cache_sets   = 0;
+        other.tree_.cache_hits   = 0;
+        other.tree_.cache_misses = 0;
+        other.tree_.trace        = nullptr;
+        other.tree_.trace_ctx    = nullptr;
+        other.tree_.iter_ids     = 0;
+        other.tree_.undo         = nullptr;
+        other.tree_.undo_len     = 0;
+        other.tree_.undo_cap     = 0;
+        other.tree_.undo_root    = nullptr;
+        other.tree_.txn_open     = 0;
+        other.tree_.txn_failed   = 0;
+    }
+
+    /* the values themselves belong to the caller. */
+    ~tree() {
+        if (tree_.txn_open) rbtree_txn_abort(&tree_);
+        clear();
+        rbtree_set_cache(&tree_, nullptr, 0);
+    }
+
+    /* return x, or nullptr if malloc fails. */
+    T *insert(T *x) { return static_cast<T *>(rbtree_insert(&tree_, x)); }
+
+    T *find(const T &key) {
+        return static_cast<T *>(rbtree_find(&tree_, const_cast<T *>(&key)));
+    }
+
+    /* return the value that was deleted, or nullptr if none. */
+    T *erase(const T &key) {
+        return static_cast<T *>(rbtree_delete(&tree_, const_cast<T *>(&key)));
+    }
+
+    T *first() { return static_cast<T *>(rbtree_first(&tree_)); }
+
+    bool empty() const { return tree_.root == nullptr; }
+
+    std::size_t size() { return rbtree_size(&tree_); }
+
+    iterator begin() { return iterator(&tree_, rbtree_node_next(&tree_, nullptr)); }
+    iterator end() { return iterator(&tree_, nullptr); }
+
+    /* the iterator at position i (end() if i == size()), in O(log(N)). */
+    iterator nth(std::size_t i) { return iterator(&tree_, rbtree_node_at(&tree_, i)); }
+
+    /* the position of it (size() for end()), in O(log(N)). */
+    std::size_t index_of(const iterator &it) { return rbtree_node_rank(&tree_, it.node_); }
+
+    ranked_range ranked() {
+        std::ptrdiff_t n = static_cast<std::ptrdiff_t>(size());
+
+        return ranked_range(rank_iterator(&tree_, rbtree_node_next(&tree_, nullptr), 0),
+                            rank_iterator(&tree_, nullptr, n));
+    }
+
+    void clear() {
+        while (!empty()) { rbtree_delete(&tree_, rbtree_first(&tree_)); }
+    }
+
+    rbtree_t *get() { return &tree_; }
+
+  private:
+    rbtree_t tree_;
+};
+
+template <class K, class V>
+struct frozen_entry {
+    K key{};
+    V value{};
+};
+
+/* the entries are kept in Eytzinger order: the entry at index i has
+ * children at 2i+1 and 2i+2, as in a binary heap, and an in-order walk of
+ * that implicit tree visits the keys in sorted order.  a lookup is a
+ * branch-light descent through an array whose top levels share a few
+ * cache lines.
+ */
+template <class K, class V, std::size_t N, class Compare = std::less<K>>
+class frozen_map {
+  public:
+    using entry = frozen_entry<K, V>;
+
+    constexpr frozen_map(const entry (&entries)[N]) : slots_() {
+        entry sorted[N > 0 ? N : 1] = {};
+
+        /* insertion sort; stable, and fine for compile-time tables */
+        for (std::size_t i = 0; i < N; ++i) {
+            std::size_t j = i;
+
+            for (; j > 0 && Compare()(entries[i].key, sorted[j - 1].key); --j) {
+                sorted[j] = sorted[j - 1];
+            }
+            sorted[j] = entries[i];
+        }
+
+        layout(sorted, 0, 0);
+    }
+
+    /* return the value of an entry with the given key, or nullptr. */
+    constexpr const V *find(const K &key) const {
+        std::size_t i = 0, found = N;
+
+        /* find the first entry not less than key.. */
+        while (i < N) {
+            if (!Compare()(slots_[i].key, key)) {
+                found = i;
+                i = 2 * i + 1;
+            } else {
+                i = 2 * i + 2;
+            }
+        }
+
+        /* ..and see if it is equal. */
+        if (found == N || Compare()(key, slots_[found].key)) return nullptr;
+
+        return &slots_[found].value;
+    }
+
+    constexpr bool contains(const K &key) const { return find(key) != nullptr; }
+
+    constexpr std::size_t size() const { return N; }
+
+  private:
+    /* fill the subtree at index i from sorted[next..]; return the index
+     * of the first sorted entry not used.
+     */
+    constexpr std::size_t layout(const entry *sorted, std::size_t i, std::size_t next) {
+        if (i >= N) return next;
+
+        next      = layout(sorted, 2 * i + 1, next);
+        slots_[i] = sorted[next++];
+
+        return layout(sorted, 2 * i + 2, next);
+    }
+
+    entry slots_[N > 0 ? N : 1];
+};
+
+template <class K, class V, class Compare = std::less<K>, std::size_t N>
+constexpr frozen_map<K, V, N, Compare> make_frozen_map(const frozen_entry<K, V> (&entries)[N]) {
+    return frozen_map<K, V, N, Compare>(entries);
+}
+
+}
+
+#endif
@@ -0,0 +1,188 @@
+/* rbtree_batch.c, Copyright (C) 2016, Greg Johnson
+ * Released under the terms of the GNU GPL v2.0.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ */
+#include <stdlib.h>
+#include <stdbool.h>
+#include <string.h>
+#include <pthread.h>
+#include "rbtree_batch.h"
+
+/* Batch apply by split and join (after Blelloch, Ferizovic & Sun, "Just
+ * Join for Parallel Ordered Sets", 2016).
+ *
+ * A task is a tree and the sorted ops that fall in its key range.  A
+ * task with few ops or no spare threads applies them one at a time.
+ * Otherwise it splits its tree at the first key of the upper half of
+ * its ops, hands the lower half to a new thread, does the upper half
+ * itself, and joins the two trees when both are done.  The two halves
+ * share no nodes, so they need no locking.
+ *
+ * The halves of the batch are split between runs of equal keys, so that
+ * all ops on a key are applied by one thread, in batch order.
+ */
+
+#define MIN_PARALLEL 1024   /* fewer ops than this aren't worth a thread */
+
+typedef struct {
+    rbtree_t tree;
+    rbtree_batch_t **ops;
+    size_t n;
+    int nthreads;
+    bool failed;
+} task_t;
+
+static void apply(task_t *task);
+
+/* stable merge sort of ops[0..n) by data, using tmp as scratch */
+static void sort(rbtree_cmp_t *cmp, rbtree_batch_t **ops, rbtree_batch_t **tmp, size_t n) {
+    size_t half = n / 2, i = 0, j = half, k = 0;
+
+    if (n < 2) return;
+
+    sort(cmp, ops, tmp, half);
+    sort(cmp, ops + half, tmp, n - half);
+
+    while (i < half && j < n)
+        tmp[k++] = cmp(ops[j]->data, ops[i]->data) < 0 ? ops[j++] : ops[i++];
+
+    while (i < half)
+        tmp[k++] = ops[i++];
+
+    memcpy(ops, tmp, k * sizeof(rbtree_batch_t *));
+}
+
+static void apply_serial(task_t *task) {
+    size_t i;
+
+    for (i = 0; i < task->n; ++i) {
+        rbtree_batch_t *op = task->ops[i];
+
+        if (op->op == RBTREE_BATCH_INSERT) {
+            if ((op->value = rbtree_find(&task->tree, op->data)) != NULL)
+                op->result = RBTREE_BATCH_EXISTED;
+
+            else if ((op->value = rbtree_insert(&task->tree, op->data)) != NULL)
+                op->result = RBTREE_BATCH_INSERTED;
+
+            else {
+                op->result   = RBTREE_BATCH_FAILED;
+                task->failed = true;
+            }
+
+        } else {
+            op->value  = rbtree_delete(&task->tree, op->data);
+            op->result = op->value != NULL ? RBTREE_BATCH_DELETED : RBTREE_BATCH_NOT_FOUND;
+        }
+    }
+}
+
+static void *apply_thread(void *arg) {
+    apply((task_t *) arg);
+
+    return NULL;
+}
+
+/* return the index nearest the middle of ops that starts a run of equal
+ * keys, or 0 if all of the keys are equal.
+ */
+static size_t middle(task_t *task) {
+    rbtree_cmp_t *cmp = task->tree.cmp;
+    rbtree_batch_t **ops = task->ops;
+    size_t down = task->n / 2, up = down;
+
+    while (down > 0 && cmp(ops[down - 1]->data, ops[down]->data) == 0)
+        --down;
+
+    while (up < task->n && cmp(ops[up - 1]->data, ops[up]->data) == 0)
+        ++up;
+
+    if (down == 0) return up == task->n ? 0 : up;
+    if (up == task->n) return down;
+
+    return task->n / 2 - down <= up - task->n / 2 ? down : up;
+}
+
+static void apply(task_t *task) {
+    task_t lower, upper;
+    pthread_t thread;
+    size_t mid;
+
+    if (task->nthreads <= 1 || task->n < MIN_PARALLEL || (mid = middle(task)) == 0) {
+        apply_serial(task);
+        return;
+    }
+
+    lower = upper = *task;
+
+    rbtree_split(&lower.tree, task->ops[mid]->data, &upper.tree);
+
+    lower.n        = mid;
+    lower.nthreads = task->nthreads / 2;
+    upper.ops      = task->ops + mid;
+    upper.n        = task->n - mid;
+    upper.nthreads = task->nthreads - lower.nthreads;
+
+    if (pthread_create(&thread, NULL, apply_thread, &lower) != 0) {
+        apply(&lower);
+        apply(&upper);
+
+    } else {
+        apply(&upper);
+        pthread_join(thread, NULL);
+    }
+
+    rbtree_join(&lower.tree, &upper.tree);
+
+    task->tree.root = lower.tree.root;
+    task->failed    = lower.failed || upper.failed;
+}
+
+int rbtree_apply_batch(rbtree_t *tree, rbtree_batch_t *ops, size_t n, int nthreads) {
+    rbtree_batch_t **sorted, **tmp;
+    task_t task;
+    size_t i;
+
+    sorted = (rbtree_batch_t **) malloc(n * sizeof(rbtree_batch_t *));
+    tmp    = (rbtree_batch_t **) malloc(n * sizeof(rbtree_batch_t *));
+
+    /* a batch works on copies of the tree, which the undo log can't follow */
+    if (tree->txn_open || (n > 0 && (sorted == NULL || tmp == NULL))) {
+        for (i = 0; i < n; ++i) {
+            ops[i].result = RBTREE_BATCH_FAILED;
+            ops[i].value  = NULL;
+        }
+
+        free(sorted);
+        free(tmp);
+        return -1;
+    }
+
+    for (i = 0; i < n; ++i)
+        sorted[i] = &ops[i];
+
+    sort(tree->cmp, sorted, tmp, n);
+    free(tmp);
+
+    task.tree     = *tree;
+    task.ops      = sorted;
+    task.n        = n;
+    task.nthreads = nthreads;
+    task.failed   = false;
+
+    /* not to be used from several threads */
+    rbtree_set_trace(&task.tree, NULL, NULL);
+    task.tree.cache = NULL;
+
+    apply(&task);
+
+    tree->root = task.tree.root;
+    rbtree_cache_clear(tree);
+    free(sorted);
+
+    return task.failed ? -1 : 0;
+}
@@ -0,0 +1,77 @@
+/* rbtree_batch.h, Copyright (C) 2016, Greg Johnson
+ * Released under the terms of the GNU GPL v2.0.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ */
+#ifndef RBTREE_BATCH_H
+#define RBTREE_BATCH_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include "rbtree.h"
+
+/* apply a large batch of inserts and deletes to a tree, using several
+ * threads.
+ *
+ * the batch is sorted by key, and the tree is split (rbtree_split())
+ * at the key in the middle of the batch.  the two halves of the batch
+ * are applied to the two halves of the tree in parallel, recursively,
+ * and the halves are joined back together (rbtree_join()).
+ *
+ * a batch insert adds its value only if the tree has no value equal to
+ * it; unlike rbtree_insert(), it never adds a duplicate.  ops on equal
+ * keys are applied in the order they appear in the batch.
+ *
+ * with nthreads > 1, the tree's allocator is called from several threads
+ * at once, so it must be thread-safe (malloc, or an rbtree_pool_t).
+ * the tree's trace hook is not called for the ops in a batch, and its
+ * hot-key cache (rbtree_set_cache()) is emptied.
+ *
+ * Usage:
+ *     rbtree_batch_t ops[] = {
+ *         {RBTREE_BATCH_INSERT, &data1},
+ *         {RBTREE_BATCH_DELETE, &data2},
+ *     };
+ *     rbtree_apply_batch(&tree, ops, 2, 8);
+ *     if (ops[0].result == RBTREE_BATCH_EXISTED) ...
+ */
+
+typedef enum {
+    RBTREE_BATCH_INSERT,
+    RBTREE_BATCH_DELETE
+} rbtree_batch_op_t;
+
+typedef enum {
+    RBTREE_BATCH_INSERTED,
+    RBTREE_BATCH_EXISTED,       /* insert found an equal value */
+    RBTREE_BATCH_DELETED,
+    RBTREE_BATCH_NOT_FOUND,     /* delete found nothing */
+    RBTREE_BATCH_FAILED         /* insert couldn't allocate a node, or the batch failed */
+} rbtree_batch_result_t;
+
+typedef struct {
+    rbtree_batch_op_t op;
+    void *data;
+
+    /* set by rbtree_apply_batch() */
+    rbtree_batch_result_t result;
+    void *value;    /* value now in the tree, or the one deleted; or NULL */
+} rbtree_batch_t;
+
+/* apply the n ops to tree, using up to nthreads threads (including the
+ * caller).  return 0, or -1 if any op failed, or memory ran out for the
+ * batch itself or the tree is in a transaction (rbtree_txn_begin()), in
+ * which case nothing was applied and every op is RBTREE_BATCH_FAILED.
+ */
+int rbtree_apply_batch(rbtree_t *tree, rbtree_batch_t *ops, size_t n, int nthreads);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
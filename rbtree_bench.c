@@ -0,0 +1,244 @@
+/* rbtree_bench.c, Copyright (C) 2016, Greg Johnson
+ * Released under the terms of the GNU GPL v2.0.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <pthread.h>
+#include "rbtree.h"
+#include "rbtree_sync.h"
+#include "rbtree_workload.h"
+#include "rbtree_perf.h"
+
+/* contention benchmark for the thread-safe front ends.
+ *
+ * usage:  rbtree_bench [-t threads] [-n ops-per-thread] [-k keys] [-w write-percent]
+ *         rbtree_bench -a keys
+ *
+ * each thread does a random mix of finds and writes on random keys.  a
+ * write deletes the key if it is in the tree and inserts it otherwise;
+ * thread t only writes keys k with k % threads == t, so it knows which
+ * of its keys are in the tree.  the tree starts out with the even keys.
+ *
+ * with -a, run each of the adversarial workloads of rbtree_workload.h
+ * on that many keys instead, in one thread, and report the latency
+ * distribution of each kind of op.  each workload is then run again
+ * without the clock, under the hardware performance counters
+ * (rbtree_perf.h), which are reported per step.
+ */
+
+typedef struct {
+    const char *name;
+    rbtree_sync_kind_t kind;
+} front_end_t;
+
+static front_end_t front_ends[] = {
+    {"mutex",     RBTREE_SYNC_MUTEX},
+    {"rwlock",    RBTREE_SYNC_RWLOCK},
+    {"combining", RBTREE_SYNC_COMBINING},
+};
+
+typedef struct {
+    rbtree_sync_t *sync;
+    int id;
+} worker_t;
+
+static int num_threads = 16, num_keys = 100000, write_percent = 50;
+static long num_ops = 200000;
+static long adversarial_keys = 0;
+
+static int *keys;
+static char *present;
+
+static int int_cmp(int *i1, int *i2) {
+    return *i1 < *i2 ? -1 : *i1 > *i2;
+}
+
+static unsigned long long now_ns() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    return (unsigned long long) ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+/* xorshift64 */
+static unsigned long long next_random(unsigned long long *state) {
+    *state ^= *state << 13;
+    *state ^= *state >> 7;
+    *state ^= *state << 17;
+
+    return *state;
+}
+
+static void *worker(void *arg) {
+    worker_t *w = (worker_t *) arg;
+    unsigned long long state = 0x9e3779b97f4a7c15ULL * (w->id + 1);
+    long i;
+
+    for (i = 0; i < num_ops; ++i) {
+        unsigned long long r = next_random(&state);
+        int k = (int) ((r >> 8) % num_keys);
+
+        if ((int) (r % 100) >= write_percent) {
+            rbtree_sync_find(w->sync, &keys[k]);
+            continue;
+        }
+
+        /* move k to the nearest key of ours */
+        k -= k % num_threads - w->id;
+        if (k < 0 || k >= num_keys) k = w->id;
+
+        if (present[k]) rbtree_sync_delete(w->sync, &keys[k]);
+        else            rbtree_sync_insert(w->sync, &keys[k]);
+
+        present[k] = !present[k];
+    }
+
+    return NULL;
+}
+
+/* run the steps on the empty tree with no timing, for the counters. */
+static void count_workload(rbtree_t *tree, rbtree_workload_step_t *steps, size_t count,
+                           rbtree_perf_t *perf) {
+    size_t i;
+
+    rbtree_perf_start(perf);
+
+    for (i = 0; i < count; ++i) {
+        switch (steps[i].op) {
+            case RBTREE_WORKLOAD_INSERT: rbtree_insert(tree, &steps[i].key); break;
+            case RBTREE_WORKLOAD_FIND:   rbtree_find(tree, &steps[i].key);   break;
+            case RBTREE_WORKLOAD_DELETE: rbtree_delete(tree, &steps[i].key); break;
+            default:                     break;
+        }
+    }
+
+    rbtree_perf_stop(perf);
+
+    while (tree->root != NULL) {
+        rbtree_delete(tree, rbtree_first(tree));
+    }
+}
+
+static int run_workloads() {
+    rbtree_workload_kind_t kind;
+    rbtree_workload_stats_t stats;
+    rbtree_workload_step_t *steps;
+    rbtree_perf_t perf;
+    rbtree_t tree;
+    size_t count;
+    int counters = rbtree_perf_open(&perf);
+
+    printf("%ld keys; latencies in ns\n", adversarial_keys);
+    printf("%-11s %-7s %9s %8s %8s %8s %8s %9s %10s\n",
+           "workload", "op", "count", "mean", "p50", "p99", "p99.9", "max", "max step");
+
+    for (kind = 0; kind < RBTREE_WORKLOAD_NUM_KINDS; ++kind) {
+        steps = rbtree_workload_create(kind, adversarial_keys, 0, &count);
+        if (steps == NULL) return 1;
+
+        rbtree_init(&tree, rbtree_workload_cmp);
+
+        if (rbtree_workload_run(&tree, steps, count, &stats) != 0) return 1;
+
+        rbtree_workload_report(&stats, stdout, rbtree_workload_name(kind));
+
+        if (counters > 0) {
+            count_workload(&tree, steps, count, &perf);
+            rbtree_perf_report(&perf, stdout, count);
+        }
+
+        free(steps);
+    }
+
+    if (counters == 0) rbtree_perf_report(&perf, stdout, 0);
+    rbtree_perf_close(&perf);
+
+    return 0;
+}
+
+static double run(rbtree_sync_kind_t kind) {
+    pthread_t threads[num_threads];
+    worker_t workers[num_threads];
+    unsigned long long start, elapsed;
+    rbtree_sync_t *sync;
+    rbtree_t tree;
+    int i;
+
+    rbtree_init(&tree, (rbtree_cmp_t *) int_cmp);
+
+    for (i = 0; i < num_keys; ++i) {
+        present[i] = i % 2 == 0;
+        if (present[i]) rbtree_insert(&tree, &keys[i]);
+    }
+
+    if ((sync = rbtree_sync_create(&tree, kind)) == NULL) return 0;
+
+    start = now_ns();
+
+    for (i = 0; i < num_threads; ++i) {
+        workers[i].sync = sync;
+        workers[i].id   = i;
+        pthread_create(&threads[i], NULL, worker, &workers[i]);
+    }
+
+    for (i = 0; i < num_threads; ++i) {
+        pthread_join(threads[i], NULL);
+    }
+
+    elapsed = now_ns() - start;
+
+    rbtree_sync_destroy(sync);
+
+    while (tree.root != NULL) {
+        rbtree_delete(&tree, rbtree_first(&tree));
+    }
+
+    return (double) num_threads * num_ops / (elapsed / 1e9);
+}
+
+int main(int argc, char **argv) {
+    int i;
+
+    for (i = 1; i < argc - 1 && argv[i][0] == '-'; i += 2) {
+        if      (strcmp(argv[i], "-t") == 0) num_threads   = atoi(argv[i + 1]);
+        else if (strcmp(argv[i], "-n") == 0) num_ops       = atol(argv[i + 1]);
+        else if (strcmp(argv[i], "-k") == 0) num_keys      = atoi(argv[i + 1]);
+        else if (strcmp(argv[i], "-w") == 0) write_percent = atoi(argv[i + 1]);
+        else if (strcmp(argv[i], "-a") == 0) adversarial_keys = atol(argv[i + 1]);
+        else break;
+    }
+
+    if (i == argc && adversarial_keys > 0) return run_workloads();
+
+    if (i != argc || num_threads < 1 || num_keys < num_threads || num_ops < 0) {
+        fprintf(stderr, "usage: rbtree_bench [-t threads] [-n ops-per-thread] "
+                        "[-k keys] [-w write-percent]\n"
+                        "       rbtree_bench -a keys\n");
+        return 2;
+    }
+
+    keys    = (int *) malloc(num_keys * sizeof(int));
+    present = (char *) malloc(num_keys);
+    if (keys == NULL || present == NULL) return 1;
+
+    for (i = 0; i < num_keys; ++i) {
+        keys[i] = i;
+    }
+
+    printf("%d threads, %ld ops each, %d keys, %d%% writes\n",
+           num_threads, num_ops, num_keys, write_percent);
+    printf("%-10s %14s\n", "front end", "ops/sec");
+
+    for (i = 0; i < sizeof(front_ends) / sizeof(front_ends[0]); ++i) {
+        printf("%-10s %14.0f\n", front_ends[i].name, run(front_ends[i].kind));
+    }
+
+    return 0;
+}
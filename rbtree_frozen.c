@@ -0,0 +1,364 @@
+/* rbtree_frozen.c, Copyright (C) 2016, Greg Johnson
+ * Released under the terms of the GNU GPL v2.0.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ */
+#include <stdlib.h>
+#include <string.h>
+#include "rbtree_frozen.h"
+
+/* Compressed, read-only copies of red-black trees.
+ *
+ * Integer keys:  each block of INT_BLOCK keys is stored as its first key
+ * (in the index) followed by the differences between consecutive keys,
+ * packed into just enough bits to hold the largest difference in the
+ * block.
+ *
+ * String keys:  each block of STR_BLOCK keys is stored as its first key,
+ * NUL-terminated so that it can be compared in place during the index
+ * search, followed by (shared prefix length, suffix length, suffix) for
+ * each of the other keys.  lengths are stored as little-endian base-128
+ * varints.
+ */
+
+#define INT_BLOCK 128
+#define STR_BLOCK 16
+
+typedef unsigned long long word_t;
+
+struct _rbtree_frozen_int_t {
+    size_t count;
+    size_t num_blocks;
+    void **data;
+
+    long long     *first;       /* first key of each block */
+    size_t        *bit_offset;  /* where each block's deltas start */
+    unsigned char *width;       /* bits per delta, for each block */
+
+    word_t *bits;
+    size_t  num_words;
+};
+
+struct _rbtree_frozen_str_t {
+    size_t count;
+    size_t num_blocks;
+    size_t max_len;
+    void **data;
+
+    size_t        *offset;      /* where each block starts */
+    unsigned char *bytes;
+    size_t         num_bytes;
+};
+
+/* return the tree's user data values in order, and their number. */
+static void **tree_data(rbtree_t *tree, size_t *count) {
+    rbtree_iter_t iter;
+    void **data;
+    size_t i;
+
+    *count = 0;
+    iter = rbtree_iter(tree);
+    while (rbtree_iter_next(&iter) != NULL) { ++*count; }
+
+    if ((data = (void **) malloc((*count + 1) * sizeof(void *))) == NULL)
+        return NULL;
+
+    iter = rbtree_iter(tree);
+    for (i = 0; i < *count; ++i) { data[i] = rbtree_iter_next(&iter); }
+
+    return data;
+}
+
+static int bits_needed(word_t value) {
+    int bits = 0;
+    while (value != 0) { ++bits; value >>= 1; }
+
+    return bits;
+}
+
+static void put_bits(word_t *words, size_t pos, int width, word_t value) {
+    size_t w = pos / 64;
+    int    b = pos % 64;
+
+    if (width == 0) return;
+
+    words[w] |= value << b;
+    if (b + width > 64) words[w + 1] |= value >> (64 - b);
+}
+
+static word_t get_bits(word_t *words, size_t pos, int width) {
+    size_t w = pos / 64;
+    int    b = pos % 64;
+    word_t value;
+
+    if (width == 0) return 0;
+
+    value = words[w] >> b;
+    if (b + width > 64) value |= words[w + 1] << (64 - b);
+
+    return width == 64 ? value : value & (((word_t) 1 << width) - 1);
+}
+
+void rbtree_frozen_int_free(rbtree_frozen_int_t *frozen) {
+    if (frozen == NULL) return;
+
+    free(frozen->data);
+    free(frozen->first);
+    free(frozen->bit_offset);
+    free(frozen->width);
+    free(frozen->bits);
+    free(frozen);
+}
+
+rbtree_frozen_int_t *rbtree_freeze_int(rbtree_t *tree, rbtree_int_key_t *key) {
+    rbtree_frozen_int_t *frozen;
+    size_t b, i, pos;
+
+    if ((frozen = (rbtree_frozen_int_t *) calloc(1, sizeof(*frozen))) == NULL)
+        return NULL;
+
+    if ((frozen->data = tree_data(tree, &frozen->count)) == NULL)
+        goto fail;
+
+    frozen->num_blocks = (frozen->count + INT_BLOCK - 1) / INT_BLOCK;
+    frozen->first      = (long long *) malloc((frozen->num_blocks + 1) * sizeof(long long));
+    frozen->bit_offset = (size_t *) malloc((frozen->num_blocks + 1) * sizeof(size_t));
+    frozen->width      = (unsigned char *) malloc(frozen->num_blocks + 1);
+
+    if (frozen->first == NULL || frozen->bit_offset == NULL || frozen->width == NULL)
+        goto fail;
+
+    /* first pass: choose the delta width of each block.. */
+    pos = 0;
+    for (b = 0; b < frozen->num_blocks; ++b) {
+        size_t start = b * INT_BLOCK;
+        size_t end   = start + INT_BLOCK < frozen->count ? start + INT_BLOCK : frozen->count;
+        word_t max_delta = 0;
+
+        frozen->first[b] = key(frozen->data[start]);
+
+        for (i = start + 1; i < end; ++i) {
+            word_t delta = (word_t) key(frozen->data[i]) - (word_t) key(frozen->data[i - 1]);
+            if (delta > max_delta) max_delta = delta;
+        }
+
+        frozen->width[b]      = bits_needed(max_delta);
+        frozen->bit_offset[b] = pos;
+        pos += (end - start - 1) * frozen->width[b];
+    }
+
+    /* ..second pass: pack the deltas. */
+    frozen->num_words = pos / 64 + 1;
+    if ((frozen->bits = (word_t *) calloc(frozen->num_words, sizeof(word_t))) == NULL)
+        goto fail;
+
+    for (b = 0; b < frozen->num_blocks; ++b) {
+        size_t start = b * INT_BLOCK;
+        size_t end   = start + INT_BLOCK < frozen->count ? start + INT_BLOCK : frozen->count;
+
+        pos = frozen->bit_offset[b];
+        for (i = start + 1; i < end; ++i) {
+            word_t delta = (word_t) key(frozen->data[i]) - (word_t) key(frozen->data[i - 1]);
+            put_bits(frozen->bits, pos, frozen->width[b], delta);
+            pos += frozen->width[b];
+        }
+    }
+
+    return frozen;
+
+fail:
+    rbtree_frozen_int_free(frozen);
+    return NULL;
+}
+
+void *rbtree_frozen_int_find(rbtree_frozen_int_t *frozen, long long key) {
+    size_t lo = 0, hi = frozen->num_blocks, b, i, end, pos;
+    word_t current;
+
+    /* find the last block whose first key is <= key */
+    while (lo < hi) {
+        size_t mid = lo + (hi - lo) / 2;
+
+        if (frozen->first[mid] <= key) lo = mid + 1;
+        else                           hi = mid;
+    }
+
+    if (lo == 0) return NULL;
+    b = lo - 1;
+
+    end     = (b + 1) * INT_BLOCK < frozen->count ? (b + 1) * INT_BLOCK : frozen->count;
+    pos     = frozen->bit_offset[b];
+    current = (word_t) frozen->first[b];
+
+    for (i = b * INT_BLOCK; ; ++i) {
+        if ((long long) current == key) return frozen->data[i];
+        if ((long long) current >  key || i + 1 == end) return NULL;
+
+        current += get_bits(frozen->bits, pos, frozen->width[b]);
+        pos     += frozen->width[b];
+    }
+}
+
+size_t rbtree_frozen_int_size(rbtree_frozen_int_t *frozen) {
+    return sizeof(*frozen)
+         + frozen->count * sizeof(void *)
+         + frozen->num_blocks * (sizeof(long long) + sizeof(size_t) + 1)
+         + frozen->num_words * sizeof(word_t);
+}
+
+static size_t put_varint(unsigned char *bytes, size_t value) {
+    size_t n = 0;
+
+    while (value >= 0x80) {
+        if (bytes != NULL) bytes[n] = (unsigned char) (value | 0x80);
+        value >>= 7;
+        ++n;
+    }
+    if (bytes != NULL) bytes[n] = (unsigned char) value;
+
+    return n + 1;
+}
+
+static size_t get_varint(const unsigned char **bytes) {
+    size_t value = 0;
+    int shift = 0;
+
+    while (**bytes & 0x80) {
+        value |= (size_t) (*(*bytes)++ & 0x7f) << shift;
+        shift += 7;
+    }
+    value |= (size_t) *(*bytes)++ << shift;
+
+    return value;
+}
+
+static size_t shared_prefix(const char *s1, const char *s2) {
+    size_t n = 0;
+    while (s1[n] != '\0' && s1[n] == s2[n]) { ++n; }
+
+    return n;
+}
+
+/* encode all blocks into bytes, or just measure them if bytes is NULL. */
+static size_t encode_str(rbtree_frozen_str_t *frozen, rbtree_str_key_t *key,
+                         unsigned char *bytes) {
+    size_t pos = 0, i;
+
+    for (i = 0; i < frozen->count; ++i) {
+        const char *s = key(frozen->data[i]);
+        size_t len    = strlen(s);
+
+        if (len > frozen->max_len) frozen->max_len = len;
+
+        if (i % STR_BLOCK == 0) {
+            if (bytes != NULL) {
+                frozen->offset[i / STR_BLOCK] = pos;
+                memcpy(bytes + pos, s, len + 1);
+            }
+            pos += len + 1;
+
+        } else {
+            size_t prefix = shared_prefix(s, key(frozen->data[i - 1]));
+
+            pos += put_varint(bytes == NULL ? NULL : bytes + pos, prefix);
+            pos += put_varint(bytes == NULL ? NULL : bytes + pos, len - prefix);
+
+            if (bytes != NULL) memcpy(bytes + pos, s + prefix, len - prefix);
+            pos += len - prefix;
+        }
+    }
+
+    return pos;
+}
+
+void rbtree_frozen_str_free(rbtree_frozen_str_t *frozen) {
+    if (frozen == NULL) return;
+
+    free(frozen->data);
+    free(frozen->offset);
+    free(frozen->bytes);
+    free(frozen);
+}
+
+rbtree_frozen_str_t *rbtree_freeze_str(rbtree_t *tree, rbtree_str_key_t *key) {
+    rbtree_frozen_str_t *frozen;
+
+    if ((frozen = (rbtree_frozen_str_t *) calloc(1, sizeof(*frozen))) == NULL)
+        return NULL;
+
+    if ((frozen->data = tree_data(tree, &frozen->count)) == NULL)
+        goto fail;
+
+    frozen->num_blocks = (frozen->count + STR_BLOCK - 1) / STR_BLOCK;
+    frozen->num_bytes  = encode_str(frozen, key, NULL);
+
+    frozen->offset = (size_t *) malloc((frozen->num_blocks + 1) * sizeof(size_t));
+    frozen->bytes  = (unsigned char *) malloc(frozen->num_bytes + 1);
+
+    if (frozen->offset == NULL || frozen->bytes == NULL)
+        goto fail;
+
+    encode_str(frozen, key, frozen->bytes);
+
+    return frozen;
+
+fail:
+    rbtree_frozen_str_free(frozen);
+    return NULL;
+}
+
+void *rbtree_frozen_str_find(rbtree_frozen_str_t *frozen, const char *key) {
+    size_t lo = 0, hi = frozen->num_blocks, b, i, end;
+    const unsigned char *pos;
+    char stack_buf[256], *current;
+    void *result = NULL;
+
+    while (lo < hi) {
+        size_t mid = lo + (hi - lo) / 2;
+
+        if (strcmp((char *) frozen->bytes + frozen->offset[mid], key) <= 0) lo = mid + 1;
+        else                                                                  hi = mid;
+    }
+
+    if (lo == 0) return NULL;
+    b = lo - 1;
+
+    if (frozen->max_len < sizeof(stack_buf))
+        current = stack_buf;
+    else if ((current = (char *) malloc(frozen->max_len + 1)) == NULL)
+        return NULL;
+
+    pos = frozen->bytes + frozen->offset[b];
+    strcpy(current, (char *) pos);
+    pos += strlen(current) + 1;
+
+    end = (b + 1) * STR_BLOCK < frozen->count ? (b + 1) * STR_BLOCK : frozen->count;
+
+    for (i = b * STR_BLOCK; ; ++i) {
+        int rel = strcmp(current, key);
+        size_t prefix, suffix;
+
+        if (rel == 0) { result = frozen->data[i]; break; }
+        if (rel >  0 || i + 1 == end) break;
+
+        prefix = get_varint(&pos);
+        suffix = get_varint(&pos);
+        memcpy(current + prefix, pos, suffix);
+        current[prefix + suffix] = '\0';
+        pos += suffix;
+    }
+
+    if (current != stack_buf) free(current);
+
+    return result;
+}
+
+size_t rbtree_frozen_str_size(rbtree_frozen_str_t *frozen) {
+    return sizeof(*frozen)
+         + frozen->count * sizeof(void *)
+         + frozen->num_blocks * sizeof(size_t)
+         + frozen->num_bytes;
+}
@@ -0,0 +1,65 @@
+/* rbtree_frozen.h, Copyright (C) 2016, Greg Johnson
+ * Released under the terms of the GNU GPL v2.0.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ */
+#ifndef RBTREE_FROZEN_H
+#define RBTREE_FROZEN_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include "rbtree.h"
+
+/* compressed, read-only copies of red-black trees.
+ *
+ * a frozen tree keeps the tree's user data values in order, and a
+ * compressed copy of their keys.  keys are split into blocks; a small
+ * index holds the first key of each block, and a lookup decodes only
+ * the one block that can hold the key it is looking for.
+ *
+ * integer keys are stored as bit-packed deltas from the previous key in
+ * their block.  string keys are front-coded: each string in a block is
+ * stored as the length of the prefix it shares with the previous string,
+ * plus the rest of the string.
+ *
+ * the tree must be ordered the same way as its keys; i.e., by increasing
+ * integer value, or by strcmp().  the tree is not changed by freezing,
+ * and the frozen copy does not see later changes to the tree.
+ *
+ * Usage:
+ *     rbtree_frozen_int_t *frozen = rbtree_freeze_int(&tree, my_key_function);
+ *     found = rbtree_frozen_int_find(frozen, key);
+ *     rbtree_frozen_int_free(frozen);
+ */
+
+typedef long long   (rbtree_int_key_t)(const void *data);
+typedef const char *(rbtree_str_key_t)(const void *data);
+
+typedef struct _rbtree_frozen_int_t rbtree_frozen_int_t;
+typedef struct _rbtree_frozen_str_t rbtree_frozen_str_t;
+
+/* return a frozen copy of tree, or NULL if malloc fails. */
+rbtree_frozen_int_t *rbtree_freeze_int(rbtree_t *tree, rbtree_int_key_t *key);
+rbtree_frozen_str_t *rbtree_freeze_str(rbtree_t *tree, rbtree_str_key_t *key);
+
+/* return a user data value with the given key, or NULL if none. */
+void *rbtree_frozen_int_find(rbtree_frozen_int_t *frozen, long long key);
+void *rbtree_frozen_str_find(rbtree_frozen_str_t *frozen, const char *key);
+
+/* return the number of bytes of memory used by the frozen copy. */
+size_t rbtree_frozen_int_size(rbtree_frozen_int_t *frozen);
+size_t rbtree_frozen_str_size(rbtree_frozen_str_t *frozen);
+
+void rbtree_frozen_int_free(rbtree_frozen_int_t *frozen);
+void rbtree_frozen_str_free(rbtree_frozen_str_t *frozen);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
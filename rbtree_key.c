@@ -0,0 +1,71 @@
+/* rbtree_key.c, Copyright (C) 2016, Greg Johnson
+ * Released under the terms of the GNU GPL v2.0.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ */
+#include <string.h>
+#include "rbtree_key.h"
+
+void rbtree_key_init(rbtree_key_t *key) {
+    key->len = 0;
+}
+
+int rbtree_key_put_uint64(rbtree_key_t *key, uint64_t value) {
+    int i;
+
+    if (key->len + 8 > RBTREE_KEY_MAX) return -1;
+
+    for (i = 7; i >= 0; --i) {
+        key->bytes[key->len++] = (unsigned char) (value >> (8 * i));
+    }
+
+    return 0;
+}
+
+int rbtree_key_put_int64(rbtree_key_t *key, int64_t value) {
+    return rbtree_key_put_uint64(key, (uint64_t) value ^ ((uint64_t) 1 << 63));
+}
+
+int rbtree_key_put_double(rbtree_key_t *key, double value) {
+    uint64_t bits;
+
+    memcpy(&bits, &value, sizeof(bits));
+
+    /* negative numbers sort backwards by their bits */
+    if (bits >> 63)
+        bits = ~bits;
+    else
+        bits ^= (uint64_t) 1 << 63;
+
+    return rbtree_key_put_uint64(key, bits);
+}
+
+int rbtree_key_put_string(rbtree_key_t *key, const char *s, size_t len) {
+    size_t need = len + 2, i;
+
+    for (i = 0; i < len; ++i) {
+        if (s[i] == 0) ++need;
+    }
+
+    if (key->len + need > RBTREE_KEY_MAX) return -1;
+
+    for (i = 0; i < len; ++i) {
+        key->bytes[key->len++] = (unsigned char) s[i];
+        if (s[i] == 0) key->bytes[key->len++] = 0xff;
+    }
+
+    key->bytes[key->len++] = 0;
+    key->bytes[key->len++] = 0;
+
+    return 0;
+}
+
+size_t rbtree_key_bytes(const void *data, const void **bytes) {
+    const rbtree_key_t *key = (const rbtree_key_t *) data;
+
+    *bytes = key->bytes;
+    return key->len;
+}
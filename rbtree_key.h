@@ -0,0 +1,93 @@
+/* rbtree_key.h, Copyright (C) 2016, Greg Johnson
+ * Released under the terms of the GNU GPL v2.0.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ */
+#ifndef RBTREE_KEY_H
+#define RBTREE_KEY_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stdint.h>
+#include <string.h>
+#include "rbtree.h"
+
+/* order-preserving byte string keys.
+ *
+ * a composite key (tenant, timestamp, id, ..) is encoded field by field
+ * into a byte string whose memcmp() order is the order of the fields,
+ * compared one after another.  the tree then compares keys with
+ * rbtree_key_cmp(), which is a single memcmp(), instead of a cmp
+ * function with a branch or two per field.
+ *
+ *   integers:  big-endian, with the sign bit flipped for signed ones,
+ *              so that negative numbers sort first.
+ *   doubles:   the sign bit is flipped for positive numbers, and all
+ *              bits for negative ones.  -0.0 sorts just below 0.0;
+ *              NaNs sort outside the other numbers.
+ *   strings:   each 0 byte is written as 0 0xff, and the string ends
+ *              with 0 0, so a string sorts before its extensions and
+ *              the next field can follow.
+ *
+ * an rbtree_key_t has a fixed size, so it can start a user data struct,
+ * or be the key of an inline tree (rbtree_init_inline()).
+ *
+ * Usage:
+ *     typedef struct { rbtree_key_t key; order_t order; } entry_t;
+ *
+ *     rbtree_key_init(&entry.key);
+ *     rbtree_key_put_string(&entry.key, tenant, strlen(tenant));
+ *     rbtree_key_put_int64(&entry.key, timestamp);
+ *     rbtree_key_put_uint64(&entry.key, id);
+ *
+ *     rbtree_init(&tree, rbtree_key_cmp);
+ *     rbtree_insert(&tree, &entry);
+ */
+
+#define RBTREE_KEY_MAX 56
+
+typedef struct {
+    size_t len;
+    unsigned char bytes[RBTREE_KEY_MAX];
+} rbtree_key_t;
+
+/* make key empty. */
+void rbtree_key_init(rbtree_key_t *key);
+
+/* append a field to key.  return 0, or -1 if it doesn't fit (key is
+ * then unchanged).
+ */
+int rbtree_key_put_int64(rbtree_key_t *key, int64_t value);
+int rbtree_key_put_uint64(rbtree_key_t *key, uint64_t value);
+int rbtree_key_put_double(rbtree_key_t *key, double value);
+int rbtree_key_put_string(rbtree_key_t *key, const char *s, size_t len);
+
+/* rbtree_cmp_t for user data values that start with an rbtree_key_t.
+ * it is defined here, so that code comparing keys itself can inline it.
+ */
+static inline int rbtree_key_cmp(const void *k1, const void *k2) {
+    const rbtree_key_t *key1 = (const rbtree_key_t *) k1;
+    const rbtree_key_t *key2 = (const rbtree_key_t *) k2;
+    size_t len = key1->len < key2->len ? key1->len : key2->len;
+    int rel    = memcmp(key1->bytes, key2->bytes, len);
+
+    if (rel != 0) return rel;
+
+    return key1->len < key2->len ? -1 : key1->len > key2->len;
+}
+
+/* rbtree_key_bytes_t (see rbtree_trace.h) for the same values.  the
+ * replay tool's memcmp() order is then exactly the tree's order.
+ */
+size_t rbtree_key_bytes(const void *data, const void **bytes);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
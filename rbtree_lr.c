@@ -0,0 +1,206 @@
+/* rbtree_lr.c, Copyright (C) 2016, Greg Johnson
+ * Released under the terms of the GNU GPL v2.0.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ */
+#include <stdlib.h>
+#include <stdatomic.h>
+#include <pthread.h>
+#include <sched.h>
+#include "rbtree_lr.h"
+
+/* Left-right.
+ *
+ * "left_right" says which tree readers search.  A reader arrives on
+ * the read indicator named by "version", reads left_right, searches,
+ * and departs from the same indicator.
+ *
+ * To write, a writer changes the tree readers aren't searching, points
+ * left_right at it, and then waits until no reader can still be in the
+ * other tree: it moves "version" to the other indicator, waits for that
+ * one to drain (readers that arrived there before the last switch), then
+ * waits for the old one to drain.  Every reader that arrived after
+ * left_right changed sees the new tree.  Now the old tree is free, and
+ * the writer changes it too.
+ *
+ * A read indicator is a set of counters on separate cache lines; each
+ * thread always uses the same one, so readers in different threads
+ * don't fight over a counter.
+ *
+ * Once the first tree is published, the insert into the second one must
+ * not fail, or the trees would differ.  So an insert allocates the nodes
+ * of both copies before it changes either tree, and the trees take their
+ * nodes from those spares (alloc_node()).
+ */
+
+#define STRIPES    16
+#define CACHE_LINE 64
+
+typedef struct {
+    atomic_long count;
+} __attribute__((aligned(CACHE_LINE))) stripe_t;
+
+struct _rbtree_lr_t {
+    rbtree_t trees[2];
+
+    atomic_int left_right;      /* the tree readers search */
+    atomic_int version;         /* the read indicator readers arrive on */
+    stripe_t readers[2][STRIPES];
+
+    pthread_mutex_t write_lock;
+    void *spares[2];            /* nodes for an insert's copies; write lock */
+};
+
+static atomic_int next_stripe;
+
+static int my_stripe() {
+    static __thread int stripe = -1;
+
+    if (stripe < 0) stripe = atomic_fetch_add(&next_stripe, 1) % STRIPES;
+
+    return stripe;
+}
+
+static void wait_empty(rbtree_lr_t *lr, int version) {
+    int i;
+
+    for (i = 0; i < STRIPES; ++i) {
+        while (atomic_load(&lr->readers[version][i].count) != 0)
+            sched_yield();
+    }
+}
+
+/* send readers to the other tree, and wait until none are left in the
+ * tree they were using.  write lock must be held.
+ */
+static void toggle(rbtree_lr_t *lr) {
+    int version = atomic_load(&lr->version);
+
+    atomic_store(&lr->left_right, !atomic_load(&lr->left_right));
+
+    wait_empty(lr, !version);
+    atomic_store(&lr->version, !version);
+    wait_empty(lr, version);
+}
+
+static void *alloc_node(void *ctx, size_t size) {
+    rbtree_lr_t *lr = (rbtree_lr_t *) ctx;
+    void *node;
+    int i;
+
+    for (i = 0; i < 2; ++i) {
+        if ((node = lr->spares[i]) != NULL) {
+            lr->spares[i] = NULL;
+            return node;
+        }
+    }
+
+    return malloc(size);
+}
+
+static void free_node(void *ctx, void *node) {
+    free(node);
+}
+
+rbtree_lr_t *rbtree_lr_create(rbtree_cmp_t *cmp) {
+    rbtree_lr_t *lr;
+    int i, j;
+
+    if (posix_memalign((void **) &lr, CACHE_LINE, sizeof(rbtree_lr_t)) != 0)
+        return NULL;
+
+    for (i = 0; i < 2; ++i) {
+        rbtree_init(&lr->trees[i], cmp);
+        rbtree_set_allocator(&lr->trees[i], alloc_node, free_node, lr);
+        lr->spares[i] = NULL;
+    }
+
+    atomic_init(&lr->left_right, 0);
+    atomic_init(&lr->version, 0);
+
+    for (i = 0; i < 2; ++i) {
+        for (j = 0; j < STRIPES; ++j) {
+            atomic_init(&lr->readers[i][j].count, 0);
+        }
+    }
+
+    pthread_mutex_init(&lr->write_lock, NULL);
+
+    return lr;
+}
+
+void rbtree_lr_destroy(rbtree_lr_t *lr) {
+    int i;
+
+    if (lr == NULL) return;
+
+    for (i = 0; i < 2; ++i) {
+        while (lr->trees[i].root != NULL) {
+            rbtree_delete(&lr->trees[i], rbtree_first(&lr->trees[i]));
+        }
+    }
+
+    pthread_mutex_destroy(&lr->write_lock);
+    free(lr->spares[0]);
+    free(lr->spares[1]);
+    free(lr);
+}
+
+void *rbtree_lr_find(rbtree_lr_t *lr, void *data) {
+    int version = atomic_load(&lr->version);
+    int stripe  = my_stripe();
+    void *found;
+
+    atomic_fetch_add(&lr->readers[version][stripe].count, 1);
+    found = rbtree_find(&lr->trees[atomic_load(&lr->left_right)], data);
+    atomic_fetch_sub(&lr->readers[version][stripe].count, 1);
+
+    return found;
+}
+
+void *rbtree_lr_insert(rbtree_lr_t *lr, void *data) {
+    void *inserted;
+    int idle, i;
+
+    pthread_mutex_lock(&lr->write_lock);
+
+    idle = !atomic_load(&lr->left_right);
+
+    for (i = 0; i < 2; ++i) {
+        if (lr->spares[i] == NULL
+            && (lr->spares[i] = malloc(rbtree_node_size(&lr->trees[idle]))) == NULL) {
+            pthread_mutex_unlock(&lr->write_lock);
+            return NULL;
+        }
+    }
+
+    /* neither insert can fail now */
+    inserted = rbtree_insert(&lr->trees[idle], data);
+    toggle(lr);
+    rbtree_insert(&lr->trees[!idle], data);
+
+    pthread_mutex_unlock(&lr->write_lock);
+
+    return inserted;
+}
+
+void *rbtree_lr_delete(rbtree_lr_t *lr, void *data) {
+    void *deleted;
+    int idle;
+
+    pthread_mutex_lock(&lr->write_lock);
+
+    idle = !atomic_load(&lr->left_right);
+
+    if ((deleted = rbtree_delete(&lr->trees[idle], data)) != NULL) {
+        toggle(lr);
+        rbtree_delete(&lr->trees[!idle], data);
+    }
+
+    pthread_mutex_unlock(&lr->write_lock);
+
+    return deleted;
+}
@@ -0,0 +1,70 @@
+/* rbtree_lr.h, Copyright (C) 2016, Greg Johnson
+ * Released under the terms of the GNU GPL v2.0.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ */
+#ifndef RBTREE_LR_H
+#define RBTREE_LR_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include "rbtree.h"
+
+/* a read-mostly tree whose finds never block or retry.
+ *
+ * this is the "left-right" construction (Ramalhete & Correia, 2015)
+ * over two trees that hold the same values.  readers always search the
+ * tree that is not being written; they only announce themselves on a
+ * counter on the way in and out, which takes a fixed number of steps
+ * whatever the writers are doing.
+ *
+ * a writer applies its change to the tree readers are not using, steers
+ * new readers over to it, waits for readers still in the other tree to
+ * leave, and applies the change there too.  writers are serialized by a
+ * mutex, and each write waits for the reads in progress, so this is for
+ * tables that are read far more often than they are written.
+ *
+ * each value has a node in each tree, so nodes take twice the memory.
+ *
+ * readers call rbtree_find() on a tree at the same time, so the trees
+ * must be ones whose finds write nothing (rbtree_find_is_read_only()):
+ * no lazy key shifting, hot-key cache, tracing or transactions.  the
+ * trees are made by rbtree_lr_create() and are never set up that way.
+ *
+ * a value returned by rbtree_lr_delete() may still be held by readers
+ * that found it before it was deleted; when to free it is up to the
+ * caller.
+ *
+ * Usage:
+ *     rbtree_lr_t *lr = rbtree_lr_create(my_data_comparison_function);
+ *     rbtree_lr_insert(lr, &my_data);     // writers
+ *     found = rbtree_lr_find(lr, &search);  // readers, in any thread
+ */
+
+typedef struct _rbtree_lr_t rbtree_lr_t;
+
+/* return a new, empty left-right tree, or NULL on failure. */
+rbtree_lr_t *rbtree_lr_create(rbtree_cmp_t *cmp);
+
+/* free the left-right tree (not the values in it).  no thread may be
+ * using it.
+ */
+void rbtree_lr_destroy(rbtree_lr_t *lr);
+
+/* as rbtree_find(); wait-free. */
+void *rbtree_lr_find(rbtree_lr_t *lr, void *data);
+
+/* as rbtree_insert() and rbtree_delete(). */
+void *rbtree_lr_insert(rbtree_lr_t *lr, void *data);
+void *rbtree_lr_delete(rbtree_lr_t *lr, void *data);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
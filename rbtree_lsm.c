@@ -0,0 +1,365 @@
+/* rbtree_lsm.c, Copyright (C) 2016, Greg Johnson
+ * Released under the terms of the GNU GPL v2.0.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ */
+#include <stdlib.h>
+#include <stdbool.h>
+#include <stdatomic.h>
+#include <pthread.h>
+#include "rbtree_lsm.h"
+#include "rbtree_batch.h"
+
+/* Per-thread write buffers (after O'Neil, Cheng, Gawlick & O'Neil, "The
+ * Log-Structured Merge-Tree", 1996).
+ *
+ * Each thread claims a buffer on first use, as in flat combining (see
+ * rbtree_sync.c).  A buffer is two small trees:  the values to insert,
+ * and the keys to delete.  A delete drops any pending insert of its key
+ * and leaves a tombstone, since the shared tree may hold the key too; an
+ * insert after a delete is kept alongside the tombstone.  So a flush
+ * applies, for each key, at most a delete followed by an insert, and a
+ * find in a buffer is decided by a pending insert, then a tombstone.
+ *
+ * A thread beyond the first MAX_BUFFERS applies its ops directly.
+ */
+
+#define MAX_BUFFERS 64
+#define CACHE_LINE  64
+
+typedef struct {
+    atomic_bool owned;
+    pthread_mutex_t lock;       /* at RBTREE_LSM_ALL_WRITES only */
+    rbtree_t inserts;
+    rbtree_t deletes;
+    rbtree_lsm_t *lsm;
+} __attribute__((aligned(CACHE_LINE))) buffer_t;
+
+struct _rbtree_lsm_t {
+    rbtree_t *tree;
+    size_t capacity;
+    rbtree_lsm_level_t level;
+
+    pthread_rwlock_t rwlock;    /* for tree */
+
+    pthread_key_t key;
+    buffer_t *buffers;
+    atomic_int num_buffers;     /* high-water mark of claimed buffers */
+};
+
+static void lock(buffer_t *buffer) {
+    if (buffer->lsm->level == RBTREE_LSM_ALL_WRITES)
+        pthread_mutex_lock(&buffer->lock);
+}
+
+static void unlock(buffer_t *buffer) {
+    if (buffer->lsm->level == RBTREE_LSM_ALL_WRITES)
+        pthread_mutex_unlock(&buffer->lock);
+}
+
+static void clear(rbtree_t *tree) {
+    while (tree->root != NULL) {
+        rbtree_delete(tree, rbtree_first(tree));
+    }
+}
+
+/* apply the buffer's ops to the shared tree, and drop them from the
+ * buffer.  the buffer must be locked.
+ */
+static int flush(buffer_t *buffer) {
+    rbtree_lsm_t *lsm = buffer->lsm;
+    size_t n = rbtree_size(&buffer->deletes) + rbtree_size(&buffer->inserts), i = 0;
+    rbtree_batch_t *ops;
+    rbtree_iter_t iter;
+    void *data;
+    int result;
+
+    if (n == 0) return 0;
+
+    if ((ops = (rbtree_batch_t *) malloc(n * sizeof(rbtree_batch_t))) == NULL)
+        return -1;
+
+    /* the batch is stably sorted, so a key's delete goes before its insert */
+    iter = rbtree_iter(&buffer->deletes);
+    while ((data = rbtree_iter_next(&iter)) != NULL) {
+        ops[i].op     = RBTREE_BATCH_DELETE;
+        ops[i++].data = data;
+    }
+
+    iter = rbtree_iter(&buffer->inserts);
+    while ((data = rbtree_iter_next(&iter)) != NULL) {
+        ops[i].op     = RBTREE_BATCH_INSERT;
+        ops[i++].data = data;
+    }
+
+    pthread_rwlock_wrlock(&lsm->rwlock);
+    result = rbtree_apply_batch(lsm->tree, ops, n, 1);
+    pthread_rwlock_unlock(&lsm->rwlock);
+
+    /* keep the ops that failed, for the next try */
+    for (i = 0; i < n; ++i) {
+        if (ops[i].result != RBTREE_BATCH_FAILED) {
+            rbtree_delete(  ops[i].op == RBTREE_BATCH_DELETE
+                          ? &buffer->deletes : &buffer->inserts, ops[i].data);
+        }
+    }
+
+    free(ops);
+
+    return result;
+}
+
+/* a thread is exiting; flush its buffer and give it up. */
+static void release_buffer(void *ptr) {
+    buffer_t *buffer = (buffer_t *) ptr;
+
+    lock(buffer);
+    flush(buffer);
+    unlock(buffer);
+
+    atomic_store(&buffer->owned, false);
+}
+
+/* the calling thread's buffer, claimed on first use; NULL if none is
+ * free.
+ */
+static buffer_t *get_buffer(rbtree_lsm_t *lsm) {
+    buffer_t *buffer = (buffer_t *) pthread_getspecific(lsm->key);
+    int i, high;
+
+    if (buffer != NULL) return buffer;
+
+    for (i = 0; i < MAX_BUFFERS; ++i) {
+        bool owned = false;
+
+        if (atomic_compare_exchange_strong(&lsm->buffers[i].owned, &owned, true))
+            break;
+    }
+
+    if (i == MAX_BUFFERS) return NULL;
+
+    buffer = &lsm->buffers[i];
+
+    if (pthread_setspecific(lsm->key, buffer) != 0) {
+        atomic_store(&buffer->owned, false);
+        return NULL;
+    }
+
+    high = atomic_load(&lsm->num_buffers);
+    while (high < i + 1 && !atomic_compare_exchange_weak(&lsm->num_buffers, &high, i + 1))
+        ;
+
+    return buffer;
+}
+
+/* return 1 if the buffer decides the find (with *found set), else 0.
+ * the buffer must be locked.
+ */
+static int buffer_find(buffer_t *buffer, void *data, void **found) {
+    if ((*found = rbtree_find(&buffer->inserts, data)) != NULL)
+        return 1;
+
+    return rbtree_find(&buffer->deletes, data) != NULL;
+}
+
+/* apply one op straight to the shared tree.  return as for the op. */
+static int apply(rbtree_lsm_t *lsm, rbtree_batch_op_t op, void *data) {
+    rbtree_batch_t batch;
+    int result;
+
+    batch.op   = op;
+    batch.data = data;
+
+    pthread_rwlock_wrlock(&lsm->rwlock);
+    result = rbtree_apply_batch(lsm->tree, &batch, 1, 1);
+    pthread_rwlock_unlock(&lsm->rwlock);
+
+    if (result == 0 && batch.result == RBTREE_BATCH_EXISTED) return 1;
+
+    return result;
+}
+
+rbtree_lsm_t *rbtree_lsm_create(rbtree_t *tree, size_t capacity, rbtree_lsm_level_t level) {
+    rbtree_lsm_t *lsm = (rbtree_lsm_t *) malloc(sizeof(rbtree_lsm_t));
+    int i;
+
+    if (lsm == NULL) return NULL;
+
+    /* finds share the tree under the read lock */
+    if (!rbtree_find_is_read_only(tree)) {
+        free(lsm);
+        return NULL;
+    }
+
+    lsm->tree     = tree;
+    lsm->capacity = capacity > 0 ? capacity : 1;
+    lsm->level    = level;
+    atomic_init(&lsm->num_buffers, 0);
+
+    if (posix_memalign((void **) &lsm->buffers, CACHE_LINE,
+                       MAX_BUFFERS * sizeof(buffer_t)) != 0 || lsm->buffers == NULL) {
+        free(lsm);
+        return NULL;
+    }
+
+    if (pthread_rwlock_init(&lsm->rwlock, NULL) != 0) {
+        free(lsm->buffers);
+        free(lsm);
+        return NULL;
+    }
+
+    for (i = 0; i < MAX_BUFFERS; ++i) {
+        buffer_t *buffer = &lsm->buffers[i];
+
+        if (pthread_mutex_init(&buffer->lock, NULL) != 0) break;
+
+        atomic_init(&buffer->owned, false);
+        rbtree_init(&buffer->inserts, tree->cmp);
+        rbtree_init(&buffer->deletes, tree->cmp);
+
+        /* the buffers' sizes are checked on every write */
+        rbtree_set_ranks(&buffer->inserts);
+        rbtree_set_ranks(&buffer->deletes);
+        buffer->lsm = lsm;
+    }
+
+    if (i < MAX_BUFFERS || pthread_key_create(&lsm->key, release_buffer) != 0) {
+        while (i > 0) pthread_mutex_destroy(&lsm->buffers[--i].lock);
+
+        pthread_rwlock_destroy(&lsm->rwlock);
+        free(lsm->buffers);
+        free(lsm);
+        return NULL;
+    }
+
+    return lsm;
+}
+
+int rbtree_lsm_destroy(rbtree_lsm_t *lsm) {
+    int result = 0, i;
+
+    if (lsm == NULL) return 0;
+
+    pthread_key_delete(lsm->key);
+
+    for (i = 0; i < MAX_BUFFERS; ++i) {
+        buffer_t *buffer = &lsm->buffers[i];
+
+        if (flush(buffer) != 0) result = -1;
+
+        clear(&buffer->deletes);
+        clear(&buffer->inserts);
+        pthread_mutex_destroy(&buffer->lock);
+    }
+
+    pthread_rwlock_destroy(&lsm->rwlock);
+    free(lsm->buffers);
+    free(lsm);
+
+    return result;
+}
+
+void *rbtree_lsm_find(rbtree_lsm_t *lsm, void *data) {
+    buffer_t *own = NULL;
+    void *found;
+    int i, num_buffers;
+
+    if (lsm->level != RBTREE_LSM_FLUSHED
+        && (own = (buffer_t *) pthread_getspecific(lsm->key)) != NULL)
+    {
+        /* only this thread writes to its buffer */
+        if (buffer_find(own, data, &found)) return found;
+    }
+
+    if (lsm->level == RBTREE_LSM_ALL_WRITES) {
+        num_buffers = atomic_load(&lsm->num_buffers);
+
+        for (i = 0; i < num_buffers; ++i) {
+            buffer_t *buffer = &lsm->buffers[i];
+            int decided;
+
+            if (buffer == own) continue;
+
+            pthread_mutex_lock(&buffer->lock);
+            decided = buffer_find(buffer, data, &found);
+            pthread_mutex_unlock(&buffer->lock);
+
+            if (decided) return found;
+        }
+    }
+
+    pthread_rwlock_rdlock(&lsm->rwlock);
+    found = rbtree_find(lsm->tree, data);
+    pthread_rwlock_unlock(&lsm->rwlock);
+
+    return found;
+}
+
+int rbtree_lsm_insert(rbtree_lsm_t *lsm, void *data) {
+    buffer_t *buffer = get_buffer(lsm);
+    int result = 0;
+
+    if (buffer == NULL) return apply(lsm, RBTREE_BATCH_INSERT, data);
+
+    lock(buffer);
+
+    /* the first pending insert of a key wins, as in the tree */
+    if (rbtree_find(&buffer->inserts, data) != NULL) {
+        result = 1;
+    } else if (rbtree_insert(&buffer->inserts, data) == NULL) {
+        result = -1;
+    }
+
+    if (result == 0
+        && rbtree_size(&buffer->inserts) + rbtree_size(&buffer->deletes) >= lsm->capacity)
+    {
+        result = flush(buffer);
+    }
+
+    unlock(buffer);
+
+    return result;
+}
+
+int rbtree_lsm_delete(rbtree_lsm_t *lsm, void *data) {
+    buffer_t *buffer = get_buffer(lsm);
+    int result = 0;
+
+    if (buffer == NULL) return apply(lsm, RBTREE_BATCH_DELETE, data);
+
+    lock(buffer);
+
+    rbtree_delete(&buffer->inserts, data);
+
+    if (rbtree_find(&buffer->deletes, data) == NULL
+        && rbtree_insert(&buffer->deletes, data) == NULL)
+    {
+        result = -1;
+    }
+
+    if (result == 0
+        && rbtree_size(&buffer->inserts) + rbtree_size(&buffer->deletes) >= lsm->capacity)
+    {
+        result = flush(buffer);
+    }
+
+    unlock(buffer);
+
+    return result;
+}
+
+int rbtree_lsm_flush(rbtree_lsm_t *lsm) {
+    buffer_t *buffer = (buffer_t *) pthread_getspecific(lsm->key);
+    int result;
+
+    if (buffer == NULL) return 0;
+
+    lock(buffer);
+    result = flush(buffer);
+    unlock(buffer);
+
+    return result;
+}
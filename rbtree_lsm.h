@@ -0,0 +1,102 @@
+/* rbtree_lsm.h, Copyright (C) 2016, Greg Johnson
+ * Released under the terms of the GNU GPL v2.0.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ */
+#ifndef RBTREE_LSM_H
+#define RBTREE_LSM_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include "rbtree.h"
+
+/* per-thread write buffers in front of a shared tree, for write-heavy
+ * loads from many threads.
+ *
+ * each thread's inserts and deletes go into a small private tree of its
+ * own (a "memtable", as in a log-structured merge tree), without taking
+ * any lock.  when a thread's buffer holds capacity ops, they are applied
+ * to the shared tree as one sorted batch (rbtree_apply_batch()), under a
+ * single lock acquisition.
+ *
+ * as in a batch, an insert adds its value only if the tree has no value
+ * equal to it.  ops by one thread take effect in order; ops on the same
+ * key by different threads take effect in the order their buffers are
+ * flushed.  a value passed to insert or delete must stay valid until the
+ * thread's buffer is flushed.
+ *
+ * what a find sees depends on the level given to rbtree_lsm_create():
+ *
+ * RBTREE_LSM_FLUSHED:     the shared tree only; a write is seen once its
+ *                         buffer has been flushed.
+ *
+ * RBTREE_LSM_OWN_WRITES:  the calling thread's buffer, then the shared
+ *                         tree; a thread sees its own writes at once.
+ *
+ * RBTREE_LSM_ALL_WRITES:  every thread's buffer, then the shared tree.
+ *                         each buffer then has a mutex, which its own
+ *                         thread takes for every op; it is uncontended
+ *                         except while a find looks at the buffer.  the
+ *                         buffers are looked at in a fixed order (the
+ *                         caller's own first), and the first one with
+ *                         an op on the key decides the find.  so if
+ *                         several threads have ops on the same key
+ *                         pending, the find may report one that a later
+ *                         flush of another buffer then overrides.
+ *
+ * finds on the shared tree share a read lock, so the tree must be one
+ * whose finds write nothing (rbtree_find_is_read_only()):  no lazy key
+ * shifting, tracing, hot-key cache or open transaction.
+ * rbtree_lsm_create() refuses any other tree.  all access to the tree
+ * must go through the front end.
+ *
+ * Usage:
+ *     rbtree_lsm_t *lsm = rbtree_lsm_create(&tree, 256, RBTREE_LSM_OWN_WRITES);
+ *     rbtree_lsm_insert(lsm, &my_data);       // from any thread
+ *     ...
+ *     rbtree_lsm_destroy(lsm);                // flushes every buffer
+ */
+
+typedef enum {
+    RBTREE_LSM_FLUSHED,
+    RBTREE_LSM_OWN_WRITES,
+    RBTREE_LSM_ALL_WRITES
+} rbtree_lsm_level_t;
+
+typedef struct _rbtree_lsm_t rbtree_lsm_t;
+
+/* return a front end for tree whose buffers hold capacity ops, or NULL
+ * on failure or if finds on tree aren't read-only.
+ */
+rbtree_lsm_t *rbtree_lsm_create(rbtree_t *tree, size_t capacity, rbtree_lsm_level_t level);
+
+/* flush every buffer, and free the front end (not the tree).  no thread
+ * may be using it.  return 0, or -1 if a flush failed.
+ */
+int rbtree_lsm_destroy(rbtree_lsm_t *lsm);
+
+/* return the value equal to data, or NULL if there is none. */
+void *rbtree_lsm_find(rbtree_lsm_t *lsm, void *data);
+
+/* buffer an insert or a delete.  return 0, or -1 if memory ran out
+ * (for the op, or for a flush it set off).  an insert returns 1, and
+ * drops data, if an insert of an equal value is already pending in the
+ * thread's buffer (or, for a thread past the buffers, whose ops are
+ * applied at once, if the tree already holds one).
+ */
+int rbtree_lsm_insert(rbtree_lsm_t *lsm, void *data);
+int rbtree_lsm_delete(rbtree_lsm_t *lsm, void *data);
+
+/* flush the calling thread's buffer.  return 0 or -1, as above. */
+int rbtree_lsm_flush(rbtree_lsm_t *lsm);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,348 @@
+/* rbtree_mapped.c, Copyright (C) 2016, Greg Johnson
+ * Released under the terms of the GNU GPL v2.0.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ */
+#include <stdlib.h>
+#include <stdbool.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <sys/file.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "rbtree_mapped.h"
+
+/* Red-black trees in a shared memory segment or a mapped file.
+ *
+ * The segment starts with a segment_t header, followed by the memory
+ * that tree nodes and user data values are allocated from.
+ *
+ * Memory is handed out in power-of-two size classes.  Each block starts
+ * with a small header giving its size class; freed blocks go on a free
+ * list for their class and are reused before fresh memory is bumped off
+ * the end of the used part of the segment.
+ */
+
+#ifndef MAP_FIXED_NOREPLACE
+#define MAP_FIXED_NOREPLACE 0
+#endif
+
+#define MAPPED_MAGIC 0x7262747265656d32ULL
+
+#define MIN_CLASS   5
+#define NUM_CLASSES 48
+
+typedef struct _block_t {
+    size_t size_class;
+    struct _block_t *next;  /* only meaningful while on a free list */
+} block_t;
+
+typedef struct {
+    unsigned long long magic;
+    void   *base;           /* every process maps the segment here */
+    size_t  size;
+    size_t  used;
+
+    pthread_mutex_t lock;
+
+    rbtree_node_t *root;
+    block_t *free_lists[NUM_CLASSES];
+} segment_t;
+
+struct _rbtree_mapped_t {
+    segment_t *seg;
+    int        fd;          /* open file of a file-backed tree, or -1 */
+    rbtree_t   tree;        /* per-process; root is copied in and out */
+};
+
+static void *segment_alloc(void *ctx, size_t size) {
+    segment_t *seg = (segment_t *) ctx;
+    block_t *block;
+    int c = MIN_CLASS;
+
+    while (c < NUM_CLASSES && ((size_t) 1 << c) < size + sizeof(block_t))
+        ++c;
+
+    if (c == NUM_CLASSES) return NULL;
+
+    if ((block = seg->free_lists[c]) != NULL) {
+        seg->free_lists[c] = block->next;
+
+    } else {
+        if (seg->size - seg->used < ((size_t) 1 << c)) return NULL;
+
+        block = (block_t *) ((char *) seg + seg->used);
+        block->size_class = c;
+        seg->used += (size_t) 1 << c;
+    }
+
+    return block + 1;
+}
+
+static void segment_free(void *ctx, void *ptr) {
+    segment_t *seg = (segment_t *) ctx;
+    block_t *block;
+
+    if (ptr == NULL) return;
+
+    block = (block_t *) ptr - 1;
+    block->next = seg->free_lists[block->size_class];
+    seg->free_lists[block->size_class] = block;
+}
+
+/* a process died holding the lock.  take it over; its change to the
+ * tree may be incomplete, but refusing all further access would be worse.
+ */
+static void lock_segment(segment_t *seg) {
+    if (pthread_mutex_lock(&seg->lock) == EOWNERDEAD)
+        pthread_mutex_consistent(&seg->lock);
+}
+
+static void unlock_segment(segment_t *seg) {
+    pthread_mutex_unlock(&seg->lock);
+}
+
+static rbtree_mapped_t *new_handle(segment_t *seg, int fd, rbtree_cmp_t *cmp) {
+    rbtree_mapped_t *mapped = (rbtree_mapped_t *) malloc(sizeof(rbtree_mapped_t));
+
+    if (mapped == NULL) return NULL;
+
+    mapped->seg = seg;
+    mapped->fd  = fd;
+    rbtree_init(&mapped->tree, cmp);
+    rbtree_set_allocator(&mapped->tree, segment_alloc, segment_free, seg);
+
+    return mapped;
+}
+
+static void init_lock(segment_t *seg) {
+    pthread_mutexattr_t attr;
+
+    pthread_mutexattr_init(&attr);
+    pthread_mutexattr_setpshared(&attr, PTHREAD_PROCESS_SHARED);
+    pthread_mutexattr_setrobust(&attr, PTHREAD_MUTEX_ROBUST);
+    pthread_mutex_init(&seg->lock, &attr);
+    pthread_mutexattr_destroy(&attr);
+}
+
+/* size fd's segment, map it, and lay out an empty tree in it. */
+static segment_t *map_new(int fd, size_t size) {
+    segment_t *seg;
+    int c;
+
+    if (size < sizeof(segment_t) || ftruncate(fd, size) < 0)
+        return NULL;
+
+    seg = (segment_t *) mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+
+    if (seg == MAP_FAILED) return NULL;
+
+    seg->base = seg;
+    seg->size = size;
+    seg->used = (sizeof(segment_t) + 15) & ~(size_t) 15;
+    seg->root = NULL;
+
+    for (c = 0; c < NUM_CLASSES; ++c)
+        seg->free_lists[c] = NULL;
+
+    init_lock(seg);
+
+    /* only now can other processes open the segment.. */
+    __sync_synchronize();
+    seg->magic = MAPPED_MAGIC;
+
+    return seg;
+}
+
+/* map fd's segment at the address it was created at. */
+static segment_t *map_existing(int fd) {
+    segment_t header, *seg;
+
+    if (pread(fd, &header, sizeof(header), 0) != sizeof(header)
+            || header.magic != MAPPED_MAGIC)
+        return NULL;
+
+    seg = (segment_t *) mmap(header.base, header.size, PROT_READ | PROT_WRITE,
+                             MAP_SHARED | MAP_FIXED_NOREPLACE, fd, 0);
+
+    if (seg == MAP_FAILED) return NULL;
+
+    /* older kernels treat the address as a hint only.. */
+    if (seg != header.base) {
+        munmap(seg, header.size);
+        return NULL;
+    }
+
+    return seg;
+}
+
+rbtree_mapped_t *rbtree_mapped_create(const char *name, size_t size, rbtree_cmp_t *cmp) {
+    rbtree_mapped_t *mapped = NULL;
+    segment_t *seg;
+    int fd;
+
+    if ((fd = shm_open(name, O_RDWR | O_CREAT | O_EXCL, 0600)) < 0)
+        return NULL;
+
+    if ((seg = map_new(fd, size)) != NULL
+            && (mapped = new_handle(seg, -1, cmp)) == NULL)
+        munmap(seg, size);
+
+    close(fd);
+    if (mapped == NULL) shm_unlink(name);
+
+    return mapped;
+}
+
+rbtree_mapped_t *rbtree_mapped_open(const char *name, rbtree_cmp_t *cmp) {
+    rbtree_mapped_t *mapped = NULL;
+    segment_t *seg;
+    int fd;
+
+    if ((fd = shm_open(name, O_RDWR, 0)) < 0)
+        return NULL;
+
+    if ((seg = map_existing(fd)) != NULL
+            && (mapped = new_handle(seg, -1, cmp)) == NULL)
+        munmap(seg, seg->size);
+
+    close(fd);
+
+    return mapped;
+}
+
+/* a file-backed tree keeps its fd open with a shared flock() on it, so
+ * that an opener can tell whether anybody else has the tree open.
+ */
+rbtree_mapped_t *rbtree_mapped_create_file(const char *path, size_t size, rbtree_cmp_t *cmp) {
+    rbtree_mapped_t *mapped = NULL;
+    segment_t *seg;
+    int fd;
+
+    if ((fd = open(path, O_RDWR | O_CREAT | O_EXCL, 0600)) < 0)
+        return NULL;
+
+    if (flock(fd, LOCK_SH) == 0 && (seg = map_new(fd, size)) != NULL) {
+        madvise(seg, size, MADV_RANDOM);
+
+        if ((mapped = new_handle(seg, fd, cmp)) == NULL)
+            munmap(seg, size);
+    }
+
+    if (mapped == NULL) {
+        close(fd);
+        unlink(path);
+    }
+
+    return mapped;
+}
+
+rbtree_mapped_t *rbtree_mapped_open_file(const char *path, rbtree_cmp_t *cmp) {
+    rbtree_mapped_t *mapped = NULL;
+    segment_t *seg;
+    bool only_user;
+    int fd;
+
+    if ((fd = open(path, O_RDWR)) < 0)
+        return NULL;
+
+    /* the lock word was saved with the file, and may be held by a
+     * process from an earlier run.  if nobody else has the file open,
+     * start over with a fresh lock, before letting anybody else in:  a
+     * later opener waits in flock(LOCK_SH) until this one is done.
+     * (the downgrade isn't atomic, but an opener that gets LOCK_EX in
+     * between only initializes a lock that nobody holds yet.)
+     */
+    only_user = flock(fd, LOCK_EX | LOCK_NB) == 0;
+
+    if ((only_user || flock(fd, LOCK_SH) == 0) && (seg = map_existing(fd)) != NULL) {
+        if (only_user) init_lock(seg);
+
+        if (only_user && flock(fd, LOCK_SH) != 0) {
+            munmap(seg, seg->size);
+
+        } else {
+            madvise(seg, seg->size, MADV_RANDOM);
+
+            if ((mapped = new_handle(seg, fd, cmp)) == NULL)
+                munmap(seg, seg->size);
+        }
+    }
+
+    if (mapped == NULL) close(fd);
+
+    return mapped;
+}
+
+int rbtree_mapped_sync(rbtree_mapped_t *mapped) {
+    int result;
+
+    lock_segment(mapped->seg);
+    result = msync(mapped->seg, mapped->seg->used, MS_SYNC);
+    unlock_segment(mapped->seg);
+
+    return result;
+}
+
+void rbtree_mapped_close(rbtree_mapped_t *mapped) {
+    munmap(mapped->seg, mapped->seg->size);
+    if (mapped->fd >= 0) close(mapped->fd);
+    free(mapped);
+}
+
+int rbtree_mapped_unlink(const char *name) {
+    return shm_unlink(name);
+}
+
+void *rbtree_mapped_alloc(rbtree_mapped_t *mapped, size_t size) {
+    void *result;
+
+    lock_segment(mapped->seg);
+    result = segment_alloc(mapped->seg, size);
+    unlock_segment(mapped->seg);
+
+    return result;
+}
+
+void rbtree_mapped_free(rbtree_mapped_t *mapped, void *ptr) {
+    lock_segment(mapped->seg);
+    segment_free(mapped->seg, ptr);
+    unlock_segment(mapped->seg);
+}
+
+rbtree_t *rbtree_mapped_lock(rbtree_mapped_t *mapped) {
+    lock_segment(mapped->seg);
+    mapped->tree.root = mapped->seg->root;
+
+    return &mapped->tree;
+}
+
+void rbtree_mapped_unlock(rbtree_mapped_t *mapped) {
+    mapped->seg->root = mapped->tree.root;
+    unlock_segment(mapped->seg);
+}
+
+void *rbtree_mapped_find(rbtree_mapped_t *mapped, void *vsearch) {
+    void *result = rbtree_find(rbtree_mapped_lock(mapped), vsearch);
+    rbtree_mapped_unlock(mapped);
+
+    return result;
+}
+
+void *rbtree_mapped_insert(rbtree_mapped_t *mapped, void *x) {
+    void *result = rbtree_insert(rbtree_mapped_lock(mapped), x);
+    rbtree_mapped_unlock(mapped);
+
+    return result;
+}
+
+void *rbtree_mapped_delete(rbtree_mapped_t *mapped, void *z) {
+    void *result = rbtree_delete(rbtree_mapped_lock(mapped), z);
+    rbtree_mapped_unlock(mapped);
+
+    return result;
+}
@@ -0,0 +1,104 @@
+/* rbtree_mapped.h, Copyright (C) 2016, Greg Johnson
+ * Released under the terms of the GNU GPL v2.0.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ */
+#ifndef RBTREE_MAPPED_H
+#define RBTREE_MAPPED_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include "rbtree.h"
+
+/* a red-black tree that lives in a named shared memory segment, so that
+ * several processes can use one copy of the tree.
+ *
+ * tree nodes are allocated from the segment.  user data values that are
+ * inserted must live in the segment too; allocate them with
+ * rbtree_mapped_alloc().
+ *
+ * every process maps the segment at the address chosen by the process
+ * that created it, so the tree's links are plain pointers and
+ * rbtree_mapped_find() costs the same as rbtree_find() plus an
+ * uncontended lock.  rbtree_mapped_open() fails if that address range
+ * is already in use in the calling process.
+ *
+ * all operations are serialized by a process-shared robust mutex.  if a
+ * process dies while holding it, the next process to lock it takes it
+ * over and carries on; a mutation that was cut short may have left the
+ * tree damaged.
+ *
+ * a tree can also be kept in an ordinary file, which survives process
+ * restarts.  this is persistence only, not an out-of-core tree: the file
+ * is mapped whole and paging is left to the kernel, with no buffer pool,
+ * pinning or eviction policy of our own.  nodes are placed wherever the
+ * allocator finds room, not grouped into pages by subtree, so a search
+ * path may touch a different page at every level.  size the file so the
+ * tree's working set fits in memory.
+ *
+ * Usage:
+ *     rbtree_mapped_t *m = rbtree_mapped_create("/my_index", 1 << 26, my_cmp);
+ *     my_data_t *my_data = rbtree_mapped_alloc(m, sizeof(my_data_t));
+ *     ...
+ *     rbtree_mapped_insert(m, my_data);
+ *
+ *     // in another process:
+ *     rbtree_mapped_t *m = rbtree_mapped_open("/my_index", my_cmp);
+ *     found = rbtree_mapped_find(m, &search);
+ */
+
+typedef struct _rbtree_mapped_t rbtree_mapped_t;
+
+/* create a segment of the given size (in bytes) holding an empty tree.
+ * return NULL on failure, or if a segment with this name already exists.
+ */
+rbtree_mapped_t *rbtree_mapped_create(const char *name, size_t size, rbtree_cmp_t *cmp);
+
+/* map an existing segment created by rbtree_mapped_create().
+ * cmp must order the data the same way as the creator's cmp.
+ */
+rbtree_mapped_t *rbtree_mapped_open(const char *name, rbtree_cmp_t *cmp);
+
+/* same as rbtree_mapped_create() and rbtree_mapped_open(), but the
+ * segment is the file at path.  the file must not exist when created.
+ */
+rbtree_mapped_t *rbtree_mapped_create_file(const char *path, size_t size, rbtree_cmp_t *cmp);
+rbtree_mapped_t *rbtree_mapped_open_file(const char *path, rbtree_cmp_t *cmp);
+
+/* write dirty pages of a file-backed tree back to the file and wait for
+ * the writes to complete.  return 0 on success, -1 on failure.
+ */
+int rbtree_mapped_sync(rbtree_mapped_t *mapped);
+
+/* unmap the segment from this process.  the segment itself remains. */
+void rbtree_mapped_close(rbtree_mapped_t *mapped);
+
+/* remove the segment name; it is destroyed once every process closes it. */
+int rbtree_mapped_unlink(const char *name);
+
+/* allocate and free memory for user data values inside the segment. */
+void *rbtree_mapped_alloc(rbtree_mapped_t *mapped, size_t size);
+void  rbtree_mapped_free(rbtree_mapped_t *mapped, void *ptr);
+
+/* same as rbtree_find(), rbtree_insert(), rbtree_delete() */
+void *rbtree_mapped_find(rbtree_mapped_t *mapped, void *vsearch);
+void *rbtree_mapped_insert(rbtree_mapped_t *mapped, void *x);
+void *rbtree_mapped_delete(rbtree_mapped_t *mapped, void *z);
+
+/* lock the segment and return the tree, so that other rbtree_*()
+ * functions (iteration, etc.) can be used on it.  call
+ * rbtree_mapped_unlock() when done.
+ */
+rbtree_t *rbtree_mapped_lock(rbtree_mapped_t *mapped);
+void rbtree_mapped_unlock(rbtree_mapped_t *mapped);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
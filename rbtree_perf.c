@@ -0,0 +1,127 @@
+/* rbtree_perf.c, Copyright (C) 2016, Greg Johnson
+ * Released under the terms of the GNU GPL v2.0.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ */
+#include <string.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <linux/perf_event.h>
+#include "rbtree_perf.h"
+
+#define CACHE_EVENT(cache, op, result) \
+    ((cache) | ((op) << 8) | ((result) << 16))
+
+static const struct {
+    const char *name;
+    unsigned int type;
+    unsigned long long config;
+} events[RBTREE_PERF_NUM_COUNTERS] = {
+    [RBTREE_PERF_CYCLES] =
+        {"cycles",        PERF_TYPE_HARDWARE, PERF_COUNT_HW_CPU_CYCLES},
+    [RBTREE_PERF_INSTRUCTIONS] =
+        {"instructions",  PERF_TYPE_HARDWARE, PERF_COUNT_HW_INSTRUCTIONS},
+    [RBTREE_PERF_L1D_MISSES] =
+        {"L1d misses",    PERF_TYPE_HW_CACHE, CACHE_EVENT(PERF_COUNT_HW_CACHE_L1D,
+                                                          PERF_COUNT_HW_CACHE_OP_READ,
+                                                          PERF_COUNT_HW_CACHE_RESULT_MISS)},
+    [RBTREE_PERF_LLC_MISSES] =
+        {"LLC misses",    PERF_TYPE_HARDWARE, PERF_COUNT_HW_CACHE_MISSES},
+    [RBTREE_PERF_DTLB_MISSES] =
+        {"dTLB misses",   PERF_TYPE_HW_CACHE, CACHE_EVENT(PERF_COUNT_HW_CACHE_DTLB,
+                                                          PERF_COUNT_HW_CACHE_OP_READ,
+                                                          PERF_COUNT_HW_CACHE_RESULT_MISS)},
+    [RBTREE_PERF_BRANCH_MISSES] =
+        {"branch misses", PERF_TYPE_HARDWARE, PERF_COUNT_HW_BRANCH_MISSES},
+};
+
+int rbtree_perf_open(rbtree_perf_t *perf) {
+    int i, available = 0;
+
+    for (i = 0; i < RBTREE_PERF_NUM_COUNTERS; ++i) {
+        struct perf_event_attr attr;
+
+        memset(&attr, 0, sizeof(attr));
+        attr.size           = sizeof(attr);
+        attr.type           = events[i].type;
+        attr.config         = events[i].config;
+        attr.disabled       = 1;
+        attr.exclude_kernel = 1;
+        attr.exclude_hv     = 1;
+        attr.read_format    = PERF_FORMAT_TOTAL_TIME_ENABLED | PERF_FORMAT_TOTAL_TIME_RUNNING;
+
+        perf->fd[i]    = syscall(SYS_perf_event_open, &attr, 0, -1, -1, PERF_FLAG_FD_CLOEXEC);
+        perf->value[i] = 0;
+
+        if (perf->fd[i] >= 0) ++available;
+    }
+
+    return available;
+}
+
+void rbtree_perf_start(rbtree_perf_t *perf) {
+    int i;
+
+    for (i = 0; i < RBTREE_PERF_NUM_COUNTERS; ++i) {
+        if (perf->fd[i] < 0) continue;
+
+        ioctl(perf->fd[i], PERF_EVENT_IOC_RESET, 0);
+        ioctl(perf->fd[i], PERF_EVENT_IOC_ENABLE, 0);
+    }
+}
+
+void rbtree_perf_stop(rbtree_perf_t *perf) {
+    int i;
+
+    for (i = 0; i < RBTREE_PERF_NUM_COUNTERS; ++i) {
+        if (perf->fd[i] >= 0) ioctl(perf->fd[i], PERF_EVENT_IOC_DISABLE, 0);
+    }
+
+    /* if there were more counters than the pmu could count at once,
+     * the kernel time-sliced them; scale up to the whole run.
+     */
+    for (i = 0; i < RBTREE_PERF_NUM_COUNTERS; ++i) {
+        unsigned long long buf[3];   /* value, time enabled, time running */
+
+        if (perf->fd[i] < 0) continue;
+
+        if (read(perf->fd[i], buf, sizeof(buf)) != sizeof(buf) || buf[2] == 0)
+            perf->value[i] = 0;
+        else if (buf[2] < buf[1])
+            perf->value[i] = (unsigned long long) ((double) buf[0] * buf[1] / buf[2]);
+        else
+            perf->value[i] = buf[0];
+    }
+}
+
+bool rbtree_perf_available(rbtree_perf_t *perf, rbtree_perf_counter_t counter) {
+    return perf->fd[counter] >= 0;
+}
+
+void rbtree_perf_report(rbtree_perf_t *perf, FILE *out, unsigned long long num_ops) {
+    int i, available = 0;
+
+    for (i = 0; i < RBTREE_PERF_NUM_COUNTERS; ++i) {
+        if (perf->fd[i] < 0) continue;
+
+        fprintf(out, "%-14s %12.2f per op\n", events[i].name,
+                num_ops == 0 ? 0.0 : (double) perf->value[i] / num_ops);
+        ++available;
+    }
+
+    if (available == 0)
+        fprintf(out, "hardware performance counters unavailable\n");
+}
+
+void rbtree_perf_close(rbtree_perf_t *perf) {
+    int i;
+
+    for (i = 0; i < RBTREE_PERF_NUM_COUNTERS; ++i) {
+        if (perf->fd[i] >= 0) close(perf->fd[i]);
+        perf->fd[i] = -1;
+    }
+}
@@ -0,0 +1,74 @@
+/* rbtree_perf.h, Copyright (C) 2016, Greg Johnson
+ * Released under the terms of the GNU GPL v2.0.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ */
+#ifndef RBTREE_PERF_H
+#define RBTREE_PERF_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stdio.h>
+#include <stdbool.h>
+
+/* hardware performance counters for benchmarks, read with
+ * perf_event_open(2).
+ *
+ * each counter is opened on its own, so a counter that the cpu or the
+ * kernel (perf_event_paranoid, seccomp, virtualization) won't provide
+ * is simply left out.  only user-space events of the calling thread
+ * are counted.
+ *
+ * Usage:
+ *     rbtree_perf_t perf;
+ *     rbtree_perf_open(&perf);
+ *
+ *     rbtree_perf_start(&perf);
+ *     ... run workload ...
+ *     rbtree_perf_stop(&perf);
+ *
+ *     rbtree_perf_report(&perf, stdout, num_ops);
+ *     rbtree_perf_close(&perf);
+ */
+
+typedef enum {
+    RBTREE_PERF_CYCLES,
+    RBTREE_PERF_INSTRUCTIONS,
+    RBTREE_PERF_L1D_MISSES,
+    RBTREE_PERF_LLC_MISSES,
+    RBTREE_PERF_DTLB_MISSES,
+    RBTREE_PERF_BRANCH_MISSES,
+    RBTREE_PERF_NUM_COUNTERS
+} rbtree_perf_counter_t;
+
+typedef struct {
+    int fd[RBTREE_PERF_NUM_COUNTERS];              /* -1 if unavailable */
+    unsigned long long value[RBTREE_PERF_NUM_COUNTERS];
+} rbtree_perf_t;
+
+/* open the counters; return how many are available. */
+int rbtree_perf_open(rbtree_perf_t *perf);
+
+/* zero the counters and start counting. */
+void rbtree_perf_start(rbtree_perf_t *perf);
+
+/* stop counting and read the counters into perf->value[]. */
+void rbtree_perf_stop(rbtree_perf_t *perf);
+
+bool rbtree_perf_available(rbtree_perf_t *perf, rbtree_perf_counter_t counter);
+
+/* print each available counter divided by num_ops. */
+void rbtree_perf_report(rbtree_perf_t *perf, FILE *out, unsigned long long num_ops);
+
+void rbtree_perf_close(rbtree_perf_t *perf);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,493 @@
+/* rbtree_pool.c, Copyright (C) 2016, Greg Johnson
+ * Released under the terms of the GNU GPL v2.0.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ */
+#include <stdlib.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <pthread.h>
+#include <sys/mman.h>
+#include "rbtree_pool.h"
+
+/* Node pool with per-thread magazines (after Bonwick & Adams, "Magazines
+ * and Vmem", 2001).
+ *
+ * Each thread has a "loaded" and a "previous" magazine.  Allocation pops
+ * from loaded; if it is empty and previous is full, the two are swapped.
+ * Frees push onto loaded; if it is full and previous is empty, the two
+ * are swapped.  Keeping two magazines means that a thread alternating
+ * between allocating and freeing right at a magazine boundary doesn't
+ * go to the depot on every call.
+ *
+ * Only when both magazines are empty (or both full) does a thread lock
+ * the depot, to trade a magazine for a full one (or an empty one).  The
+ * depot carves a new slab into full magazines when it has none left.
+ *
+ * Slabs are SLAB_SIZE bytes, aligned on a SLAB_SIZE boundary, so the
+ * slab an object belongs to can be found by masking its address.  That
+ * lets trim() count the free objects of each slab by walking the depot's
+ * magazines, with no bookkeeping on the fast path.
+ *
+ * Trimming is automatic when the depot holds more than next_trim
+ * objects.  After each trim next_trim is raised well above what is left
+ * in the depot, so a depot whose free objects are scattered over
+ * partially used slabs isn't walked over and over.
+ */
+
+#define MAG_SIZE  64
+#define SLAB_SIZE ((size_t) 1 << 18)
+
+typedef struct _magazine_t {
+    int count;
+    struct _magazine_t *next;
+    void *objs[MAG_SIZE];
+} magazine_t;
+
+typedef struct _slab_t {
+    struct _slab_t *next;
+    size_t num_objs;
+    size_t num_free;        /* only meaningful during trim() */
+} slab_t;
+
+typedef struct {
+    magazine_t *loaded, *previous;
+} thread_cache_t;
+
+struct _rbtree_pool_t {
+    size_t obj_size;
+    pthread_key_t key;
+
+    /* the depot.. */
+    pthread_mutex_t lock;
+    magazine_t *full;
+    magazine_t *empty;
+    slab_t *slabs;
+
+    size_t depot_objs;      /* objects in the full magazines */
+    size_t total_objs;      /* objects in all slabs */
+    size_t next_trim;
+};
+
+#define SLAB_START ((sizeof(slab_t) + 15) & ~(size_t) 15)
+
+#define SLAB_OF(obj) ((slab_t *) ((uintptr_t) (obj) & ~(uintptr_t) (SLAB_SIZE - 1)))
+
+static size_t trim(rbtree_pool_t *pool);
+
+static magazine_t *new_magazine() {
+    magazine_t *mag = (magazine_t *) malloc(sizeof(magazine_t));
+
+    if (mag != NULL) {
+        mag->count = 0;
+        mag->next  = NULL;
+    }
+
+    return mag;
+}
+
+/* pop a magazine off a depot list; for the empty list, make a new one if
+ * need be.  depot must be locked.
+ */
+static magazine_t *take_full(rbtree_pool_t *pool) {
+    magazine_t *mag = pool->full;
+
+    if (mag != NULL) {
+        pool->full        = mag->next;
+        pool->depot_objs -= mag->count;
+    }
+
+    return mag;
+}
+
+static magazine_t *take_empty(rbtree_pool_t *pool) {
+    magazine_t *mag = pool->empty;
+
+    if (mag == NULL) return new_magazine();
+
+    pool->empty = mag->next;
+    return mag;
+}
+
+static void give(magazine_t **list, magazine_t *mag) {
+    mag->next = *list;
+    *list     = mag;
+}
+
+static void give_full(rbtree_pool_t *pool, magazine_t *mag) {
+    give(&pool->full, mag);
+    pool->depot_objs += mag->count;
+}
+
+/* map a new slab and carve it into full magazines in the depot.
+ * depot must be locked.  return -1 on failure, with the depot as it was.
+ */
+static int grow(rbtree_pool_t *pool) {
+    char *raw, *base, *obj;
+    size_t lead, num_objs = (SLAB_SIZE - SLAB_START) / pool->obj_size, i;
+    slab_t *slab;
+    magazine_t *mags = NULL, *mag = NULL;
+
+    /* take the magazines first, since they can fail and the slab can't
+     * be put back once objects are handed out of it.
+     */
+    for (i = 0; i < num_objs; i += MAG_SIZE) {
+        if ((mag = take_empty(pool)) == NULL) break;
+        give(&mags, mag);
+    }
+
+    /* over-allocate so that the slab can be aligned, then trim. */
+    raw = i < num_objs ? (char *) MAP_FAILED
+                       : (char *) mmap(NULL, 2 * SLAB_SIZE, PROT_READ | PROT_WRITE,
+                                       MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+
+    if (raw == MAP_FAILED) {
+        while ((mag = mags) != NULL) {
+            mags = mag->next;
+            give(&pool->empty, mag);
+        }
+
+        return -1;
+    }
+
+    base = (char *) (((uintptr_t) raw + SLAB_SIZE - 1) & ~(uintptr_t) (SLAB_SIZE - 1));
+    lead = base - raw;
+    if (lead > 0) munmap(raw, lead);
+    munmap(base + SLAB_SIZE, SLAB_SIZE - lead);
+
+    slab = (slab_t *) base;
+    slab->num_objs = num_objs;
+    slab->next     = pool->slabs;
+    pool->slabs    = slab;
+
+    pool->total_objs += num_objs;
+
+    for (obj = base + SLAB_START, i = 0; i < num_objs; obj += pool->obj_size, ++i) {
+        if (i % MAG_SIZE == 0) {
+            mag  = mags;
+            mags = mag->next;
+        }
+
+        mag->objs[mag->count++] = obj;
+
+        if (mag->count == MAG_SIZE || i + 1 == num_objs) give_full(pool, mag);
+    }
+
+    return 0;
+}
+
+/* a thread is exiting; hand its magazines back to the depot. */
+static void release_cache(void *ptr) {
+    thread_cache_t *cache = (thread_cache_t *) ptr;
+    rbtree_pool_t *pool   = *(rbtree_pool_t **) (cache + 1);
+    magazine_t *mags[2];
+    int i;
+
+    mags[0] = cache->loaded;
+    mags[1] = cache->previous;
+
+    pthread_mutex_lock(&pool->lock);
+    for (i = 0; i < 2; ++i) {
+        if (mags[i]->count > 0) give_full(pool, mags[i]);
+        else                    give(&pool->empty, mags[i]);
+    }
+    pthread_mutex_unlock(&pool->lock);
+
+    free(cache);
+}
+
+/* the calling thread's cache, created on first use.  the cache is
+ * followed by a pointer to its pool, for release_cache().
+ */
+static thread_cache_t *get_cache(rbtree_pool_t *pool) {
+    thread_cache_t *cache = (thread_cache_t *) pthread_getspecific(pool->key);
+
+    if (cache != NULL) return cache;
+
+    cache = (thread_cache_t *) malloc(sizeof(thread_cache_t) + sizeof(rbtree_pool_t *));
+    if (cache == NULL) return NULL;
+
+    *(rbtree_pool_t **) (cache + 1) = pool;
+
+    pthread_mutex_lock(&pool->lock);
+    cache->loaded   = take_empty(pool);
+    cache->previous = take_empty(pool);
+    pthread_mutex_unlock(&pool->lock);
+
+    if (cache->loaded == NULL || cache->previous == NULL
+            || pthread_setspecific(pool->key, cache) != 0) {
+        free(cache->loaded);
+        free(cache->previous);
+        free(cache);
+        return NULL;
+    }
+
+    return cache;
+}
+
+void *rbtree_pool_alloc(rbtree_pool_t *pool) {
+    thread_cache_t *cache = get_cache(pool);
+    magazine_t *mag;
+
+    if (cache == NULL) return NULL;
+
+    if (cache->loaded->count > 0)
+        return cache->loaded->objs[--cache->loaded->count];
+
+    if (cache->previous->count > 0) {
+        mag             = cache->loaded;
+        cache->loaded   = cache->previous;
+        cache->previous = mag;
+
+        return cache->loaded->objs[--cache->loaded->count];
+    }
+
+    /* both magazines are empty; trade one for a full one */
+    pthread_mutex_lock(&pool->lock);
+
+    if (pool->full == NULL && grow(pool) < 0) {
+        pthread_mutex_unlock(&pool->lock);
+        return NULL;
+    }
+
+    give(&pool->empty, cache->previous);
+    cache->previous = cache->loaded;
+    cache->loaded   = take_full(pool);
+
+    pthread_mutex_unlock(&pool->lock);
+
+    return cache->loaded->objs[--cache->loaded->count];
+}
+
+void rbtree_pool_free(rbtree_pool_t *pool, void *obj) {
+    thread_cache_t *cache;
+    magazine_t *mag;
+
+    if (obj == NULL) return;
+
+    /* no cache and no memory for one; leak the object rather than crash */
+    if ((cache = get_cache(pool)) == NULL) return;
+
+    if (cache->loaded->count < MAG_SIZE) {
+        cache->loaded->objs[cache->loaded->count++] = obj;
+        return;
+    }
+
+    if (cache->previous->count == 0) {
+        mag             = cache->loaded;
+        cache->loaded   = cache->previous;
+        cache->previous = mag;
+
+        cache->loaded->objs[cache->loaded->count++] = obj;
+        return;
+    }
+
+    /* both magazines are full; trade one for an empty one */
+    pthread_mutex_lock(&pool->lock);
+
+    if ((mag = take_empty(pool)) == NULL) {
+        pthread_mutex_unlock(&pool->lock);
+        return;
+    }
+
+    give_full(pool, cache->previous);
+    cache->previous = cache->loaded;
+    cache->loaded   = mag;
+
+    if (pool->depot_objs > pool->next_trim) trim(pool);
+
+    pthread_mutex_unlock(&pool->lock);
+
+    cache->loaded->objs[cache->loaded->count++] = obj;
+}
+
+/* give every slab all of whose objects are in the depot back to the
+ * operating system.  depot must be locked.
+ */
+static size_t trim(rbtree_pool_t *pool) {
+    magazine_t *mag, **link;
+    slab_t *slab, **slab_link;
+    size_t released = 0;
+    int i, j;
+
+    for (slab = pool->slabs; slab != NULL; slab = slab->next) {
+        slab->num_free = 0;
+    }
+
+    for (mag = pool->full; mag != NULL; mag = mag->next) {
+        for (i = 0; i < mag->count; ++i) {
+            SLAB_OF(mag->objs[i])->num_free++;
+        }
+    }
+
+    /* drop the objects of the slabs that are going away.. */
+    for (link = &pool->full; (mag = *link) != NULL; ) {
+        for (i = j = 0; i < mag->count; ++i) {
+            slab = SLAB_OF(mag->objs[i]);
+            if (slab->num_free < slab->num_objs) mag->objs[j++] = mag->objs[i];
+        }
+
+        pool->depot_objs -= mag->count - j;
+        mag->count = j;
+
+        if (mag->count == 0) {
+            *link = mag->next;
+            give(&pool->empty, mag);
+        } else {
+            link = &mag->next;
+        }
+    }
+
+    /* ..and then the slabs themselves. */
+    for (slab_link = &pool->slabs; (slab = *slab_link) != NULL; ) {
+        if (slab->num_free == slab->num_objs) {
+            *slab_link        = slab->next;
+            pool->total_objs -= slab->num_objs;
+            released         += SLAB_SIZE;
+            munmap(slab, SLAB_SIZE);
+        } else {
+            slab_link = &slab->next;
+        }
+    }
+
+    /* keep just a few spare empty magazines */
+    for (link = &pool->empty, i = 0; (mag = *link) != NULL; ++i) {
+        if (i < 16) {
+            link = &mag->next;
+        } else {
+            *link = mag->next;
+            free(mag);
+        }
+    }
+
+    pool->next_trim = pool->depot_objs * 2 > pool->total_objs / 2
+                    ? pool->depot_objs * 2
+                    : pool->total_objs / 2;
+    if (pool->next_trim < SLAB_SIZE / pool->obj_size * 4)
+        pool->next_trim = SLAB_SIZE / pool->obj_size * 4;
+
+    return released;
+}
+
+static void *pool_alloc(void *ctx, size_t size) {
+    rbtree_pool_t *pool = (rbtree_pool_t *) ctx;
+
+    /* the tree's nodes have grown since the pool was set */
+    if (size > pool->obj_size) return NULL;
+
+    return rbtree_pool_alloc(pool);
+}
+
+static void pool_free(void *ctx, void *ptr) {
+    rbtree_pool_free((rbtree_pool_t *) ctx, ptr);
+}
+
+rbtree_pool_t *rbtree_pool_create(size_t obj_size) {
+    rbtree_pool_t *pool = (rbtree_pool_t *) malloc(sizeof(rbtree_pool_t));
+
+    if (pool == NULL) return NULL;
+
+    /* keep objects pointer-aligned */
+    obj_size = (obj_size + sizeof(void *) - 1) & ~(sizeof(void *) - 1);
+
+    if (obj_size == 0 || obj_size > SLAB_SIZE - SLAB_START
+            || pthread_key_create(&pool->key, release_cache) != 0) {
+        free(pool);
+        return NULL;
+    }
+
+    pool->obj_size = obj_size;
+    pool->full     = NULL;
+    pool->empty    = NULL;
+    pool->slabs    = NULL;
+
+    pool->depot_objs = 0;
+    pool->total_objs = 0;
+    pool->next_trim  = SLAB_SIZE / obj_size * 4;
+
+    pthread_mutex_init(&pool->lock, NULL);
+
+    return pool;
+}
+
+static void free_magazines(magazine_t *mag) {
+    while (mag != NULL) {
+        magazine_t *next = mag->next;
+        free(mag);
+        mag = next;
+    }
+}
+
+void rbtree_pool_destroy(rbtree_pool_t *pool) {
+    thread_cache_t *cache = (thread_cache_t *) pthread_getspecific(pool->key);
+
+    if (cache != NULL) {
+        pthread_setspecific(pool->key, NULL);
+        free(cache->loaded);
+        free(cache->previous);
+        free(cache);
+    }
+
+    pthread_key_delete(pool->key);
+
+    free_magazines(pool->full);
+    free_magazines(pool->empty);
+
+    while (pool->slabs != NULL) {
+        slab_t *next = pool->slabs->next;
+        munmap(pool->slabs, SLAB_SIZE);
+        pool->slabs = next;
+    }
+
+    pthread_mutex_destroy(&pool->lock);
+    free(pool);
+}
+
+/* flush the calling thread's magazines, so that its free objects count,
+ * and trim.
+ */
+size_t rbtree_pool_trim(rbtree_t *tree) {
+    rbtree_pool_t *pool = (rbtree_pool_t *) tree->alloc_ctx;
+    thread_cache_t *cache;
+    size_t released;
+
+    if (tree->dealloc != pool_free) return 0;
+
+    cache = (thread_cache_t *) pthread_getspecific(pool->key);
+
+    pthread_mutex_lock(&pool->lock);
+
+    if (cache != NULL && cache->loaded->count > 0) {
+        magazine_t *mag = take_empty(pool);
+
+        if (mag != NULL) {
+            give_full(pool, cache->loaded);
+            cache->loaded = mag;
+        }
+    }
+
+    if (cache != NULL && cache->previous->count > 0) {
+        magazine_t *mag = take_empty(pool);
+
+        if (mag != NULL) {
+            give_full(pool, cache->previous);
+            cache->previous = mag;
+        }
+    }
+
+    released = trim(pool);
+    pthread_mutex_unlock(&pool->lock);
+
+    return released;
+}
+
+int rbtree_set_pool(rbtree_t *tree, rbtree_pool_t *pool) {
+    if (rbtree_node_size(tree) > pool->obj_size) return -1;
+
+    rbtree_set_allocator(tree, pool_alloc, pool_free, pool);
+
+    return 0;
+}
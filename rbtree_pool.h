@@ -0,0 +1,74 @@
+/* rbtree_pool.h, Copyright (C) 2016, Greg Johnson
+ * Released under the terms of the GNU GPL v2.0.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ */
+#ifndef RBTREE_POOL_H
+#define RBTREE_POOL_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include "rbtree.h"
+
+/* a thread-safe pool of tree nodes, for trees used by many threads.
+ *
+ * each thread keeps a couple of "magazines" (small stacks) of free
+ * nodes, so that most node allocations and frees are a pointer pop or
+ * push with no locking and no shared cache lines.  when a thread's
+ * magazines run empty or fill up, it trades whole magazines with a
+ * global depot.  nodes come from large slabs of memory.
+ *
+ * a node may be freed by a different thread than the one that allocated
+ * it; it simply joins the freeing thread's magazine.
+ *
+ * one pool can serve any number of trees, in any number of threads, as
+ * long as their nodes fit in the pool's object size.
+ *
+ * slabs whose nodes are all free can be given back to the operating
+ * system with rbtree_pool_trim().  the pool also does this by itself
+ * when the depot holds a large share of the pool's nodes, e.g. after a
+ * big tree is emptied.  this check is made only when a thread trades
+ * magazines with the depot, never on the per-thread fast path.  nodes
+ * sitting in other threads' magazines keep their slabs alive.
+ *
+ * Usage:
+ *     rbtree_pool_t *pool = rbtree_pool_create(rbtree_node_size(&tree));
+ *     rbtree_set_pool(&tree, pool);
+ *     ...
+ *     rbtree_pool_destroy(pool);
+ */
+
+typedef struct _rbtree_pool_t rbtree_pool_t;
+
+/* create a pool of objects of obj_size bytes.  return NULL on failure. */
+rbtree_pool_t *rbtree_pool_create(size_t obj_size);
+
+/* release all of the pool's memory.  no tree may still be using the
+ * pool, and no other thread may touch it again.
+ */
+void rbtree_pool_destroy(rbtree_pool_t *pool);
+
+/* allocate tree's nodes from pool.  return 0 on success, or -1 if the
+ * tree's nodes don't fit in the pool's objects.
+ */
+int rbtree_set_pool(rbtree_t *tree, rbtree_pool_t *pool);
+
+/* give slabs of tree's pool that have no nodes in use back to the
+ * operating system.  return the number of bytes given back.
+ */
+size_t rbtree_pool_trim(rbtree_t *tree);
+
+/* allocate and free pool objects directly. */
+void *rbtree_pool_alloc(rbtree_pool_t *pool);
+void  rbtree_pool_free(rbtree_pool_t *pool, void *obj);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
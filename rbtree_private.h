@@ -18,6 +18,11 @@ typedef struct _rbtree_node_t {
     struct _rbtree_node_t *parent;
     struct _rbtree_node_t *lchild, *rchild;
     char color;
+
+    /* key and value bytes of an inline tree, then the optional fields
+     * that the tree's *_offset members locate
+     */
+    void *payload[];
 } rbtree_node_t;
 
 typedef struct {
@@ -26,11 +31,40 @@ typedef struct {
 
     rbtree_malloc_t *malloc;
     rbtree_free_t *free;
+
+    rbtree_alloc_t   *alloc;
+    rbtree_dealloc_t *dealloc;
+    void             *alloc_ctx;
+
+    size_t key_size, value_size;    /* nonzero for inline trees */
+
+    rbtree_shift_t *shift;
+    rbtree_extent_t *extent;
+    size_t shift_offset;    /* of each node's pending shift; 0 if nodes have none */
+    size_t size_offset;     /* of each node's subtree size; 0 if nodes have none */
+    size_t extent_offset;   /* of each node's max extent; 0 if nodes have none */
+
+    rbtree_trace_hook_t *trace;
+    void                *trace_ctx;
+    unsigned long        iter_ids;      /* iterators made while tracing */
+
+    /* hot-key cache: cache_sets sets of two recently found nodes */
+    rbtree_hash_t *hash;
+    rbtree_node_t **cache;
+    size_t cache_sets;
+    unsigned long cache_hits, cache_misses;
+
+    /* undo log of the open transaction; see rbtree_txn_begin() */
+    unsigned char *undo;
+    size_t undo_len, undo_cap;      /* in records */
+    rbtree_node_t *undo_root;
+    char txn_open, txn_failed;
 } rbtree_t;
 
 typedef struct {
     rbtree_node_t *next_node;
     rbtree_t *tree;
+    unsigned long id;   /* tells iterators apart in a trace; 0 if untraced */
 } rbtree_iter_t;
 
 #ifdef __cplusplus
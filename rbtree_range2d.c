@@ -0,0 +1,241 @@
+/* rbtree_range2d.c, Copyright (C) 2016, Greg Johnson
+ * Released under the terms of the GNU GPL v2.0.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ */
+#include <stdlib.h>
+#include <stdint.h>
+#include "rbtree_range2d.h"
+
+/* Layered range trees (Willard, 1985; Lueker, 1978), with fractional
+ * cascading (Chazelle & Guibas, 1986).
+ *
+ * the values are numbered 0..N-1 in x order.  the primary tree is
+ * implicit:  the node for positions [lo, hi) has children [lo, mid) and
+ * [mid, hi), mid = lo + (hi - lo) / 2, down to single values.  all of
+ * the nodes at one depth cover disjoint ranges, so they share one array
+ * per level:  pos[level][lo..hi-1] is the node's values, by y.
+ *
+ * left[level][i], for i in [lo, hi), is how many of pos[level][lo..i-1]
+ * go to the left child.  so the entry at i sits at lo + left[level][i]
+ * in the left child's list, or mid + (i - lo) - left[level][i] in the
+ * right child's.  the same holds for the first entry with y >= y1, which
+ * is why a query needs just one binary search, at the root.  i == hi
+ * (no such entry) has an implicit left count of mid - lo.
+ */
+
+typedef uint32_t index_t;
+
+struct _rbtree_range2d_t {
+    size_t count;
+    int levels;
+    void **data;            /* by x */
+    long long *x;           /* by x */
+    long long *y;           /* by y, like pos[0] */
+    index_t **pos;
+    index_t **left;
+};
+
+typedef struct {
+    long long y;
+    index_t i;
+} point_t;
+
+static int point_cmp(const void *p1, const void *p2) {
+    const point_t *a = (const point_t *) p1;
+    const point_t *b = (const point_t *) p2;
+
+    if (a->y != b->y) return a->y < b->y ? -1 : 1;
+    return a->i < b->i ? -1 : a->i > b->i;
+}
+
+/* fill in level + 1 from level, for the node [lo, hi). */
+static void build(rbtree_range2d_t *index, int level, size_t lo, size_t hi) {
+    size_t mid = lo + (hi - lo) / 2;
+    size_t l = lo, r = mid, i;
+    index_t *pos  = index->pos[level];
+    index_t *left = index->left[level];
+    index_t *next = index->pos[level + 1];
+
+    if (hi - lo <= 1) {
+        if (hi - lo == 1) { next[lo] = pos[lo]; left[lo] = 0; }
+        return;
+    }
+
+    for (i = lo; i < hi; ++i) {
+        left[i] = (index_t) (l - lo);
+        if (pos[i] < mid) next[l++] = pos[i];
+        else              next[r++] = pos[i];
+    }
+
+    if (level + 2 < index->levels) {
+        build(index, level + 1, lo, mid);
+        build(index, level + 1, mid, hi);
+    }
+}
+
+rbtree_range2d_t *rbtree_range2d_build(rbtree_t *tree, rbtree_int_key_t *x, rbtree_int_key_t *y) {
+    rbtree_range2d_t *index;
+    rbtree_iter_t iter;
+    point_t *points = NULL;
+    size_t n = rbtree_size(tree), i;
+    int level;
+
+    if (n >= (index_t) -1) return NULL;
+
+    if ((index = (rbtree_range2d_t *) calloc(1, sizeof(*index))) == NULL)
+        return NULL;
+
+    index->count  = n;
+    index->levels = 1;
+    while (((size_t) 1 << (index->levels - 1)) < n) { ++index->levels; }
+
+    index->data = (void **) malloc((n + 1) * sizeof(void *));
+    index->x    = (long long *) malloc((n + 1) * sizeof(long long));
+    index->y    = (long long *) malloc((n + 1) * sizeof(long long));
+    index->pos  = (index_t **) calloc(index->levels, sizeof(index_t *));
+    index->left = (index_t **) calloc(index->levels, sizeof(index_t *));
+    points      = (point_t *) malloc((n + 1) * sizeof(point_t));
+
+    if (index->data == NULL || index->x == NULL || index->y == NULL
+        || index->pos == NULL || index->left == NULL || points == NULL)
+    {
+        goto fail;
+    }
+
+    for (level = 0; level < index->levels; ++level) {
+        index->pos[level]  = (index_t *) malloc((n + 1) * sizeof(index_t));
+        index->left[level] = (index_t *) malloc((n + 1) * sizeof(index_t));
+
+        if (index->pos[level] == NULL || index->left[level] == NULL) goto fail;
+    }
+
+    iter = rbtree_iter(tree);
+    for (i = 0; i < n; ++i) {
+        index->data[i] = rbtree_iter_next(&iter);
+        index->x[i]    = x(index->data[i]);
+        points[i].y    = y(index->data[i]);
+        points[i].i    = (index_t) i;
+    }
+
+    qsort(points, n, sizeof(point_t), point_cmp);
+
+    for (i = 0; i < n; ++i) {
+        index->y[i]      = points[i].y;
+        index->pos[0][i] = points[i].i;
+    }
+
+    free(points);
+
+    if (index->levels > 1) build(index, 0, 0, n);
+
+    return index;
+
+fail:
+    free(points);
+    rbtree_range2d_free(index);
+    return NULL;
+}
+
+typedef struct {
+    rbtree_range2d_t *index;
+    size_t a, b;            /* the x range, as positions */
+    rbtree_range2d_visit_t *visit;
+    void *ctx;
+} query_t;
+
+/* report the values of node [lo, hi) at level whose y range is
+ * pos[level][p..q-1], and whose x range is in [a, b).
+ */
+static size_t query(query_t *q, int level, size_t lo, size_t hi, size_t p, size_t e) {
+    index_t *left = q->index->left[level];
+    size_t mid, lp, le;
+
+    if (p >= e || hi <= q->a || q->b <= lo) return 0;
+
+    if (q->a <= lo && hi <= q->b) {
+        if (q->visit != NULL) {
+            index_t *pos = q->index->pos[level];
+            size_t i;
+
+            for (i = p; i < e; ++i) {
+                q->visit(q->ctx, q->index->data[pos[i]]);
+            }
+        }
+
+        return e - p;
+    }
+
+    /* a node of one value is always inside or outside [a, b) */
+    mid = lo + (hi - lo) / 2;
+    lp  = p == hi ? mid - lo : left[p];
+    le  = e == hi ? mid - lo : left[e];
+
+    return query(q, level + 1, lo, mid, lo + lp, lo + le)
+         + query(q, level + 1, mid, hi, mid + (p - lo) - lp, mid + (e - lo) - le);
+}
+
+/* return the first position in sorted[0..n-1] whose value is > key, or
+ * >= key if !after.
+ */
+static size_t search(long long *sorted, size_t n, long long key, int after) {
+    size_t lo = 0, hi = n;
+
+    while (lo < hi) {
+        size_t mid = lo + (hi - lo) / 2;
+
+        if (sorted[mid] < key || (after && sorted[mid] == key)) lo = mid + 1;
+        else                                                     hi = mid;
+    }
+
+    return lo;
+}
+
+size_t rbtree_range2d_query(rbtree_range2d_t *index, long long x1, long long x2,
+                            long long y1, long long y2,
+                            rbtree_range2d_visit_t *visit, void *ctx)
+{
+    query_t q;
+
+    if (x1 > x2 || y1 > y2) return 0;
+
+    q.index = index;
+    q.a     = search(index->x, index->count, x1, 0);
+    q.b     = search(index->x, index->count, x2, 1);
+    q.visit = visit;
+    q.ctx   = ctx;
+
+    return query(&q, 0, 0, index->count,
+                 search(index->y, index->count, y1, 0),
+                 search(index->y, index->count, y2, 1));
+}
+
+size_t rbtree_range2d_size(rbtree_range2d_t *index) {
+    return sizeof(*index)
+         + (index->count + 1) * (sizeof(void *) + 2 * sizeof(long long))
+         + index->levels * (2 * sizeof(index_t *) + 2 * (index->count + 1) * sizeof(index_t));
+}
+
+void rbtree_range2d_free(rbtree_range2d_t *index) {
+    int level;
+
+    if (index == NULL) return;
+
+    if (index->pos != NULL) {
+        for (level = 0; level < index->levels; ++level) { free(index->pos[level]); }
+    }
+
+    if (index->left != NULL) {
+        for (level = 0; level < index->levels; ++level) { free(index->left[level]); }
+    }
+
+    free(index->pos);
+    free(index->left);
+    free(index->data);
+    free(index->x);
+    free(index->y);
+    free(index);
+}
@@ -0,0 +1,65 @@
+/* rbtree_range2d.h, Copyright (C) 2016, Greg Johnson
+ * Released under the terms of the GNU GPL v2.0.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ */
+#ifndef RBTREE_RANGE2D_H
+#define RBTREE_RANGE2D_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include "rbtree.h"
+#include "rbtree_frozen.h"
+
+/* read-only 2-D range index over the values of a tree.
+ *
+ * each user data value is a point (x, y), and the tree must be ordered
+ * by x.  a query reports every value with x1 <= x <= x2 and
+ * y1 <= y <= y2 in O(log(N) + k) time for k values reported.
+ *
+ * this is a layered range tree: a balanced tree over the values in x
+ * order, where each node has its subtree's values sorted by y.  each
+ * entry of a node's list also records where it falls in its children's
+ * lists ("fractional cascading"), so a query binary-searches y only
+ * once, at the root, and follows those links down.  it takes
+ * O(N log(N)) memory, 8 bytes per value per level.
+ *
+ * like a frozen tree (rbtree_frozen.h), the index is a copy; it does
+ * not see later changes to the tree.  at most 2^32 - 1 values.
+ *
+ * Usage:
+ *     rbtree_range2d_t *index = rbtree_range2d_build(&tree, my_price, my_time);
+ *     n = rbtree_range2d_query(index, price1, price2, time1, time2, my_visit, my_ctx);
+ *     rbtree_range2d_free(index);
+ */
+
+typedef struct _rbtree_range2d_t rbtree_range2d_t;
+
+typedef void (rbtree_range2d_visit_t)(void *ctx, void *data);
+
+/* return an index of tree's values, or NULL on failure. */
+rbtree_range2d_t *rbtree_range2d_build(rbtree_t *tree, rbtree_int_key_t *x, rbtree_int_key_t *y);
+
+/* call visit(ctx, data) for each value in the (inclusive) rectangle, in
+ * no particular order, and return their number.  visit may be NULL, to
+ * just count them.
+ */
+size_t rbtree_range2d_query(rbtree_range2d_t *index, long long x1, long long x2,
+                            long long y1, long long y2,
+                            rbtree_range2d_visit_t *visit, void *ctx);
+
+/* return the number of bytes of memory used by the index. */
+size_t rbtree_range2d_size(rbtree_range2d_t *index);
+
+void rbtree_range2d_free(rbtree_range2d_t *index);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
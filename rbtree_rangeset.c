@@ -0,0 +1,118 @@
+/* rbtree_rangeset.c, Copyright (C) 2016, Greg Johnson
+ * Released under the terms of the GNU GPL v2.0.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ */
+#include "rbtree_rangeset.h"
+
+/* The runs in the tree are disjoint, and no two of them touch.  so two
+ * runs can be ordered by where they lie, and the cmp function calls any
+ * two that overlap equal:  a search for the run [x, x] finds the run
+ * that holds x, in one descent, with no floor search needed.  the
+ * neighbours of x are found the same way, as the runs holding x - 1 and
+ * x + 1.
+ *
+ * a run's bounds are changed in place, in the tree's node.  that keeps
+ * the order, as long as the run doesn't come to overlap another one; so
+ * when x joins two runs, the upper one is deleted before the lower one
+ * grows.  the undo log of a transaction doesn't see such changes, so
+ * edits are refused in one.
+ */
+
+static int range_cmp(const void *r1, const void *r2) {
+    const rbtree_range_t *a = (const rbtree_range_t *) r1;
+    const rbtree_range_t *b = (const rbtree_range_t *) r2;
+
+    if (a->hi < b->lo) return -1;
+    if (a->lo > b->hi) return 1;
+
+    return 0;
+}
+
+void rbtree_rangeset_init(rbtree_t *tree) {
+    rbtree_init_inline(tree, range_cmp, sizeof(rbtree_range_t), 0);
+}
+
+rbtree_range_t *rbtree_rangeset_find(rbtree_t *tree, int64_t x) {
+    rbtree_range_t probe;
+
+    probe.lo = probe.hi = x;
+
+    return (rbtree_range_t *) rbtree_find(tree, &probe);
+}
+
+int rbtree_rangeset_contains(rbtree_t *tree, int64_t x) {
+    return rbtree_rangeset_find(tree, x) != NULL;
+}
+
+int rbtree_rangeset_insert(rbtree_t *tree, int64_t x) {
+    rbtree_range_t *below = NULL, *above = NULL, run;
+
+    if (tree->txn_open) return -1;
+
+    if (rbtree_rangeset_find(tree, x) != NULL) return 0;
+
+    if (x > INT64_MIN) below = rbtree_rangeset_find(tree, x - 1);
+    if (x < INT64_MAX) above = rbtree_rangeset_find(tree, x + 1);
+
+    if (below != NULL && above != NULL) {
+        int64_t hi = above->hi;
+
+        /* the values of an inline tree move when one is deleted */
+        rbtree_delete(tree, above);
+        rbtree_rangeset_find(tree, x - 1)->hi = hi;
+
+    } else if (below != NULL) {
+        below->hi = x;
+
+    } else if (above != NULL) {
+        above->lo = x;
+
+    } else {
+        run.lo = run.hi = x;
+
+        if (rbtree_insert(tree, &run) == NULL) return -1;
+    }
+
+    return 1;
+}
+
+int rbtree_rangeset_delete(rbtree_t *tree, int64_t x) {
+    rbtree_range_t *found, upper;
+
+    if (tree->txn_open) return -1;
+
+    if ((found = rbtree_rangeset_find(tree, x)) == NULL) return 0;
+
+    if (found->lo == x && found->hi == x) {
+        rbtree_delete(tree, found);
+
+    } else if (found->lo == x) {
+        found->lo = x + 1;
+
+    } else if (found->hi == x) {
+        found->hi = x - 1;
+
+    } else {
+        /* split the run into [lo, x - 1] and [x + 1, hi] */
+        upper.lo  = x + 1;
+        upper.hi  = found->hi;
+        found->hi = x - 1;
+
+        if (rbtree_insert(tree, &upper) == NULL) {
+            found->hi = upper.hi;
+            return -1;
+        }
+    }
+
+    return 1;
+}
+
+void rbtree_rangeset_clear(rbtree_t *tree) {
+    while (tree->root != NULL) {
+        rbtree_delete(tree, rbtree_first(tree));
+    }
+}
@@ -0,0 +1,74 @@
+/* rbtree_rangeset.h, Copyright (C) 2016, Greg Johnson
+ * Released under the terms of the GNU GPL v2.0.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ */
+#ifndef RBTREE_RANGESET_H
+#define RBTREE_RANGESET_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stdint.h>
+#include "rbtree.h"
+
+/* a set of integers, stored as runs of consecutive integers.
+ *
+ * the tree is an inline tree (rbtree_init_inline()) whose values are the
+ * maximal runs [lo, hi] in the set, so a dense set takes a node per run
+ * and not per integer.  an insert extends the run just below or above
+ * it, or joins the two; a delete shortens its run, or splits it in two.
+ * each op takes a descent or two, and membership takes one.
+ *
+ * rbtree_iter() visits the runs in order, and rbtree_size() is the number
+ * of runs.  the tree's allocator can be set after rbtree_rangeset_init()
+ * as usual; don't insert or delete runs other than with the calls below.
+ * runs are changed in place, where a transaction's undo log can't see
+ * them, so a range set can't be changed inside a transaction
+ * (rbtree_txn_begin()).
+ *
+ * Usage:
+ *     rbtree_rangeset_init(&tree);
+ *     rbtree_rangeset_insert(&tree, id);
+ *     if (rbtree_rangeset_contains(&tree, id)) ...
+ *     rbtree_rangeset_clear(&tree);
+ */
+
+typedef struct {
+    int64_t lo, hi;
+} rbtree_range_t;
+
+/* make tree an empty range set. */
+void rbtree_rangeset_init(rbtree_t *tree);
+
+/* add x to the set.  return 1 if it was added, 0 if it was already
+ * there, or -1 if a node couldn't be allocated or a transaction is open.
+ */
+int rbtree_rangeset_insert(rbtree_t *tree, int64_t x);
+
+/* take x out of the set.  return 1 if it was removed, 0 if it wasn't
+ * there, or -1 if a node couldn't be allocated (to split a run) or a
+ * transaction is open.
+ */
+int rbtree_rangeset_delete(rbtree_t *tree, int64_t x);
+
+/* return 1 if x is in the set, else 0. */
+int rbtree_rangeset_contains(rbtree_t *tree, int64_t x);
+
+/* return the run that holds x, or NULL.  it is valid until the next
+ * insert or delete.
+ */
+rbtree_range_t *rbtree_rangeset_find(rbtree_t *tree, int64_t x);
+
+/* remove every run. */
+void rbtree_rangeset_clear(rbtree_t *tree);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,433 @@
+/* rbtree_replay.c, Copyright (C) 2016, Greg Johnson
+ * Released under the terms of the GNU GPL v2.0.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include "rbtree.h"
+#include "rbtree_trace.h"
+#include "rbtree_perf.h"
+#include "rbtree_pool.h"
+#include "rbtree_mapped.h"
+
+/* replay a trace recorded with rbtree_trace_start() against a tree, and
+ * report throughput and per-operation latency.
+ *
+ * usage:  rbtree_replay [-r repeat] [-p | -m bytes] [-i] [-c entries] trace-file
+ *
+ *     -r repeat    replay the trace this many times
+ *     -p           allocate nodes from an rbtree_pool_t
+ *     -m bytes     keep the tree in a shared memory segment of this size
+ *                  (rbtree_mapped.h); the keys stay in private memory
+ *     -i           an inline tree (rbtree_init_inline()), whose nodes hold
+ *                  the keys, each padded to the length of the longest
+ *     -c entries   a hot-key cache of this many entries
+ *
+ * the whole trace is read into memory before the clock starts.  keys are
+ * replayed as byte strings ordered by memcmp().  each traced iterator is
+ * replayed on an iterator of its own.
+ *
+ * where hardware performance counters are available, the trace is
+ * replayed once more without the per-operation clock reads, with the
+ * counters running, and counts per operation are reported.
+ */
+
+typedef struct {
+    size_t len;
+    unsigned char bytes[];
+} blob_t;
+
+typedef struct {
+    rbtree_trace_op_t op;
+    blob_t *key;
+    size_t iter;        /* iterator, numbered from 0 */
+} op_t;
+
+typedef struct {
+    const char *path;
+    int repeat;
+    int pool;
+    size_t mapped_size;
+    int inline_keys;
+    size_t cache_entries;
+} config_t;
+
+typedef struct {
+    const char *name;
+    unsigned long long count, total_ns, max_ns;
+} op_stats_t;
+
+static op_stats_t stats[] = {
+    [RBTREE_TRACE_FIND]      = {"find"},
+    [RBTREE_TRACE_INSERT]    = {"insert"},
+    [RBTREE_TRACE_DELETE]    = {"delete"},
+    [RBTREE_TRACE_FIRST]     = {"first"},
+    [RBTREE_TRACE_ITER]      = {"iter"},
+    [RBTREE_TRACE_ITER_NEXT] = {"iter_next"},
+};
+
+static int blob_cmp(blob_t *b1, blob_t *b2) {
+    size_t len = b1->len < b2->len ? b1->len : b2->len;
+    int rel    = memcmp(b1->bytes, b2->bytes, len);
+
+    if (rel != 0) return rel;
+
+    return b1->len < b2->len ? -1 : b1->len > b2->len;
+}
+
+/* FNV-1a */
+static size_t blob_hash(blob_t *b) {
+    size_t hash = 2166136261u, i;
+
+    for (i = 0; i < b->len; ++i) {
+        hash = (hash ^ b->bytes[i]) * 16777619u;
+    }
+
+    return hash;
+}
+
+static unsigned long long now_ns() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    return (unsigned long long) ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+/* the trace numbers iterators by the order they were made in the traced
+ * tree; renumber them from 0, in a table from trace ids to our numbers.
+ */
+typedef struct {
+    unsigned long *ids;
+    size_t *iters;
+    size_t space, count;
+} iter_map_t;
+
+/* return the number of the iterator with the given trace id, adding it
+ * if it is new; or (size_t) -1 if memory ran out.
+ */
+static size_t iter_number(iter_map_t *map, unsigned long id) {
+    size_t i;
+
+    if (2 * (map->count + 1) > map->space) {
+        iter_map_t bigger;
+
+        bigger.space = map->space == 0 ? 64 : 2 * map->space;
+        bigger.count = 0;
+        bigger.ids   = (unsigned long *) calloc(bigger.space, sizeof(unsigned long));
+        bigger.iters = (size_t *) malloc(bigger.space * sizeof(size_t));
+
+        if (bigger.ids == NULL || bigger.iters == NULL) {
+            free(bigger.ids);
+            free(bigger.iters);
+            return (size_t) -1;
+        }
+
+        for (i = 0; i < map->space; ++i) {
+            if (map->ids[i] != 0) {
+                size_t j = map->ids[i] & (bigger.space - 1);
+
+                while (bigger.ids[j] != 0) j = (j + 1) & (bigger.space - 1);
+
+                bigger.ids[j]   = map->ids[i];
+                bigger.iters[j] = map->iters[i];
+            }
+        }
+
+        bigger.count = map->count;
+        free(map->ids);
+        free(map->iters);
+        *map = bigger;
+    }
+
+    /* ids start at 1, so 0 marks an empty entry */
+    for (i = (id + 1) & (map->space - 1); map->ids[i] != 0; i = (i + 1) & (map->space - 1)) {
+        if (map->ids[i] == id + 1) return map->iters[i];
+    }
+
+    map->ids[i]   = id + 1;
+    map->iters[i] = map->count;
+
+    return map->count++;
+}
+
+static op_t *load_trace(const char *path, size_t *count, size_t *num_iters, size_t *max_key) {
+    rbtree_trace_reader_t *reader;
+    rbtree_trace_record_t record;
+    iter_map_t map = {NULL, NULL, 0, 0};
+    size_t space = 1024;
+    op_t *ops;
+    int rc;
+
+    if ((reader = rbtree_trace_open(path)) == NULL) {
+        fprintf(stderr, "rbtree_replay: can't open trace %s\n", path);
+        return NULL;
+    }
+
+    *count   = 0;
+    *max_key = 0;
+    ops = (op_t *) malloc(space * sizeof(op_t));
+
+    while (ops != NULL && (rc = rbtree_trace_read(reader, &record)) > 0) {
+        op_t *op;
+
+        if (*count == space) {
+            op_t *more = (op_t *) realloc(ops, (space *= 2) * sizeof(op_t));
+            if (more == NULL) { free(ops); ops = NULL; break; }
+            ops = more;
+        }
+
+        op = &ops[(*count)++];
+        op->op   = record.op;
+        op->key  = NULL;
+        op->iter = 0;
+
+        if (record.op == RBTREE_TRACE_ITER || record.op == RBTREE_TRACE_ITER_NEXT) {
+            if ((op->iter = iter_number(&map, record.iter)) == (size_t) -1) {
+                free(ops); ops = NULL; break;
+            }
+        }
+
+        if (record.key != NULL) {
+            if ((op->key = (blob_t *) malloc(sizeof(blob_t) + record.key_len)) == NULL) {
+                free(ops); ops = NULL; break;
+            }
+
+            op->key->len = record.key_len;
+            memcpy(op->key->bytes, record.key, record.key_len);
+
+            if (record.key_len > *max_key) *max_key = record.key_len;
+        }
+    }
+
+    if (ops != NULL && rc < 0) {
+        fprintf(stderr, "rbtree_replay: trace %s is damaged; replaying %zu ops\n",
+                path, *count);
+    }
+
+    *num_iters = map.count;
+
+    free(map.ids);
+    free(map.iters);
+    rbtree_trace_close(reader);
+
+    return ops;
+}
+
+/* give each key the same size, for an inline tree.  return 0, or -1 if
+ * memory ran out.
+ */
+static int pad_keys(op_t *ops, size_t count, size_t max_key) {
+    size_t i;
+
+    for (i = 0; i < count; ++i) {
+        blob_t *key;
+
+        if (ops[i].key == NULL) continue;
+
+        if ((key = (blob_t *) realloc(ops[i].key, sizeof(blob_t) + max_key)) == NULL)
+            return -1;
+
+        memset(key->bytes + key->len, 0, max_key - key->len);
+        ops[i].key = key;
+    }
+
+    return 0;
+}
+
+static void replay(rbtree_t *tree, op_t *ops, size_t count, rbtree_iter_t *iters,
+                   size_t num_iters, bool timed) {
+    size_t i;
+
+    /* an iterator made before the trace started has nothing left */
+    for (i = 0; i < num_iters; ++i) {
+        iters[i] = rbtree_iter(tree);
+        iters[i].next_node = NULL;
+    }
+
+    for (i = 0; i < count; ++i) {
+        unsigned long long start = timed ? now_ns() : 0, elapsed;
+
+        switch (ops[i].op) {
+            case RBTREE_TRACE_FIND:      rbtree_find(tree, ops[i].key);           break;
+            case RBTREE_TRACE_INSERT:    rbtree_insert(tree, ops[i].key);         break;
+            case RBTREE_TRACE_DELETE:    rbtree_delete(tree, ops[i].key);         break;
+            case RBTREE_TRACE_FIRST:     rbtree_first(tree);                      break;
+            case RBTREE_TRACE_ITER:      iters[ops[i].iter] = rbtree_iter(tree);  break;
+            case RBTREE_TRACE_ITER_NEXT: rbtree_iter_next(&iters[ops[i].iter]);   break;
+        }
+
+        if (!timed) continue;
+
+        elapsed = now_ns() - start;
+
+        stats[ops[i].op].count    += 1;
+        stats[ops[i].op].total_ns += elapsed;
+        if (elapsed > stats[ops[i].op].max_ns) stats[ops[i].op].max_ns = elapsed;
+    }
+}
+
+/* start the next repetition from an empty tree */
+static void clear(rbtree_t *tree) {
+    while (tree->root != NULL) {
+        rbtree_delete(tree, rbtree_first(tree));
+    }
+}
+
+static void report() {
+    unsigned long long count = 0, total_ns = 0;
+    int op;
+
+    printf("%-10s %12s %12s %10s %10s\n", "op", "count", "total ms", "avg ns", "max ns");
+
+    for (op = 0; op < sizeof(stats) / sizeof(stats[0]); ++op) {
+        if (stats[op].count == 0) continue;
+
+        printf("%-10s %12llu %12.3f %10.1f %10llu\n", stats[op].name, stats[op].count,
+               stats[op].total_ns / 1e6, (double) stats[op].total_ns / stats[op].count,
+               stats[op].max_ns);
+
+        count    += stats[op].count;
+        total_ns += stats[op].total_ns;
+    }
+
+    printf("%llu ops in %.3f ms; %.0f ops/sec\n", count, total_ns / 1e6,
+           total_ns == 0 ? 0.0 : count / (total_ns / 1e9));
+}
+
+static int usage() {
+    fprintf(stderr, "usage: rbtree_replay [-r repeat] [-p | -m bytes] [-i] [-c entries]"
+                    " trace-file\n");
+    return 2;
+}
+
+static int parse_args(int argc, char **argv, config_t *config) {
+    int i;
+
+    memset(config, 0, sizeof(*config));
+    config->repeat = 1;
+
+    for (i = 1; i < argc - 1 && argv[i][0] == '-'; ++i) {
+        if (strcmp(argv[i], "-r") == 0 && i + 1 < argc - 1) {
+            config->repeat = atoi(argv[++i]);
+
+        } else if (strcmp(argv[i], "-p") == 0) {
+            config->pool = 1;
+
+        } else if (strcmp(argv[i], "-m") == 0 && i + 1 < argc - 1) {
+            config->mapped_size = (size_t) strtoull(argv[++i], NULL, 0);
+
+        } else if (strcmp(argv[i], "-i") == 0) {
+            config->inline_keys = 1;
+
+        } else if (strcmp(argv[i], "-c") == 0 && i + 1 < argc - 1) {
+            config->cache_entries = (size_t) strtoull(argv[++i], NULL, 0);
+
+        } else {
+            break;
+        }
+    }
+
+    if (i != argc - 1) return -1;
+
+    /* a mapped tree allocates from its segment, and isn't inline */
+    if (config->mapped_size > 0 && (config->pool || config->inline_keys)) return -1;
+
+    config->path = argv[i];
+
+    return 0;
+}
+
+int main(int argc, char **argv) {
+    rbtree_mapped_t *mapped = NULL;
+    rbtree_pool_t *pool = NULL;
+    rbtree_iter_t *iters;
+    char mapped_name[64];
+    size_t count, num_iters, max_key;
+    rbtree_perf_t perf;
+    rbtree_t local, *tree = &local;
+    config_t config;
+    op_t *ops;
+    int i;
+
+    if (parse_args(argc, argv, &config) != 0) return usage();
+
+    if ((ops = load_trace(config.path, &count, &num_iters, &max_key)) == NULL)
+        return 1;
+
+    if ((iters = (rbtree_iter_t *) malloc((num_iters + 1) * sizeof(rbtree_iter_t))) == NULL
+        || (config.inline_keys && pad_keys(ops, count, max_key) != 0))
+    {
+        fprintf(stderr, "rbtree_replay: out of memory\n");
+        return 1;
+    }
+
+    if (config.mapped_size > 0) {
+        snprintf(mapped_name, sizeof(mapped_name), "/rbtree_replay.%d", (int) getpid());
+
+        if ((mapped = rbtree_mapped_create(mapped_name, config.mapped_size,
+                                           (rbtree_cmp_t *) blob_cmp)) == NULL) {
+            fprintf(stderr, "rbtree_replay: can't create segment %s\n", mapped_name);
+            return 1;
+        }
+
+        /* nobody else uses the segment, so keep it locked throughout */
+        tree = rbtree_mapped_lock(mapped);
+
+    } else if (config.inline_keys) {
+        rbtree_init_inline(tree, (rbtree_cmp_t *) blob_cmp, sizeof(blob_t) + max_key, 0);
+
+    } else {
+        rbtree_init(tree, (rbtree_cmp_t *) blob_cmp);
+    }
+
+    if (config.pool
+        && ((pool = rbtree_pool_create(rbtree_node_size(tree))) == NULL
+            || rbtree_set_pool(tree, pool) != 0))
+    {
+        fprintf(stderr, "rbtree_replay: can't create node pool\n");
+        return 1;
+    }
+
+    if (config.cache_entries > 0
+        && rbtree_set_cache(tree, (rbtree_hash_t *) blob_hash, config.cache_entries) != 0)
+    {
+        fprintf(stderr, "rbtree_replay: can't create cache\n");
+        return 1;
+    }
+
+    for (i = 0; i < config.repeat; ++i) {
+        replay(tree, ops, count, iters, num_iters, true);
+        clear(tree);
+    }
+
+    report();
+
+    if (rbtree_perf_open(&perf) > 0) {
+        rbtree_perf_start(&perf);
+        replay(tree, ops, count, iters, num_iters, false);
+        rbtree_perf_stop(&perf);
+        clear(tree);
+    }
+
+    rbtree_perf_report(&perf, stdout, count);
+    rbtree_perf_close(&perf);
+
+    rbtree_set_cache(tree, NULL, 0);
+
+    if (mapped != NULL) {
+        rbtree_mapped_unlock(mapped);
+        rbtree_mapped_close(mapped);
+        rbtree_mapped_unlink(mapped_name);
+    }
+
+    if (pool != NULL) rbtree_pool_destroy(pool);
+
+    return 0;
+}
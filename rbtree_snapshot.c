@@ -0,0 +1,345 @@
+/* rbtree_snapshot.c, Copyright (C) 2016, Greg Johnson
+ * Released under the terms of the GNU GPL v2.0.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ */
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <stdio.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <pthread.h>
+#include "rbtree_snapshot.h"
+
+/* The file is a header, an index of chunks, and the chunks:
+ *
+ *     "rbtsnap1"  count  chunks
+ *     offset records bytes        (per chunk)
+ *     len data  len data ...      (per chunk, len a uint32_t)
+ *
+ * all numbers but len are uint64_t.  the chunks follow one another, so
+ * a thread's run of chunks is one range of the file.
+ *
+ * a thread builds each chunk into a tree of its own and joins it onto
+ * the end of its part; since a chunk is read into one buffer and built
+ * before the next is read, an inline tree's make can hand back pointers
+ * into the buffer.  the caller's thread then joins the parts in order.
+ * rbtree_join() takes O(log(N)) time, so the stitching is cheap next to
+ * the building.
+ */
+
+#define MAGIC                "rbtsnap1"
+#define DEFAULT_CHUNK_VALUES 65536
+
+typedef struct {
+    char magic[8];
+    uint64_t count;
+    uint64_t chunks;
+} header_t;
+
+typedef struct {
+    uint64_t offset;
+    uint64_t records;
+    uint64_t bytes;
+} chunk_t;
+
+int rbtree_snapshot_save(rbtree_t *tree, const char *path, rbtree_snapshot_bytes_t *bytes,
+                         size_t chunk_values) {
+    header_t header;
+    chunk_t *chunks;
+    rbtree_iter_t iter;
+    void *data;
+    uint64_t offset;
+    size_t i = 0;
+    FILE *f;
+    int result = 0;
+
+    if (chunk_values == 0) chunk_values = DEFAULT_CHUNK_VALUES;
+
+    memcpy(header.magic, MAGIC, sizeof(header.magic));
+    header.count  = rbtree_size(tree);
+    header.chunks = (header.count + chunk_values - 1) / chunk_values;
+
+    if ((chunks = (chunk_t *) calloc(header.chunks + 1, sizeof(chunk_t))) == NULL)
+        return -1;
+
+    if ((f = fopen(path, "wb")) == NULL) {
+        free(chunks);
+        return -1;
+    }
+
+    /* the index is written again once the chunks' sizes are known */
+    offset = sizeof(header) + header.chunks * sizeof(chunk_t);
+
+    if (fwrite(&header, sizeof(header), 1, f) != 1
+        || fwrite(chunks, sizeof(chunk_t), header.chunks, f) != header.chunks)
+    {
+        result = -1;
+    }
+
+    iter = rbtree_iter(tree);
+    while (result == 0 && (data = rbtree_iter_next(&iter)) != NULL) {
+        chunk_t *chunk = &chunks[i / chunk_values];
+        const void *buf;
+        size_t len = bytes(data, &buf);
+        uint32_t len32 = (uint32_t) len;
+
+        if (i % chunk_values == 0) chunk->offset = offset;
+
+        if (len != len32
+            || fwrite(&len32, sizeof(len32), 1, f) != 1
+            || (len > 0 && fwrite(buf, len, 1, f) != 1))
+        {
+            result = -1;
+        }
+
+        ++chunk->records;
+        chunk->bytes += sizeof(len32) + len;
+        offset       += sizeof(len32) + len;
+        ++i;
+    }
+
+    if (result == 0
+        && (fseek(f, sizeof(header), SEEK_SET) != 0
+            || fwrite(chunks, sizeof(chunk_t), header.chunks, f) != header.chunks))
+    {
+        result = -1;
+    }
+
+    if (fclose(f) != 0) result = -1;
+    free(chunks);
+
+    if (result != 0) remove(path);
+
+    return result;
+}
+
+typedef struct {
+    int fd;
+    chunk_t *chunks;
+    rbtree_snapshot_make_t *make;
+    rbtree_snapshot_release_t *release;
+    void *ctx;
+} loader_t;
+
+typedef struct {
+    loader_t *loader;
+    size_t first, last;     /* the chunks [first, last) */
+    rbtree_t tree;
+    int result;
+
+    pthread_t thread;
+    int threaded;           /* if thread is loading the part */
+} part_t;
+
+/* empty the tree, releasing its values. */
+static void discard(loader_t *loader, rbtree_t *tree) {
+    while (tree->root != NULL) {
+        void *data = rbtree_delete(tree, rbtree_first(tree));
+
+        if (loader->release != NULL) loader->release(loader->ctx, data);
+    }
+}
+
+/* read len bytes at offset, across short reads. */
+static int read_at(int fd, char *buf, size_t len, uint64_t offset) {
+    while (len > 0) {
+        ssize_t got = pread(fd, buf, len, (off_t) offset);
+
+        if (got <= 0) return -1;
+
+        buf    += got;
+        len    -= got;
+        offset += got;
+    }
+
+    return 0;
+}
+
+/* make the values of chunk in buf, and build them into the empty tree. */
+static int load_chunk(loader_t *loader, chunk_t *chunk, char *buf, void **values,
+                      rbtree_t *tree) {
+    char *p = buf, *end = buf + chunk->bytes;
+    size_t i, n = chunk->records;
+
+    for (i = 0; i < n; ++i) {
+        uint32_t len;
+
+        if ((size_t) (end - p) < sizeof(len)) break;
+        memcpy(&len, p, sizeof(len));
+        p += sizeof(len);
+
+        if ((size_t) (end - p) < len) break;
+        if ((values[i] = loader->make(loader->ctx, p, len)) == NULL) break;
+        p += len;
+    }
+
+    if (i == n && p == end && rbtree_build(tree, values, n) == 0) return 0;
+
+    if (loader->release != NULL) {
+        while (i > 0) loader->release(loader->ctx, values[--i]);
+    }
+
+    return -1;
+}
+
+static void load_part(part_t *part) {
+    loader_t *loader = part->loader;
+    rbtree_t chunk_tree = part->tree;
+    size_t max_bytes = 0, max_records = 0, c;
+    char *buf;
+    void **values;
+
+    for (c = part->first; c < part->last; ++c) {
+        if (loader->chunks[c].bytes   > max_bytes)   max_bytes   = loader->chunks[c].bytes;
+        if (loader->chunks[c].records > max_records) max_records = loader->chunks[c].records;
+    }
+
+    buf    = (char *) malloc(max_bytes + 1);
+    values = (void **) malloc((max_records + 1) * sizeof(void *));
+
+    part->result = buf != NULL && values != NULL ? 0 : -1;
+
+    for (c = part->first; part->result == 0 && c < part->last; ++c) {
+        chunk_t *chunk = &loader->chunks[c];
+
+        if (read_at(loader->fd, buf, chunk->bytes, chunk->offset) != 0
+            || load_chunk(loader, chunk, buf, values, &chunk_tree) != 0)
+        {
+            part->result = -1;
+        } else {
+            rbtree_join(&part->tree, &chunk_tree);
+        }
+    }
+
+    free(buf);
+    free(values);
+}
+
+static void *load_thread(void *arg) {
+    load_part((part_t *) arg);
+
+    return NULL;
+}
+
+/* read and check the header and index; return the index, or NULL. */
+static chunk_t *read_index(int fd, header_t *header) {
+    chunk_t *chunks;
+    uint64_t offset, count = 0, c;
+
+    if (read_at(fd, (char *) header, sizeof(*header), 0) != 0
+        || memcmp(header->magic, MAGIC, sizeof(header->magic)) != 0
+        || header->chunks > SIZE_MAX / sizeof(chunk_t) - 1)
+    {
+        return NULL;
+    }
+
+    if ((chunks = (chunk_t *) malloc((header->chunks + 1) * sizeof(chunk_t))) == NULL)
+        return NULL;
+
+    if (read_at(fd, (char *) chunks, header->chunks * sizeof(chunk_t), sizeof(*header)) != 0) {
+        free(chunks);
+        return NULL;
+    }
+
+    offset = sizeof(*header) + header->chunks * sizeof(chunk_t);
+
+    for (c = 0; c < header->chunks; ++c) {
+        if (chunks[c].offset != offset || chunks[c].records > chunks[c].bytes
+            || chunks[c].bytes > SIZE_MAX / 2)
+        {
+            break;
+        }
+
+        offset += chunks[c].bytes;
+        count  += chunks[c].records;
+    }
+
+    if (c < header->chunks || count != header->count) {
+        free(chunks);
+        return NULL;
+    }
+
+    return chunks;
+}
+
+int rbtree_snapshot_load(rbtree_t *tree, const char *path, rbtree_snapshot_make_t *make,
+                         rbtree_snapshot_release_t *release, void *ctx, int nthreads) {
+    loader_t loader;
+    header_t header;
+    part_t *parts;
+    int nparts, i, result;
+
+    /* the parts are copies of tree, which the undo log can't follow */
+    if (tree->root != NULL || tree->txn_open) return -1;
+
+    if ((loader.fd = open(path, O_RDONLY)) < 0) return -1;
+
+    if ((loader.chunks = read_index(loader.fd, &header)) == NULL) {
+        close(loader.fd);
+        return -1;
+    }
+
+    loader.make    = make;
+    loader.release = release;
+    loader.ctx     = ctx;
+
+    nparts = nthreads < 1 ? 1 : nthreads;
+    if ((uint64_t) nparts > header.chunks) nparts = header.chunks > 0 ? (int) header.chunks : 1;
+
+    if ((parts = (part_t *) malloc(nparts * sizeof(part_t))) == NULL) {
+        free(loader.chunks);
+        close(loader.fd);
+        return -1;
+    }
+
+    for (i = 0; i < nparts; ++i) {
+        parts[i].loader   = &loader;
+        parts[i].first    = (size_t) (header.chunks * i / nparts);
+        parts[i].last     = (size_t) (header.chunks * (i + 1) / nparts);
+        parts[i].tree     = *tree;
+        parts[i].threaded = 0;
+
+        /* not to be used from several threads */
+        rbtree_set_trace(&parts[i].tree, NULL, NULL);
+        parts[i].tree.cache = NULL;
+    }
+
+    /* the caller's thread loads the first part, and any part that a
+     * thread couldn't be started for
+     */
+    for (i = 1; i < nparts; ++i) {
+        parts[i].threaded = pthread_create(&parts[i].thread, NULL, load_thread, &parts[i]) == 0;
+    }
+
+    for (i = 0; i < nparts; ++i) {
+        if (i == 0 || !parts[i].threaded) load_part(&parts[i]);
+    }
+
+    for (i = 1; i < nparts; ++i) {
+        if (parts[i].threaded) pthread_join(parts[i].thread, NULL);
+    }
+
+    /* a failed part still holds the chunks it loaded, to be discarded */
+    result = parts[0].result;
+
+    for (i = 1; i < nparts; ++i) {
+        if (parts[i].result != 0) result = -1;
+        rbtree_join(&parts[0].tree, &parts[i].tree);
+    }
+
+    if (result != 0) discard(&loader, &parts[0].tree);
+
+    tree->root = parts[0].tree.root;
+    rbtree_cache_clear(tree);
+
+    free(parts);
+    free(loader.chunks);
+    close(loader.fd);
+
+    return result;
+}
@@ -0,0 +1,73 @@
+/* rbtree_snapshot.h, Copyright (C) 2016, Greg Johnson
+ * Released under the terms of the GNU GPL v2.0.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ */
+#ifndef RBTREE_SNAPSHOT_H
+#define RBTREE_SNAPSHOT_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include "rbtree.h"
+
+/* save a tree's values to a file, and load them back into a tree using
+ * several threads.
+ *
+ * a snapshot holds the values in order, each as a byte string, in chunks
+ * of a fixed number of values, with an index of where each chunk starts.
+ * to load it, each thread reads its own run of chunks with pread(),
+ * turns the bytes back into values, and builds them into a balanced
+ * tree of its own (rbtree_build()); the trees are then joined end to end
+ * (rbtree_join()).  so a load takes O(N / nthreads + nthreads log(N))
+ * time, with no comparisons or rebalancing.
+ *
+ * the file is in the machine's own byte order.  with nthreads > 1, the
+ * tree's allocator and the make function are called from several threads
+ * at once, so they must be thread-safe (malloc, or an rbtree_pool_t).
+ *
+ * Usage:
+ *     rbtree_snapshot_save(&tree, "index.snap", my_bytes, 0);
+ *     ...
+ *     rbtree_init(&tree, my_cmp);
+ *     rbtree_snapshot_load(&tree, "index.snap", my_make, my_release, ctx, 8);
+ */
+
+/* set *bytes to the bytes that represent data, and return how many. */
+typedef size_t (rbtree_snapshot_bytes_t)(const void *data, const void **bytes);
+
+/* return a value made from the bytes, or NULL on failure.  the bytes
+ * stay valid until the value is in the tree.  for an inline tree
+ * (rbtree_init_inline()), whose nodes copy their key and value, this can
+ * return bytes itself, with no release function.
+ */
+typedef void *(rbtree_snapshot_make_t)(void *ctx, const void *bytes, size_t len);
+
+/* give back a value that make returned. */
+typedef void (rbtree_snapshot_release_t)(void *ctx, void *data);
+
+/* write tree's values to path, chunk_values to a chunk (0 for a
+ * default).  return 0, or -1 on failure.
+ */
+int rbtree_snapshot_save(rbtree_t *tree, const char *path, rbtree_snapshot_bytes_t *bytes,
+                         size_t chunk_values);
+
+/* fill tree, which must be empty and not in a transaction, with the
+ * values of the snapshot at path, using up to nthreads threads
+ * (including the caller).  return 0, or -1 if the tree can't be filled,
+ * the file can't be read or isn't a snapshot, or make or the allocator
+ * fails; the tree is then left empty, and each value made is passed to
+ * release, if that isn't NULL.
+ */
+int rbtree_snapshot_load(rbtree_t *tree, const char *path, rbtree_snapshot_make_t *make,
+                         rbtree_snapshot_release_t *release, void *ctx, int nthreads);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,301 @@
+/* rbtree_sync.c, Copyright (C) 2016, Greg Johnson
+ * Released under the terms of the GNU GPL v2.0.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ */
+#include <stdlib.h>
+#include <stdbool.h>
+#include <stdatomic.h>
+#include <pthread.h>
+#include <sched.h>
+#include "rbtree_sync.h"
+#include "rbtree_batch.h"
+
+/* Flat combining.
+ *
+ * Each thread claims a slot (its own cache line) on first use.  To do
+ * an operation it fills in its slot and marks it POSTED, then tries to
+ * take the combiner lock.  The thread that gets the lock scans the slots,
+ * sorts the posted operations by key, applies them, and marks each slot
+ * DONE.  The finds go to rbtree_find_sorted_batch(), where each search
+ * starts from where the last one ended, and then the inserts and deletes
+ * go to rbtree_apply_batch() as one sorted batch.  (Posted operations
+ * are concurrent, so they may take effect in any order.)  A batch insert
+ * of a key that is already there, or an op the batch couldn't allocate
+ * for, is redone with rbtree_insert() or rbtree_delete(), for the same
+ * result as from the other front ends.
+ * It rescans a few times, since threads that lost the race for the lock
+ * are likely to post again right away.  A thread that doesn't get the
+ * lock spins on its own slot until it is DONE, or the lock comes free.
+ *
+ * A thread beyond the first MAX_SLOTS just takes the lock and does its
+ * own operation.
+ */
+
+#define MAX_SLOTS      64
+#define CACHE_LINE     64
+#define COMBINE_PASSES 3
+#define SPIN           128
+
+typedef enum { OP_FIND, OP_INSERT, OP_DELETE } op_t;
+
+enum { IDLE, POSTED, DONE };
+
+typedef struct {
+    atomic_bool owned;
+    atomic_int state;
+    op_t op;
+    void *data;
+    void *result;
+} __attribute__((aligned(CACHE_LINE))) slot_t;
+
+struct _rbtree_sync_t {
+    rbtree_t *tree;
+    rbtree_sync_kind_t kind;
+
+    pthread_mutex_t lock;
+    pthread_rwlock_t rwlock;
+
+    /* flat combining */
+    pthread_key_t key;
+    slot_t *slots;
+    atomic_int num_slots;   /* high-water mark of claimed slots */
+};
+
+static void *apply(rbtree_t *tree, op_t op, void *data) {
+    switch (op) {
+        case OP_FIND:   return rbtree_find(tree, data);
+        case OP_INSERT: return rbtree_insert(tree, data);
+        case OP_DELETE: return rbtree_delete(tree, data);
+    }
+
+    return NULL;
+}
+
+/* a thread is exiting; give up its slot. */
+static void release_slot(void *ptr) {
+    atomic_store(&((slot_t *) ptr)->owned, false);
+}
+
+/* the calling thread's slot, claimed on first use; NULL if none is free. */
+static slot_t *get_slot(rbtree_sync_t *sync) {
+    slot_t *slot = (slot_t *) pthread_getspecific(sync->key);
+    int i, high;
+
+    if (slot != NULL) return slot;
+
+    for (i = 0; i < MAX_SLOTS; ++i) {
+        bool owned = false;
+
+        if (atomic_compare_exchange_strong(&sync->slots[i].owned, &owned, true))
+            break;
+    }
+
+    if (i == MAX_SLOTS) return NULL;
+
+    slot = &sync->slots[i];
+
+    if (pthread_setspecific(sync->key, slot) != 0) {
+        atomic_store(&slot->owned, false);
+        return NULL;
+    }
+
+    high = atomic_load(&sync->num_slots);
+    while (high < i + 1 && !atomic_compare_exchange_weak(&sync->num_slots, &high, i + 1))
+        ;
+
+    return slot;
+}
+
+/* apply the n posted operations, sorted by key. */
+static void apply_sorted(rbtree_t *tree, slot_t **posted, int n) {
+    void *keys[MAX_SLOTS], *found[MAX_SLOTS];
+    rbtree_batch_t ops[MAX_SLOTS];
+    slot_t *writes[MAX_SLOTS];
+    int i, nfinds = 0, nwrites = 0;
+
+    for (i = 0; i < n; ++i) {
+        if (posted[i]->op == OP_FIND) {
+            keys[nfinds++] = posted[i]->data;
+
+        } else {
+            ops[nwrites].op     = posted[i]->op == OP_INSERT ? RBTREE_BATCH_INSERT
+                                                             : RBTREE_BATCH_DELETE;
+            ops[nwrites].data = posted[i]->data;
+            writes[nwrites++] = posted[i];
+        }
+    }
+
+    if (nfinds > 0) rbtree_find_sorted_batch(tree, keys, nfinds, found);
+    if (nwrites > 0) rbtree_apply_batch(tree, ops, nwrites, 1);
+
+    for (i = nfinds = 0; i < n; ++i) {
+        if (posted[i]->op == OP_FIND) posted[i]->result = found[nfinds++];
+    }
+
+    for (i = 0; i < nwrites; ++i) {
+        if (ops[i].result == RBTREE_BATCH_EXISTED || ops[i].result == RBTREE_BATCH_FAILED)
+            writes[i]->result = apply(tree, writes[i]->op, writes[i]->data);
+        else
+            writes[i]->result = ops[i].value;
+    }
+}
+
+/* apply every posted operation.  combiner lock must be held. */
+static void combine(rbtree_sync_t *sync) {
+    rbtree_cmp_t *cmp = sync->tree->cmp;
+    slot_t *posted[MAX_SLOTS];
+    int pass, num_slots, n, i, j;
+
+    for (pass = 0; pass < COMBINE_PASSES; ++pass) {
+        num_slots = atomic_load(&sync->num_slots);
+
+        for (i = n = 0; i < num_slots; ++i) {
+            slot_t *slot = &sync->slots[i];
+
+            if (atomic_load_explicit(&slot->state, memory_order_acquire) != POSTED)
+                continue;
+
+            /* insertion sort by key */
+            for (j = n++; j > 0 && cmp(slot->data, posted[j - 1]->data) < 0; --j)
+                posted[j] = posted[j - 1];
+
+            posted[j] = slot;
+        }
+
+        if (n == 0) break;
+
+        apply_sorted(sync->tree, posted, n);
+
+        for (i = 0; i < n; ++i) {
+            atomic_store_explicit(&posted[i]->state, DONE, memory_order_release);
+        }
+    }
+}
+
+static void *combining(rbtree_sync_t *sync, op_t op, void *data) {
+    slot_t *slot = get_slot(sync);
+    void *result;
+    int spin;
+
+    if (slot == NULL) {
+        pthread_mutex_lock(&sync->lock);
+        result = apply(sync->tree, op, data);
+        pthread_mutex_unlock(&sync->lock);
+
+        return result;
+    }
+
+    slot->op   = op;
+    slot->data = data;
+    atomic_store_explicit(&slot->state, POSTED, memory_order_release);
+
+    while (atomic_load_explicit(&slot->state, memory_order_acquire) == POSTED) {
+        if (pthread_mutex_trylock(&sync->lock) == 0) {
+            combine(sync);
+            pthread_mutex_unlock(&sync->lock);
+            continue;
+        }
+
+        for (spin = 0; spin < SPIN; ++spin) {
+            if (atomic_load_explicit(&slot->state, memory_order_acquire) != POSTED)
+                break;
+        }
+
+        if (spin == SPIN) sched_yield();
+    }
+
+    result = slot->result;
+    atomic_store_explicit(&slot->state, IDLE, memory_order_relaxed);
+
+    return result;
+}
+
+static void *locked(rbtree_sync_t *sync, op_t op, void *data) {
+    void *result;
+
+    if (sync->kind == RBTREE_SYNC_MUTEX) {
+        pthread_mutex_lock(&sync->lock);
+        result = apply(sync->tree, op, data);
+        pthread_mutex_unlock(&sync->lock);
+
+    } else {
+        if (op == OP_FIND) pthread_rwlock_rdlock(&sync->rwlock);
+        else               pthread_rwlock_wrlock(&sync->rwlock);
+
+        result = apply(sync->tree, op, data);
+        pthread_rwlock_unlock(&sync->rwlock);
+    }
+
+    return result;
+}
+
+static void *sync_op(rbtree_sync_t *sync, op_t op, void *data) {
+    return   sync->kind == RBTREE_SYNC_COMBINING
+           ? combining(sync, op, data)
+           : locked(sync, op, data);
+}
+
+rbtree_sync_t *rbtree_sync_create(rbtree_t *tree, rbtree_sync_kind_t kind) {
+    rbtree_sync_t *sync = (rbtree_sync_t *) malloc(sizeof(rbtree_sync_t));
+    int i;
+
+    if (sync == NULL) return NULL;
+
+    sync->tree  = tree;
+    sync->kind  = kind;
+    sync->slots = NULL;
+    atomic_init(&sync->num_slots, 0);
+
+    if (kind == RBTREE_SYNC_COMBINING) {
+        if (posix_memalign((void **) &sync->slots, CACHE_LINE,
+                           MAX_SLOTS * sizeof(slot_t)) != 0) {
+            free(sync);
+            return NULL;
+        }
+
+        if (pthread_key_create(&sync->key, release_slot) != 0) {
+            free(sync->slots);
+            free(sync);
+            return NULL;
+        }
+
+        for (i = 0; i < MAX_SLOTS; ++i) {
+            atomic_init(&sync->slots[i].owned, false);
+            atomic_init(&sync->slots[i].state, IDLE);
+        }
+    }
+
+    pthread_mutex_init(&sync->lock, NULL);
+    pthread_rwlock_init(&sync->rwlock, NULL);
+
+    return sync;
+}
+
+void rbtree_sync_destroy(rbtree_sync_t *sync) {
+    if (sync == NULL) return;
+
+    if (sync->kind == RBTREE_SYNC_COMBINING) {
+        pthread_key_delete(sync->key);
+        free(sync->slots);
+    }
+
+    pthread_mutex_destroy(&sync->lock);
+    pthread_rwlock_destroy(&sync->rwlock);
+    free(sync);
+}
+
+void *rbtree_sync_find(rbtree_sync_t *sync, void *data) {
+    return sync_op(sync, OP_FIND, data);
+}
+
+void *rbtree_sync_insert(rbtree_sync_t *sync, void *data) {
+    return sync_op(sync, OP_INSERT, data);
+}
+
+void *rbtree_sync_delete(rbtree_sync_t *sync, void *data) {
+    return sync_op(sync, OP_DELETE, data);
+}
@@ -0,0 +1,74 @@
+/* rbtree_sync.h, Copyright (C) 2016, Greg Johnson
+ * Released under the terms of the GNU GPL v2.0.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ */
+#ifndef RBTREE_SYNC_H
+#define RBTREE_SYNC_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include "rbtree.h"
+
+/* thread-safe front ends for a tree shared by many threads.
+ *
+ * RBTREE_SYNC_MUTEX:      every operation takes a mutex.
+ *
+ * RBTREE_SYNC_RWLOCK:     finds share a read lock; inserts and deletes
+ *                         take it exclusively.  the tree must not use
+ *                         lazy key shifting, tracing or a hot-key cache,
+ *                         since those write to the tree (or the trace)
+ *                         during a find.
+ *
+ * RBTREE_SYNC_COMBINING:  flat combining (Hendler, Incze, Shavit &
+ *                         Tzafrir, 2010).  each thread posts its
+ *                         operation in a slot of its own, and whichever
+ *                         thread gets the lock applies all posted
+ *                         operations, sorted by key, and posts their
+ *                         results.  the tree's nodes stay in the
+ *                         combiner's cache instead of moving from core
+ *                         to core with each operation, so this does well
+ *                         when many threads write at once.  the sorted
+ *                         finds go to rbtree_find_sorted_batch(), and
+ *                         the writes to rbtree_apply_batch(), so the
+ *                         trace hook doesn't see most writes.
+ *
+ * the tree's allocator is only ever called by one thread at a time.
+ * all access to the tree must go through the front end.
+ *
+ * Usage:
+ *     rbtree_sync_t *sync = rbtree_sync_create(&tree, RBTREE_SYNC_COMBINING);
+ *     rbtree_sync_insert(sync, &my_data);     // from any thread
+ *     ...
+ *     rbtree_sync_destroy(sync);
+ */
+
+typedef enum {
+    RBTREE_SYNC_MUTEX,
+    RBTREE_SYNC_RWLOCK,
+    RBTREE_SYNC_COMBINING
+} rbtree_sync_kind_t;
+
+typedef struct _rbtree_sync_t rbtree_sync_t;
+
+/* return a front end of the given kind for tree, or NULL on failure. */
+rbtree_sync_t *rbtree_sync_create(rbtree_t *tree, rbtree_sync_kind_t kind);
+
+/* free the front end (not the tree).  no thread may be using it. */
+void rbtree_sync_destroy(rbtree_sync_t *sync);
+
+/* as rbtree_find(), rbtree_insert() and rbtree_delete(). */
+void *rbtree_sync_find(rbtree_sync_t *sync, void *data);
+void *rbtree_sync_insert(rbtree_sync_t *sync, void *data);
+void *rbtree_sync_delete(rbtree_sync_t *sync, void *data);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -7,7 +7,26 @@
  * GNU General Public License for more details.
  */
 #include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <sys/wait.h>
 #include "rbtree.h"
+#include "rbtree_mapped.h"
+#include "rbtree_frozen.h"
+#include "rbtree_range2d.h"
+#include "rbtree_trace.h"
+#include "rbtree_perf.h"
+#include "rbtree_workload.h"
+#include "rbtree_pool.h"
+#include "rbtree_batch.h"
+#include "rbtree_sync.h"
+#include "rbtree_lr.h"
+#include "rbtree_lsm.h"
+#include "rbtree_key.h"
+#include "rbtree_snapshot.h"
+#include "rbtree_rangeset.h"
 
 typedef unsigned char byte;
 
@@ -113,10 +132,1735 @@ static void test_mallocAndFreeUserData() {
     }
 }
 
+static int int_cmp(int *i1, int *i2) {
+    return *i1 < *i2 ? -1 : *i1 > *i2;
+}
+
+static void int_shift(int *i, long delta) {
+    *i += delta;
+}
+
+static void test_ShiftKeys() {
+    int data[] = {50,10,40,20,30,60,90,70,80};
+    int sortedData[] = {10,20,30,45,50,70,80,90,100};
+    int search, *found;
+    rbtree_t tree;
+    rbtree_iter_t iter;
+    int i;
+
+    rbtree_init(&tree, (rbtree_cmp_t *) int_cmp);
+
+    /* the pending shifts need room in the nodes */
+    rbtree_insert(&tree, &data[0]);
+    test_result(rbtree_set_shift(&tree, (rbtree_shift_t *) int_shift) == -1, "shift set too late");
+    rbtree_delete(&tree, &data[0]);
+    test_result(rbtree_set_shift(&tree, (rbtree_shift_t *) int_shift) == 0
+                && rbtree_node_size(&tree) == sizeof(rbtree_node_t) + sizeof(long), "shift set");
+
+    for (i = 0; i < sizeof(data) / sizeof(data[0]); ++i) {
+        rbtree_insert(&tree, &data[i]);
+    }
+
+    search = 40;
+    rbtree_shift_keys(&tree, &search, 5);
+
+    search = 40;
+    test_result(rbtree_find(&tree, &search) == NULL, "shift find old key");
+    search = 45;
+    found = rbtree_find(&tree, &search);
+    test_result(found != NULL && *found == 45, "shift find new key");
+
+    search = 60;
+    rbtree_shift_keys(&tree, &search, 10);
+    search = 50;
+    rbtree_shift_keys(&tree, &search, -5);
+
+    iter = rbtree_iter(&tree);
+    for (i = 0; i < sizeof(sortedData) / sizeof(sortedData[0]); ++i) {
+        found = rbtree_iter_next(&iter);
+        test_result(found != NULL && *found == sortedData[i], "shift in order");
+    }
+
+    for (i = 0; i < sizeof(sortedData) / sizeof(sortedData[0]); ++i) {
+        found = rbtree_delete(&tree, &sortedData[i]);
+        test_result(found != NULL && *found == sortedData[i], "shift delete");
+    }
+    test_result(tree.root == NULL, "shift empty");
+}
+
+/* return true if every node's size is the size of its subtree */
+static bool sizesOk(rbtree_t *tree, rbtree_node_t *subtree) {
+    if (subtree == NULL) return true;
+
+    return *(size_t *) ((char *) subtree + tree->size_offset) == countNodes(subtree)
+           && sizesOk(tree, subtree->lchild) && sizesOk(tree, subtree->rchild);
+}
+
+static void test_Rank() {
+    int ints[200], i;
+    rbtree_node_t *node;
+    rbtree_t tree, plain;
+    bool ok = true;
+
+    rbtree_init(&tree, (rbtree_cmp_t *) int_cmp);
+    rbtree_init(&plain, (rbtree_cmp_t *) int_cmp);
+    test_result(rbtree_set_ranks(&tree) == 0
+                && rbtree_node_size(&tree) == rbtree_node_size(&plain) + sizeof(size_t),
+                "rank set");
+
+    /* 0, 2, 4, .. in a scrambled order */
+    for (i = 0; i < 200; ++i) {
+        ints[i] = (i * 37 % 200) * 2;
+        rbtree_insert(&tree, &ints[i]);
+        rbtree_insert(&plain, &ints[i]);
+    }
+    test_result(rbtree_size(&tree) == 200 && sizesOk(&tree, tree.root), "rank sizes after insert");
+
+    /* nodes can't grow once there are some */
+    test_result(rbtree_set_ranks(&plain) == -1, "rank set too late");
+
+    /* without sizes, positions are counted */
+    for (i = 0; i < 200; ++i) {
+        node = rbtree_node_at(&plain, i);
+        ok &= node != NULL && *(int *) node->data == 2 * i
+              && rbtree_node_rank(&plain, node) == i;
+    }
+    test_result(ok && rbtree_size(&plain) == 200 && rbtree_node_at(&plain, 200) == NULL,
+                "rank at counted");
+
+    while (plain.root != NULL) {
+        rbtree_delete(&plain, rbtree_first(&plain));
+    }
+
+    for (i = 0; i < 200; ++i) {
+        node = rbtree_node_at(&tree, i);
+        ok &= node != NULL && *(int *) node->data == 2 * i
+              && rbtree_node_rank(&tree, node) == i;
+    }
+    test_result(ok && rbtree_node_at(&tree, 200) == NULL
+                && rbtree_node_rank(&tree, NULL) == 200, "rank at");
+
+    for (i = 199, node = rbtree_node_prev(&tree, NULL); node != NULL;
+         node = rbtree_node_prev(&tree, node), --i) {
+        ok &= *(int *) node->data == 2 * i;
+    }
+    test_result(ok && i == -1, "rank prev");
+
+    for (i = 0; i < 200; i += 3) {
+        rbtree_delete(&tree, &ints[i]);
+    }
+    test_result(rbtree_size(&tree) == 200 - 67 && sizesOk(&tree, tree.root), "rank sizes after delete");
+
+    while (tree.root != NULL) {
+        rbtree_delete(&tree, rbtree_first(&tree));
+    }
+    test_result(rbtree_size(&tree) == 0 && rbtree_node_prev(&tree, NULL) == NULL, "rank empty");
+}
+
+/* return the black-height of subtree, or -1 if it isn't a red-black tree */
+static int blackHeight(rbtree_node_t *subtree) {
+    int left, right;
+
+    if (subtree == NULL) return 0;
+
+    if (subtree->color == 'r'
+        && ((subtree->lchild != NULL && subtree->lchild->color == 'r')
+            || (subtree->rchild != NULL && subtree->rchild->color == 'r')))
+        return -1;
+
+    left  = blackHeight(subtree->lchild);
+    right = blackHeight(subtree->rchild);
+
+    if (left < 0 || left != right) return -1;
+
+    return left + (subtree->color == 'b');
+}
+
+static bool treeOk(rbtree_t *tree) {
+    return (tree->root == NULL || tree->root->color == 'b')
+           && blackHeight(tree->root) >= 0
+           && (tree->size_offset == 0 || sizesOk(tree, tree->root));
+}
+
+static void test_SplitJoin() {
+    int ints[1000], i, key, *found;
+    rbtree_iter_t iter;
+    rbtree_t tree, right;
+    bool ok = true;
+
+    rbtree_init(&tree, (rbtree_cmp_t *) int_cmp);
+    rbtree_set_ranks(&tree);
+
+    for (i = 0; i < 1000; ++i) {
+        ints[i] = i * 7 % 1000;
+        rbtree_insert(&tree, &ints[i]);
+    }
+
+    /* split at every 50th key (including both ends), and put the
+     * pieces back together
+     */
+    for (key = 0; key <= 1000; key += 50) {
+        rbtree_split(&tree, &key, &right);
+
+        ok &= treeOk(&tree) && treeOk(&right);
+        ok &= rbtree_size(&tree) == key && rbtree_size(&right) == 1000 - key;
+        ok &= (found = rbtree_first(&right)) == NULL || *found == key;
+
+        rbtree_join(&tree, &right);
+        ok &= treeOk(&tree) && rbtree_size(&tree) == 1000 && right.root == NULL;
+    }
+
+    iter = rbtree_iter(&tree);
+    for (i = 0; i < 1000; ++i) {
+        ok &= (found = rbtree_iter_next(&iter)) != NULL && *found == i;
+    }
+    test_result(ok, "split and join");
+
+    while (tree.root != NULL) {
+        rbtree_delete(&tree, rbtree_first(&tree));
+    }
+}
+
+static void test_Build() {
+    static int ints[300];
+    void *values[300];
+    rbtree_iter_t iter;
+    rbtree_t tree;
+    int n, i, *found;
+    bool ok = true;
+
+    rbtree_init(&tree, (rbtree_cmp_t *) int_cmp);
+    rbtree_set_ranks(&tree);
+
+    for (i = 0; i < 300; ++i) {
+        ints[i]   = i;
+        values[i] = &ints[i];
+    }
+
+    for (n = 0; n <= 300; ++n) {
+        ok &= rbtree_build(&tree, values, n) == 0 && treeOk(&tree) && rbtree_size(&tree) == n;
+
+        iter = rbtree_iter(&tree);
+        for (i = 0; i < n; ++i) {
+            ok &= (found = rbtree_iter_next(&iter)) != NULL && *found == i;
+        }
+
+        /* the tree takes inserts and deletes as usual */
+        ok &= rbtree_insert(&tree, &ints[n / 2]) != NULL && treeOk(&tree);
+        ok &= rbtree_build(&tree, values, n) == -1;
+
+        while (tree.root != NULL) {
+            rbtree_delete(&tree, rbtree_first(&tree));
+        }
+        ok &= treeOk(&tree);
+    }
+    test_result(ok, "build");
+}
+
+typedef struct {
+    int addr;
+    size_t len;
+} extent_t;
+
+static size_t extent_len(extent_t *extent) {
+    return extent->len;
+}
+
+/* the largest extent in the subtree, checked against each node's max */
+static size_t maxExtent(rbtree_t *tree, rbtree_node_t *subtree, bool *ok) {
+    size_t max, left, right;
+
+    if (subtree == NULL) return 0;
+
+    max   = ((extent_t *) subtree->data)->len;
+    left  = maxExtent(tree, subtree->lchild, ok);
+    right = maxExtent(tree, subtree->rchild, ok);
+
+    if (left  > max) max = left;
+    if (right > max) max = right;
+
+    *ok &= *(size_t *) ((char *) subtree + tree->extent_offset) == max;
+
+    return max;
+}
+
+/* the first extent of at least size, by linear search */
+static extent_t *firstFit(rbtree_t *tree, size_t size) {
+    rbtree_iter_t iter = rbtree_iter(tree);
+    extent_t *extent;
+
+    while ((extent = rbtree_iter_next(&iter)) != NULL && extent->len < size)
+        ;
+
+    return extent;
+}
+
+static void test_FirstFit() {
+    static extent_t extents[2000];
+    extent_t *found;
+    rbtree_t tree, right;
+    unsigned seed = 7;
+    rbtree_pool_t *pool;
+    size_t size;
+    int i, j, key;
+    bool ok = true;
+
+    rbtree_init(&tree, (rbtree_cmp_t *) int_cmp);
+    size = rbtree_node_size(&tree);
+    ok &= rbtree_set_extent(&tree, (rbtree_extent_t *) extent_len) == 0
+          && rbtree_node_size(&tree) == size + sizeof(size_t);
+
+    for (i = 0; i < 1000; ++i) {
+        extents[i].addr = i * 3 % 1000;
+        extents[i].len  = (size_t) (i * 37 % 101);
+        rbtree_insert(&tree, &extents[i]);
+    }
+    maxExtent(&tree, tree.root, &ok);
+
+    /* stopped, then brought up to date again */
+    rbtree_set_extent(&tree, NULL);
+    extents[0].len = 500;
+    ok &= rbtree_set_extent(&tree, (rbtree_extent_t *) extent_len) == 0;
+    maxExtent(&tree, tree.root, &ok);
+    extents[0].len = 0;
+    rbtree_update_extent(&tree, &extents[0]);
+
+    /* a tree whose nodes have no room, or whose pool is sized without it */
+    rbtree_init(&right, (rbtree_cmp_t *) int_cmp);
+    rbtree_insert(&right, &extents[0]);
+    ok &= rbtree_set_extent(&right, (rbtree_extent_t *) extent_len) == -1;
+    rbtree_delete(&right, &extents[0]);
+
+    pool = rbtree_pool_create(rbtree_node_size(&right));
+    ok &= pool != NULL && rbtree_set_pool(&right, pool) == 0;
+    ok &= rbtree_set_extent(&right, (rbtree_extent_t *) extent_len) == -1
+          && rbtree_node_size(&right) == size;
+    ok &= rbtree_insert(&right, &extents[0]) == &extents[0];
+    rbtree_delete(&right, &extents[0]);
+    rbtree_pool_destroy(pool);
+
+    for (i = 0; i < 3000; ++i) {
+        seed = seed * 1103515245 + 12345;
+        j    = (seed >> 8) % 2000;
+
+        if (rbtree_find(&tree, &extents[j]) == &extents[j]) {
+            rbtree_delete(&tree, &extents[j]);
+
+        } else if (rbtree_find(&tree, &extents[j]) == NULL) {
+            extents[j].addr = j;
+            extents[j].len  = (seed >> 4) % 200;
+            rbtree_insert(&tree, &extents[j]);
+        }
+
+        if ((found = rbtree_find(&tree, &extents[(j + 1) % 2000])) != NULL) {
+            found->len = (seed >> 12) % 200;
+            rbtree_update_extent(&tree, found);
+        }
+
+        ok &= rbtree_find_first_fit(&tree, i % 210) == firstFit(&tree, i % 210);
+    }
+    maxExtent(&tree, tree.root, &ok);
+    test_result(ok && treeOk(&tree), "first fit");
+
+    /* split and join keep the max extents too */
+    for (key = 0; key <= 2000; key += 250) {
+        rbtree_split(&tree, &key, &right);
+        maxExtent(&tree, tree.root, &ok);
+        maxExtent(&right, right.root, &ok);
+        ok &= rbtree_find_first_fit(&right, 150) == firstFit(&right, 150);
+
+        rbtree_join(&tree, &right);
+        maxExtent(&tree, tree.root, &ok);
+    }
+
+    /* as does an aborted transaction */
+    rbtree_txn_begin(&tree);
+    while (tree.root != NULL && rbtree_find_first_fit(&tree, 100) != NULL) {
+        rbtree_delete(&tree, rbtree_find_first_fit(&tree, 100));
+    }
+    rbtree_txn_abort(&tree);
+    maxExtent(&tree, tree.root, &ok);
+    test_result(ok && rbtree_find_first_fit(&tree, 1000) == NULL, "first fit split, join, abort");
+
+    while (tree.root != NULL) {
+        rbtree_delete(&tree, rbtree_first(&tree));
+    }
+}
+
+static int malloc_budget;
+
+/* malloc, until the budget runs out */
+static void *budget_malloc(size_t size) {
+    return malloc_budget-- > 0 ? malloc(size) : NULL;
+}
+
+typedef struct {
+    rbtree_node_t *node, *lchild, *rchild;
+    void *data;
+    char color;
+} shape_t;
+
+/* record where each node is, and what it holds */
+static void getShape(rbtree_t *tree, shape_t *shape) {
+    size_t i;
+
+    for (i = 0; i < rbtree_size(tree); ++i) {
+        shape[i].node   = rbtree_node_at(tree, i);
+        shape[i].lchild = shape[i].node->lchild;
+        shape[i].rchild = shape[i].node->rchild;
+        shape[i].data   = shape[i].node->data;
+        shape[i].color  = shape[i].node->color;
+    }
+}
+
+static bool sameShape(rbtree_t *tree, shape_t *shape, size_t n) {
+    shape_t now[500];
+    size_t i;
+
+    if (rbtree_size(tree) != n || !treeOk(tree)) return false;
+
+    getShape(tree, now);
+    for (i = 0; i < n; ++i) {
+        if (now[i].node != shape[i].node || now[i].lchild != shape[i].lchild
+            || now[i].rchild != shape[i].rchild || now[i].data != shape[i].data
+            || now[i].color != shape[i].color)
+            return false;
+    }
+
+    return true;
+}
+
+static void test_Txn() {
+    int ints[300], odds[200], i, key, *found;
+    bool deleted[600] = {false};
+    shape_t shape[500];
+    rbtree_batch_t batch;
+    rbtree_t tree, other, right;
+    bool ok = true;
+
+    rbtree_init(&tree, (rbtree_cmp_t *) int_cmp);
+    rbtree_set_shift(&tree, (rbtree_shift_t *) int_shift);
+    rbtree_set_ranks(&tree);
+
+    /* 0, 2, 4, .. in a scrambled order */
+    for (i = 0; i < 300; ++i) {
+        ints[i] = (i * 37 % 300) * 2;
+        rbtree_insert(&tree, &ints[i]);
+    }
+    for (i = 0; i < 200; ++i) {
+        odds[i] = 2 * i + 1;
+    }
+    getShape(&tree, shape);
+
+    ok &= rbtree_txn_begin(&tree) == 0 && rbtree_txn_begin(&tree) == -1;
+    for (i = 0; i < 200; ++i) {
+        ok &= rbtree_insert(&tree, &odds[i]) == &odds[i];
+    }
+    for (i = 0; i < 300; i += 2) {
+        ok &= rbtree_delete(&tree, &ints[i]) == &ints[i];
+    }
+    ok &= rbtree_size(&tree) == 350 && treeOk(&tree);
+    rbtree_txn_abort(&tree);
+    test_result(ok && sameShape(&tree, shape, 300), "txn abort");
+
+    /* shifted keys are shifted back */
+    rbtree_txn_begin(&tree);
+    key = 100;
+    rbtree_shift_keys(&tree, &key, 1000);
+    key = 1100;
+    ok &= (found = rbtree_delete(&tree, &key)) != NULL && *found == 1100;
+    ok &= rbtree_insert(&tree, &odds[0]) == &odds[0];
+    rbtree_txn_abort(&tree);
+    test_result(ok && sameShape(&tree, shape, 300) && *found == 100, "txn abort shift");
+
+    /* a failed malloc part way through */
+    rbtree_set_malloc_free(&tree, budget_malloc, free);
+    malloc_budget = 100;
+    rbtree_txn_begin(&tree);
+    for (i = 0; i < 200 && rbtree_insert(&tree, &odds[i]) != NULL; ++i)
+        ;
+    ok &= i < 100;
+    rbtree_txn_abort(&tree);
+    malloc_budget = 0;
+    ok &= rbtree_txn_begin(&tree) == -1;
+    test_result(ok && sameShape(&tree, shape, 300), "txn out of memory");
+
+    /* a find that can't push shifts down fails alone; with no lazy
+     * shifting it needs no log room at all
+     */
+    rbtree_init(&other, (rbtree_cmp_t *) int_cmp);
+    rbtree_set_malloc_free(&other, budget_malloc, free);
+    malloc_budget = 4;
+    rbtree_txn_begin(&tree);
+    rbtree_txn_begin(&other);
+    ok = rbtree_insert(&tree, &odds[0]) == &odds[0] && rbtree_insert(&other, &odds[0]) == &odds[0];
+    key   = ints[0];
+    errno = 0;
+    ok &= rbtree_find(&tree, &key) == NULL && errno == ENOMEM;
+    errno = 0;
+    ok &= rbtree_find(&other, &odds[0]) == &odds[0] && errno == 0;
+    ok &= rbtree_txn_commit(&tree) == 0 && rbtree_delete(&tree, &odds[0]) == &odds[0];
+    test_result(ok && sameShape(&tree, shape, 300), "txn find out of memory");
+    rbtree_set_malloc_free(&tree, malloc, free);
+
+    /* operations that work on copies of the tree are refused */
+    rbtree_set_malloc_free(&other, malloc, free);
+    batch.op   = RBTREE_BATCH_INSERT;
+    batch.data = &odds[1];
+    ok  = rbtree_split(&other, &odds[0], &right) == -1 && rbtree_join(&right, &other) == -1;
+    ok &= rbtree_build(&other, (void **) &found, 0) == -1 && rbtree_set_extent(&other, NULL) == -1;
+    ok &= rbtree_apply_batch(&other, &batch, 1, 1) == -1 && batch.result == RBTREE_BATCH_FAILED;
+    rbtree_txn_abort(&other);
+    test_result(ok && other.root == NULL, "txn refuses copies");
+
+    rbtree_txn_begin(&tree);
+    for (i = 0; i < 200; ++i) {
+        rbtree_insert(&tree, &odds[i]);
+    }
+    for (i = 0; i < 300; i += 2) {
+        rbtree_delete(&tree, &ints[i]);
+        deleted[ints[i]] = true;
+    }
+    ok &= rbtree_txn_commit(&tree) == 0 && rbtree_size(&tree) == 350 && treeOk(&tree);
+    for (i = 0; i < 600; ++i) {
+        key = i;
+        found = rbtree_find(&tree, &key);
+        ok &= (found != NULL) == (i % 2 == 1 ? i < 400 : !deleted[i]);
+    }
+    test_result(ok && rbtree_txn_commit(&tree) == -1, "txn commit");
+
+    while (tree.root != NULL) {
+        rbtree_delete(&tree, rbtree_first(&tree));
+    }
+}
+
+static void test_Batch() {
+    static int ints[10000], keys[30000], gone[20000];
+    static rbtree_batch_t ops[30000];
+    int i, n, expected;
+    rbtree_iter_t iter;
+    rbtree_t tree;
+    int *found;
+    bool ok = true;
+
+    rbtree_init(&tree, (rbtree_cmp_t *) int_cmp);
+    rbtree_set_ranks(&tree);
+
+    /* the tree holds the even numbers below 20000 */
+    for (i = 0; i < 10000; ++i) {
+        ints[i] = 2 * i;
+        rbtree_insert(&tree, &ints[i]);
+    }
+
+    /* insert everything below 20000 in a scrambled order, then delete
+     * the multiples of 3
+     */
+    for (i = n = 0; i < 20000; ++i, ++n) {
+        keys[n]    = i * 7919 % 20000;
+        ops[n].op   = RBTREE_BATCH_INSERT;
+        ops[n].data = &keys[n];
+    }
+    for (i = 0; i < 30000; i += 3, ++n) {
+        keys[n]     = i;
+        ops[n].op   = RBTREE_BATCH_DELETE;
+        ops[n].data = &keys[n];
+    }
+
+    test_result(rbtree_apply_batch(&tree, ops, n, 8) == 0 && treeOk(&tree), "batch apply");
+
+    for (i = 0; i < 20000; ++i) {
+        int key = *(int *) ops[i].data;
+        ok &= ops[i].result == (key % 2 == 0 ? RBTREE_BATCH_EXISTED : RBTREE_BATCH_INSERTED);
+    }
+    for (; i < n; ++i) {
+        int key = *(int *) ops[i].data;
+        ok &= ops[i].result == (key < 20000 ? RBTREE_BATCH_DELETED : RBTREE_BATCH_NOT_FOUND);
+    }
+    test_result(ok, "batch results");
+
+    iter = rbtree_iter(&tree);
+    for (expected = 0; expected < 20000; ++expected) {
+        if (expected % 3 == 0) continue;
+        ok &= (found = rbtree_iter_next(&iter)) != NULL && *found == expected;
+    }
+    test_result(ok && rbtree_iter_next(&iter) == NULL, "batch in order");
+
+    /* delete it all again */
+    for (i = 0; i < 20000; ++i) {
+        gone[i]     = i;
+        ops[i].op   = RBTREE_BATCH_DELETE;
+        ops[i].data = &gone[i];
+    }
+    rbtree_apply_batch(&tree, ops, 20000, 3);
+    test_result(tree.root == NULL, "batch delete all");
+}
+
+static size_t int_hash(int *i) {
+    return (size_t) *i * 0x9e3779b97f4a7c15ULL >> 16;
+}
+
+static void test_Cache() {
+    int ints[1000], i, round, key;
+    unsigned long hits, misses;
+    rbtree_t tree;
+    bool ok = true;
+
+    rbtree_init(&tree, (rbtree_cmp_t *) int_cmp);
+    ok = rbtree_find_is_read_only(&tree);
+    test_result(rbtree_set_cache(&tree, (rbtree_hash_t *) int_hash, 64) == 0
+                && ok && !rbtree_find_is_read_only(&tree), "cache set");
+    rbtree_set_shift(&tree, (rbtree_shift_t *) int_shift);
+
+    for (i = 0; i < 1000; ++i) {
+        ints[i] = i;
+        rbtree_insert(&tree, &ints[i]);
+    }
+
+    /* a few hot keys, found over and over */
+    for (round = 0; round < 100; ++round) {
+        for (i = 0; i < 10; ++i) {
+            key = i * 100;
+            ok &= rbtree_find(&tree, &key) == &ints[i * 100];
+        }
+    }
+    rbtree_cache_stats(&tree, &hits, &misses);
+    test_result(ok && hits >= 900 && hits + misses == 1000, "cache hits");
+
+    /* deleting a hot key, and the nodes of hot keys (the successor of
+     * a node with two children gives up its node)
+     */
+    for (i = 0; i < 1000; i += 2) {
+        rbtree_delete(&tree, &ints[i]);
+    }
+    for (round = 0; round < 2; ++round) {
+        for (i = 0; i < 1000; ++i) {
+            key = i;
+            ok &= rbtree_find(&tree, &key) == (i % 2 == 0 ? NULL : &ints[i]);
+        }
+    }
+    test_result(ok, "cache after delete");
+
+    key = 500;
+    rbtree_shift_keys(&tree, &key, 1);
+    key = 502;
+    ok = rbtree_find(&tree, &key) == &ints[501];
+    key = 501;
+    ok &= rbtree_find(&tree, &key) == NULL;
+    test_result(ok, "cache after shift");
+
+    rbtree_set_cache(&tree, NULL, 0);
+    while (tree.root != NULL) {
+        rbtree_delete(&tree, rbtree_first(&tree));
+    }
+}
+
+static long compares;
+
+static int counting_cmp(int *i1, int *i2) {
+    ++compares;
+    return int_cmp(i1, i2);
+}
+
+static void test_SortedBatch() {
+    int ints[1000], keys[2000], *ptrs[2000], *out[2000], i;
+    long batch_compares;
+    rbtree_t tree;
+    bool ok = true;
+
+    rbtree_init(&tree, (rbtree_cmp_t *) counting_cmp);
+
+    /* the even numbers below 2000 */
+    for (i = 0; i < 1000; ++i) {
+        ints[i] = (i * 7 % 1000) * 2;
+        rbtree_insert(&tree, &ints[i]);
+    }
+
+    for (i = 0; i < 2000; ++i) {
+        keys[i] = i;
+        ptrs[i] = &keys[i];
+    }
+
+    compares = 0;
+    ok &= rbtree_find_sorted_batch(&tree, (void **) ptrs, 2000, (void **) out) == 1000;
+    batch_compares = compares;
+
+    for (i = 0; i < 2000; ++i) {
+        ok &= i % 2 == 0 ? out[i] != NULL && *out[i] == i : out[i] == NULL;
+    }
+
+    compares = 0;
+    for (i = 0; i < 2000; ++i) {
+        rbtree_find(&tree, ptrs[i]);
+    }
+    test_result(ok && batch_compares < compares / 2, "sorted batch find");
+
+    /* unsorted keys are found all the same */
+    for (i = 0; i < 2000; ++i) {
+        ptrs[i] = &keys[i * 997 % 2000];
+    }
+    ok = rbtree_find_sorted_batch(&tree, (void **) ptrs, 2000, (void **) out) == 1000;
+    for (i = 0; i < 2000; ++i) {
+        ok &= *ptrs[i] % 2 == 0 ? out[i] != NULL && *out[i] == *ptrs[i] : out[i] == NULL;
+    }
+    test_result(ok, "unsorted batch find");
+
+    while (tree.root != NULL) {
+        rbtree_delete(&tree, rbtree_first(&tree));
+    }
+}
+
+typedef struct {
+    const char *tenant;
+    size_t tenant_len;
+    long long time;
+    unsigned long long id;
+} tuple_t;
+
+static int tuple_cmp(tuple_t *t1, tuple_t *t2) {
+    size_t len = t1->tenant_len < t2->tenant_len ? t1->tenant_len : t2->tenant_len;
+    int rel    = memcmp(t1->tenant, t2->tenant, len);
+
+    if (rel != 0)                         return rel;
+    if (t1->tenant_len != t2->tenant_len) return t1->tenant_len < t2->tenant_len ? -1 : 1;
+    if (t1->time != t2->time)             return t1->time < t2->time ? -1 : 1;
+    if (t1->id != t2->id)                 return t1->id < t2->id ? -1 : 1;
+
+    return 0;
+}
+
+static void test_Key() {
+    static const char *tenants[] = {"", "a", "ab", "a\0", "b", "ba"};
+    static const size_t tenant_lens[] = {0, 1, 2, 2, 1, 2};
+    static const long long times[] = {-5000000000LL, -1, 0, 1, 7, 5000000000LL};
+    double doubles[] = {-1e300, -2.5, -1.0, -0.0, 0.0, 1e-300, 1.0, 2.5, 1e300};
+    typedef struct { rbtree_key_t key; int index; } entry_t;
+    tuple_t tuples[6 * 6 * 3];
+    rbtree_key_t k1, k2;
+    rbtree_iter_t iter;
+    entry_t entry, *found, *prev = NULL;
+    rbtree_t tree;
+    bool ok = true;
+    int i, n = 6 * 6 * 3;
+
+    rbtree_init_inline(&tree, rbtree_key_cmp, sizeof(rbtree_key_t), sizeof(int));
+
+    for (i = 0; i < n; ++i) {
+        tuples[i].tenant     = tenants[i * 5 % 6];
+        tuples[i].tenant_len = tenant_lens[i * 5 % 6];
+        tuples[i].time       = times[i / 6 % 6];
+        tuples[i].id         = i % 3 == 0 ? ~0ULL : (unsigned long long) i;
+
+        rbtree_key_init(&entry.key);
+        ok &= rbtree_key_put_string(&entry.key, tuples[i].tenant, tuples[i].tenant_len) == 0;
+        ok &= rbtree_key_put_int64(&entry.key, tuples[i].time) == 0;
+        ok &= rbtree_key_put_uint64(&entry.key, tuples[i].id) == 0;
+        entry.index = i;
+
+        rbtree_insert(&tree, &entry);
+    }
+    test_result(ok, "key encode");
+
+    iter = rbtree_iter(&tree);
+    for (i = 0; i < n; ++i) {
+        found = rbtree_iter_next(&iter);
+        ok &= prev == NULL || tuple_cmp(&tuples[prev->index], &tuples[found->index]) <= 0;
+        prev = found;
+    }
+    test_result(ok, "key order");
+
+    for (i = 0; i + 1 < sizeof(doubles) / sizeof(doubles[0]); ++i) {
+        rbtree_key_init(&k1);
+        rbtree_key_init(&k2);
+        rbtree_key_put_double(&k1, doubles[i]);
+        rbtree_key_put_double(&k2, doubles[i + 1]);
+        ok &= rbtree_key_cmp(&k1, &k2) < 0;
+    }
+    test_result(ok, "key double order");
+
+    rbtree_key_init(&k1);
+    ok = rbtree_key_put_string(&k1, "0123456789012345678901234567890123456789", 40) == 0;
+    ok &= rbtree_key_put_string(&k1, "0123456789012345", 16) == -1 && k1.len == 42;
+    test_result(ok, "key too long");
+
+    while (tree.root != NULL) {
+        rbtree_delete(&tree, rbtree_first(&tree));
+    }
+}
+
+static void test_Mapped() {
+    byte data[] = {3,1,4,1,5,9,2,6};
+    char name[64];
+    rbtree_mapped_t *mapped;
+    byte search, *found;
+    int i, status;
+    pid_t pid;
+
+    snprintf(name, sizeof(name), "/rbtree_test1.%d", (int) getpid());
+    mapped = rbtree_mapped_create(name, 1 << 16, (rbtree_cmp_t *) byte_cmp);
+    test_result(mapped != NULL, "mapped create");
+    if (mapped == NULL) return;
+
+    /* the child maps the segment afresh and fills in the tree.. */
+    if ((pid = fork()) == 0) {
+        rbtree_mapped_close(mapped);
+
+        if ((mapped = rbtree_mapped_open(name, (rbtree_cmp_t *) byte_cmp)) == NULL)
+            _exit(1);
+
+        for (i = 0; i < sizeof(data); ++i) {
+            byte *datum = rbtree_mapped_alloc(mapped, sizeof(byte));
+            *datum = data[i];
+            if (rbtree_mapped_insert(mapped, datum) == NULL) _exit(1);
+        }
+
+        _exit(0);
+    }
+
+    waitpid(pid, &status, 0);
+    test_result(WIFEXITED(status) && WEXITSTATUS(status) == 0, "mapped child");
+
+    /* ..and the parent sees it. */
+    for (i = 0; i < sizeof(data); ++i) {
+        found = rbtree_mapped_find(mapped, &data[i]);
+        test_result(found != NULL && *found == data[i], "mapped find");
+    }
+
+    search = 7;
+    test_result(rbtree_mapped_find(mapped, &search) == NULL, "mapped find missing");
+
+    for (i = 0; i < sizeof(data); ++i) {
+        found = rbtree_mapped_delete(mapped, &data[i]);
+        test_result(found != NULL && *found == data[i], "mapped delete");
+        rbtree_mapped_free(mapped, found);
+    }
+
+    test_result(rbtree_mapped_lock(mapped)->root == NULL, "mapped empty");
+    rbtree_mapped_unlock(mapped);
+
+    rbtree_mapped_close(mapped);
+    rbtree_mapped_unlink(name);
+}
+
+static void test_MappedFile() {
+    byte data[] = {3,1,4,1,5,9,2,6};
+    byte sortedData[] = {1,1,2,3,4,5,6,9};
+    char path[64];
+    rbtree_mapped_t *mapped;
+    rbtree_iter_t iter;
+    byte *found;
+    int i;
+
+    snprintf(path, sizeof(path), "/tmp/rbtree_test1.%d", (int) getpid());
+    mapped = rbtree_mapped_create_file(path, 1 << 20, (rbtree_cmp_t *) byte_cmp);
+    test_result(mapped != NULL, "mapped file create");
+    if (mapped == NULL) return;
+
+    for (i = 0; i < sizeof(data); ++i) {
+        byte *datum = rbtree_mapped_alloc(mapped, sizeof(byte));
+        *datum = data[i];
+        rbtree_mapped_insert(mapped, datum);
+    }
+
+    test_result(rbtree_mapped_sync(mapped) == 0, "mapped file sync");
+    rbtree_mapped_close(mapped);
+
+    /* the tree is still there after the file is reopened */
+    mapped = rbtree_mapped_open_file(path, (rbtree_cmp_t *) byte_cmp);
+    test_result(mapped != NULL, "mapped file open");
+    if (mapped == NULL) { unlink(path); return; }
+
+    iter = rbtree_iter(rbtree_mapped_lock(mapped));
+    for (i = 0; i < sizeof(sortedData); ++i) {
+        found = rbtree_iter_next(&iter);
+        test_result(found != NULL && *found == sortedData[i], "mapped file in order");
+    }
+    rbtree_mapped_unlock(mapped);
+
+    rbtree_mapped_close(mapped);
+    unlink(path);
+}
+
+static atomic_int snapshot_made, snapshot_released, snapshot_fail_at;
+
+static size_t snapshot_bytes(const int *data, const void **bytes) {
+    *bytes = data;
+
+    return sizeof(int);
+}
+
+/* a copy of the int, until snapshot_fail_at values have been made */
+static void *snapshot_make(void *ctx, const void *bytes, size_t len) {
+    int *data;
+
+    if (len != sizeof(int) || atomic_fetch_add(&snapshot_made, 1) == snapshot_fail_at)
+        return NULL;
+
+    if ((data = (int *) malloc(sizeof(int))) != NULL) memcpy(data, bytes, sizeof(int));
+
+    return data;
+}
+
+static void snapshot_release(void *ctx, void *data) {
+    atomic_fetch_add(&snapshot_released, 1);
+    free(data);
+}
+
+/* load path into tree with nthreads, and check that it holds 0..n-1 */
+static bool snapshot_loaded(rbtree_t *tree, const char *path, int nthreads, int n) {
+    rbtree_iter_t iter;
+    int i, *found;
+    bool ok;
+
+    atomic_store(&snapshot_made, 0);
+    atomic_store(&snapshot_released, 0);
+    atomic_store(&snapshot_fail_at, -1);
+
+    ok = rbtree_snapshot_load(tree, path, snapshot_make, snapshot_release, NULL, nthreads) == 0
+      && rbtree_size(tree) == n && treeOk(tree);
+
+    iter = rbtree_iter(tree);
+    for (i = 0; i < n; ++i) {
+        ok &= (found = rbtree_iter_next(&iter)) != NULL && *found == i;
+    }
+
+    while (tree->root != NULL) {
+        free(rbtree_delete(tree, rbtree_first(tree)));
+    }
+
+    return ok;
+}
+
+static void test_Snapshot() {
+    static int ints[10000];
+    char path[64];
+    rbtree_t tree, loaded;
+    int i;
+
+    snprintf(path, sizeof(path), "/tmp/rbtree_test1.%d.snap", (int) getpid());
+
+    rbtree_init(&tree, (rbtree_cmp_t *) int_cmp);
+    rbtree_init(&loaded, (rbtree_cmp_t *) int_cmp);
+
+    for (i = 0; i < 10000; ++i) {
+        ints[i] = i * 7 % 10000;
+        rbtree_insert(&tree, &ints[i]);
+    }
+
+    test_result(rbtree_snapshot_save(&tree, path, (rbtree_snapshot_bytes_t *) snapshot_bytes,
+                                     1000) == 0, "snapshot save");
+    test_result(snapshot_loaded(&loaded, path, 4, 10000), "snapshot load 4 threads");
+    test_result(snapshot_loaded(&loaded, path, 1, 10000), "snapshot load 1 thread");
+    test_result(snapshot_loaded(&loaded, path, 64, 10000), "snapshot load more threads than chunks");
+
+    /* a failed load leaves the tree empty, and gives back what was made */
+    atomic_store(&snapshot_made, 0);
+    atomic_store(&snapshot_released, 0);
+    atomic_store(&snapshot_fail_at, 7777);
+    test_result(rbtree_snapshot_load(&loaded, path, snapshot_make, snapshot_release, NULL, 4) == -1
+             && loaded.root == NULL
+             && atomic_load(&snapshot_released) == atomic_load(&snapshot_made) - 1,
+                "snapshot load make fails");
+
+    rbtree_txn_begin(&loaded);
+    atomic_store(&snapshot_made, 0);
+    test_result(rbtree_snapshot_load(&loaded, path, snapshot_make, snapshot_release, NULL, 4) == -1
+             && loaded.root == NULL && atomic_load(&snapshot_made) == 0, "snapshot load in txn");
+    rbtree_txn_abort(&loaded);
+
+    while (tree.root != NULL) {
+        rbtree_delete(&tree, rbtree_first(&tree));
+    }
+
+    test_result(rbtree_snapshot_save(&tree, path, (rbtree_snapshot_bytes_t *) snapshot_bytes,
+                                     0) == 0
+             && snapshot_loaded(&loaded, path, 4, 0), "snapshot empty");
+
+    unlink(path);
+    test_result(rbtree_snapshot_load(&loaded, path, snapshot_make, snapshot_release, NULL, 4) == -1,
+                "snapshot missing file");
+}
+
+static void test_Rangeset() {
+    static bool in[2000];
+    rbtree_range_t *run, *prev;
+    rbtree_iter_t iter;
+    rbtree_t tree;
+    unsigned seed = 1;
+    int i, x, runs;
+    bool ok = true;
+
+    rbtree_rangeset_init(&tree);
+
+    /* mostly consecutive inserts make a few long runs */
+    for (x = 0; x < 1000; ++x) {
+        if (x % 100 != 50) in[x] = rbtree_rangeset_insert(&tree, x) == 1;
+    }
+    test_result(rbtree_size(&tree) == 11 && treeOk(&tree), "rangeset runs");
+    test_result(rbtree_rangeset_insert(&tree, 7) == 0 && rbtree_rangeset_insert(&tree, 150) == 1
+             && rbtree_size(&tree) == 10, "rangeset join");
+    in[150] = true;
+
+    for (i = 0; i < 20000; ++i) {
+        seed = seed * 1103515245 + 12345;
+        x = (seed >> 8) % 2000;
+
+        if ((seed >> 4) % 2 == 0) {
+            ok &= rbtree_rangeset_insert(&tree, x) == !in[x];
+            in[x] = true;
+        } else {
+            ok &= rbtree_rangeset_delete(&tree, x) == in[x];
+            in[x] = false;
+        }
+    }
+
+    /* the runs are maximal, and hold just the members */
+    runs = 0;
+    for (x = 0; x < 2000; ++x) {
+        ok &= rbtree_rangeset_contains(&tree, x) == in[x];
+        runs += in[x] && (x == 0 || !in[x - 1]);
+    }
+
+    prev = NULL;
+    iter = rbtree_iter(&tree);
+    while ((run = rbtree_iter_next(&iter)) != NULL) {
+        ok &= run->lo <= run->hi && (prev == NULL || prev->hi + 1 < run->lo);
+        prev = run;
+    }
+    test_result(ok && rbtree_size(&tree) == runs && treeOk(&tree), "rangeset random");
+
+    test_result(rbtree_rangeset_contains(&tree, INT64_MIN) == 0
+             && rbtree_rangeset_insert(&tree, INT64_MIN) == 1
+             && rbtree_rangeset_insert(&tree, INT64_MAX) == 1
+             && rbtree_rangeset_delete(&tree, INT64_MAX) == 1
+             && rbtree_rangeset_delete(&tree, INT64_MIN) == 1, "rangeset limits");
+
+    rbtree_rangeset_insert(&tree, 0);
+    rbtree_txn_begin(&tree);
+    test_result(rbtree_rangeset_insert(&tree, INT64_MIN) == -1
+             && rbtree_rangeset_delete(&tree, 0) == -1 && rbtree_rangeset_contains(&tree, 0) == 1
+             && rbtree_txn_commit(&tree) == 0, "rangeset in txn");
+
+    rbtree_rangeset_clear(&tree);
+    test_result(tree.root == NULL, "rangeset clear");
+}
+
+static long long int_key(int *i) {
+    return *i;
+}
+
+static const char *str_key(char **s) {
+    return *s;
+}
+
+static int str_cmp(char **s1, char **s2) {
+    return strcmp(*s1, *s2);
+}
+
+static void test_Frozen() {
+    static int ints[1000];
+    char *strs[] = {"apple", "applesauce", "apply", "banana", "band",
+                    "bandana", "cherry", "chert", "date", "dated", "dates",
+                    "elder", "elderberry", "fig", "figs", "grape", "grapefruit",
+                    "guava", "kiwi", "lemon"};
+    int nstrs = sizeof(strs) / sizeof(strs[0]);
+    rbtree_frozen_int_t *frozen_int;
+    rbtree_frozen_str_t *frozen_str;
+    rbtree_t tree;
+    int i, ok, *first;
+
+    rbtree_init(&tree, (rbtree_cmp_t *) int_cmp);
+    for (i = 0; i < 1000; ++i) {
+        ints[i] = i * 3 + (i % 7 == 0) - 500;
+        rbtree_insert(&tree, &ints[i]);
+    }
+
+    frozen_int = rbtree_freeze_int(&tree, (rbtree_int_key_t *) int_key);
+    test_result(frozen_int != NULL, "frozen int freeze");
+
+    ok = 1;
+    for (i = 0; i < 1000; ++i) {
+        ok &= rbtree_frozen_int_find(frozen_int, ints[i]) == &ints[i];
+        ok &= rbtree_frozen_int_find(frozen_int, ints[i] + 1) == NULL;
+    }
+    test_result(ok, "frozen int find");
+    test_result(rbtree_frozen_int_find(frozen_int, -501) == NULL, "frozen int below");
+    test_result(rbtree_frozen_int_size(frozen_int) * 4 < 1000 * sizeof(rbtree_node_t),
+                "frozen int size");
+    rbtree_frozen_int_free(frozen_int);
+
+    while ((first = rbtree_first(&tree)) != NULL) {
+        rbtree_delete(&tree, first);
+    }
+
+    rbtree_init(&tree, (rbtree_cmp_t *) str_cmp);
+    for (i = nstrs - 1; i >= 0; --i) {
+        rbtree_insert(&tree, &strs[i]);
+    }
+
+    frozen_str = rbtree_freeze_str(&tree, (rbtree_str_key_t *) str_key);
+    test_result(frozen_str != NULL, "frozen str freeze");
+
+    ok = 1;
+    for (i = 0; i < nstrs; ++i) {
+        ok &= rbtree_frozen_str_find(frozen_str, strs[i]) == &strs[i];
+    }
+    test_result(ok, "frozen str find");
+    test_result(rbtree_frozen_str_find(frozen_str, "app") == NULL
+             && rbtree_frozen_str_find(frozen_str, "bananas") == NULL
+             && rbtree_frozen_str_find(frozen_str, "zebra") == NULL,
+                "frozen str missing");
+    rbtree_frozen_str_free(frozen_str);
+
+    for (i = 0; i < nstrs; ++i) {
+        rbtree_delete(&tree, &strs[i]);
+    }
+}
+
+typedef struct {
+    int price;
+    int time;
+} order_t;
+
+static int order_cmp(order_t *o1, order_t *o2) {
+    return o1->price < o2->price ? -1 : o1->price > o2->price;
+}
+
+static long long order_price(order_t *o) {
+    return o->price;
+}
+
+static long long order_time(order_t *o) {
+    return o->time;
+}
+
+static void count_visit(size_t *count, order_t *o) {
+    ++*count;
+}
+
+static void test_Range2d() {
+    static order_t orders[3000];
+    rbtree_range2d_t *index;
+    rbtree_t tree;
+    size_t count, visited;
+    int i, j, ok = 1;
+
+    rbtree_init(&tree, (rbtree_cmp_t *) order_cmp);
+    for (i = 0; i < 3000; ++i) {
+        orders[i].price = i * 37 % 1000;
+        orders[i].time  = i * 101 % 997;
+        rbtree_insert(&tree, &orders[i]);
+    }
+
+    index = rbtree_range2d_build(&tree, (rbtree_int_key_t *) order_price,
+                                 (rbtree_int_key_t *) order_time);
+    test_result(index != NULL, "range2d build");
+
+    for (i = 0; i < 200; ++i) {
+        int x1 = i * 13 % 1000 - 10, x2 = x1 + i * 7 % 300;
+        int y1 = i * 29 % 997 - 10, y2 = y1 + i * 11 % 400;
+
+        count = 0;
+        for (j = 0; j < 3000; ++j) {
+            count += orders[j].price >= x1 && orders[j].price <= x2
+                  && orders[j].time  >= y1 && orders[j].time  <= y2;
+        }
+
+        visited = 0;
+        ok &= rbtree_range2d_query(index, x1, x2, y1, y2,
+                                   (rbtree_range2d_visit_t *) count_visit, &visited) == count;
+        ok &= visited == count;
+    }
+    test_result(ok, "range2d query");
+
+    test_result(rbtree_range2d_query(index, 0, 999, 0, 996, NULL, NULL) == 3000
+             && rbtree_range2d_query(index, 5, 4, 0, 996, NULL, NULL) == 0
+             && rbtree_range2d_query(index, 0, 999, 997, 2000, NULL, NULL) == 0,
+                "range2d bounds");
+    rbtree_range2d_free(index);
+
+    while (tree.root != NULL) {
+        rbtree_delete(&tree, rbtree_first(&tree));
+    }
+}
+
+static size_t byte_key_bytes(byte *b, const void **bytes) {
+    *bytes = b;
+    return sizeof(byte);
+}
+
+static void test_Trace() {
+    byte data[] = {3,1,4};
+    rbtree_trace_op_t ops[] = {RBTREE_TRACE_INSERT, RBTREE_TRACE_INSERT,
+                               RBTREE_TRACE_INSERT, RBTREE_TRACE_FIND,
+                               RBTREE_TRACE_ITER, RBTREE_TRACE_ITER,
+                               RBTREE_TRACE_ITER_NEXT, RBTREE_TRACE_ITER_NEXT,
+                               RBTREE_TRACE_ITER_NEXT, RBTREE_TRACE_DELETE};
+    byte keys[]  = {3,1,4,1,0,0,0,0,0,4};
+    int iters[]  = {0,0,0,0,1,2,1,2,2,0};     /* which iterator */
+    unsigned long ids[3] = {0};
+    rbtree_trace_reader_t *reader;
+    rbtree_trace_record_t record;
+    rbtree_trace_t *trace;
+    rbtree_iter_t iter, iter2;
+    rbtree_t tree;
+    char path[64];
+    int i, ok;
+
+    snprintf(path, sizeof(path), "/tmp/rbtree_test1.%d.trace", (int) getpid());
+
+    rbtree_init(&tree, (rbtree_cmp_t *) byte_cmp);
+    trace = rbtree_trace_start(&tree, path, (rbtree_key_bytes_t *) byte_key_bytes);
+    test_result(trace != NULL, "trace start");
+    if (trace == NULL) return;
+
+    for (i = 0; i < sizeof(data); ++i) {
+        rbtree_insert(&tree, &data[i]);
+    }
+    rbtree_find(&tree, &data[1]);
+    iter  = rbtree_iter(&tree);
+    iter2 = rbtree_iter(&tree);
+    rbtree_iter_next(&iter);
+    rbtree_iter_next(&iter2);
+    rbtree_iter_next(&iter2);
+    rbtree_delete(&tree, &data[2]);
+
+    test_result(rbtree_trace_stop(trace) == 0, "trace stop");
+
+    /* not recorded */
+    rbtree_delete(&tree, &data[0]);
+    rbtree_delete(&tree, &data[1]);
+
+    reader = rbtree_trace_open(path);
+    test_result(reader != NULL, "trace open");
+    if (reader == NULL) { unlink(path); return; }
+
+    ok = 1;
+    for (i = 0; i < sizeof(ops) / sizeof(ops[0]); ++i) {
+        ok &= rbtree_trace_read(reader, &record) == 1 && record.op == ops[i];
+
+        if (keys[i] != 0)
+            ok &= record.key_len == 1 && *(byte *) record.key == keys[i];
+        else
+            ok &= record.key == NULL;
+
+        /* each iterator keeps its own number */
+        if (iters[i] != 0 && ids[iters[i]] == 0) ids[iters[i]] = record.iter;
+        ok &= iters[i] == 0 || record.iter == ids[iters[i]];
+    }
+    ok &= ids[1] != 0 && ids[2] != 0 && ids[1] != ids[2];
+    test_result(ok, "trace read");
+    test_result(rbtree_trace_read(reader, &record) == 0, "trace end");
+
+    rbtree_trace_close(reader);
+    unlink(path);
+}
+
+static void test_Perf() {
+    byte data[] = {3,1,4,1,5,9,2,6};
+    rbtree_perf_t perf;
+    rbtree_t tree;
+    int i, available;
+
+    /* counters may not be available here; either way, nothing breaks */
+    available = rbtree_perf_open(&perf);
+    test_result(available >= 0 && available <= RBTREE_PERF_NUM_COUNTERS, "perf open");
+
+    rbtree_init(&tree, (rbtree_cmp_t *) byte_cmp);
+
+    rbtree_perf_start(&perf);
+    for (i = 0; i < sizeof(data); ++i) {
+        rbtree_insert(&tree, &data[i]);
+    }
+    rbtree_perf_stop(&perf);
+
+    test_result(!rbtree_perf_available(&perf, RBTREE_PERF_INSTRUCTIONS)
+                || perf.value[RBTREE_PERF_INSTRUCTIONS] > 0, "perf count");
+
+    rbtree_perf_close(&perf);
+
+    for (i = 0; i < sizeof(data); ++i) {
+        rbtree_delete(&tree, &data[i]);
+    }
+}
+
+#define POOL_THREADS 4
+#define POOL_NODES   20000
+
+typedef struct {
+    rbtree_t tree;
+    int data[POOL_NODES];
+    int ok;
+} pool_test_t;
+
+static void *pool_insert_thread(void *arg) {
+    pool_test_t *t = (pool_test_t *) arg;
+    int i;
+
+    for (i = 0; i < POOL_NODES; ++i) {
+        t->data[i] = (i * 7919) % POOL_NODES;
+        t->ok &= rbtree_insert(&t->tree, &t->data[i]) != NULL;
+    }
+
+    return NULL;
+}
+
+/* deletes the nodes some other thread allocated */
+static void *pool_delete_thread(void *arg) {
+    pool_test_t *t = (pool_test_t *) arg;
+    int i;
+
+    for (i = 0; i < POOL_NODES; ++i) {
+        t->ok &= rbtree_delete(&t->tree, &i) != NULL;
+    }
+    t->ok &= t->tree.root == NULL;
+
+    return NULL;
+}
+
+static void test_Workload() {
+    rbtree_workload_kind_t kind;
+    rbtree_workload_stats_t stats;
+    rbtree_workload_step_t *steps;
+    int inserted[1000];
+    rbtree_t tree;
+    size_t count, i;
+    bool ok = true;
+
+    for (kind = 0; kind < RBTREE_WORKLOAD_NUM_KINDS; ++kind) {
+        steps = rbtree_workload_create(kind, 1000, 1, &count);
+        ok &= steps != NULL && count == 3000;
+        if (steps == NULL) break;
+
+        /* every key inserted is deleted again */
+        memset(inserted, 0, sizeof(inserted));
+        for (i = 0; i < count; ++i) {
+            if (steps[i].op == RBTREE_WORKLOAD_INSERT) ++inserted[steps[i].key];
+            if (steps[i].op == RBTREE_WORKLOAD_DELETE) --inserted[steps[i].key];
+        }
+        for (i = 0; i < 1000; ++i) {
+            ok &= inserted[i] == 0;
+        }
+
+        rbtree_init(&tree, rbtree_workload_cmp);
+        ok &= rbtree_workload_run(&tree, steps, count, &stats) == 0 && tree.root == NULL;
+        ok &= stats.count[RBTREE_WORKLOAD_INSERT] == 1000
+              && stats.count[RBTREE_WORKLOAD_FIND] == 1000
+              && stats.count[RBTREE_WORKLOAD_DELETE] == 1000;
+        ok &= rbtree_workload_percentile(&stats, RBTREE_WORKLOAD_DELETE, 0.5)
+              <= rbtree_workload_percentile(&stats, RBTREE_WORKLOAD_DELETE, 0.99)
+              && rbtree_workload_percentile(&stats, RBTREE_WORKLOAD_DELETE, 1.0)
+              == stats.max_ns[RBTREE_WORKLOAD_DELETE];
+
+        free(steps);
+    }
+    test_result(ok, "workload run");
+
+    steps = rbtree_workload_create(RBTREE_WORKLOAD_ZIGZAG, 1000, 1, &count);
+    ok = steps[0].key == 0 && steps[1].key == 999 && steps[2].key == 1 && steps[3].key == 998;
+    free(steps);
+    steps = rbtree_workload_create(RBTREE_WORKLOAD_CASCADE, 1000, 1, &count);
+    ok &= steps[2000].key == 0 && steps[2001].key == 512 && steps[2002].key == 256;
+    free(steps);
+    test_result(ok, "workload shapes");
+}
+
+static void test_Pool() {
+    static pool_test_t tests[POOL_THREADS];
+    pthread_t threads[POOL_THREADS];
+    rbtree_pool_t *pool;
+    int i, ok;
+
+    pool = rbtree_pool_create(sizeof(rbtree_node_t));
+    test_result(pool != NULL, "pool create");
+    if (pool == NULL) return;
+
+    for (i = 0; i < POOL_THREADS; ++i) {
+        rbtree_init(&tests[i].tree, (rbtree_cmp_t *) int_cmp);
+        test_result(rbtree_set_pool(&tests[i].tree, pool) == 0, "pool set");
+        tests[i].ok = 1;
+        pthread_create(&threads[i], NULL, pool_insert_thread, &tests[i]);
+    }
+    for (i = 0; i < POOL_THREADS; ++i) {
+        pthread_join(threads[i], NULL);
+    }
+
+    for (i = 0; i < POOL_THREADS; ++i) {
+        pthread_create(&threads[i], NULL, pool_delete_thread,
+                       &tests[(i + 1) % POOL_THREADS]);
+    }
+    for (i = 0; i < POOL_THREADS; ++i) {
+        pthread_join(threads[i], NULL);
+    }
+
+    ok = 1;
+    for (i = 0; i < POOL_THREADS; ++i) {
+        ok &= tests[i].ok;
+    }
+    test_result(ok, "pool threads");
+
+    rbtree_pool_destroy(pool);
+
+    test_result(rbtree_pool_create(0) == NULL, "pool bad size");
+}
+
+static void test_PoolTrim() {
+    static int data[100000];
+    rbtree_pool_t *pool;
+    rbtree_t tree;
+    int i, ok;
+
+    pool = rbtree_pool_create(sizeof(rbtree_node_t));
+    rbtree_init(&tree, (rbtree_cmp_t *) int_cmp);
+    rbtree_set_pool(&tree, pool);
+
+    for (i = 0; i < 100000; ++i) {
+        data[i] = i;
+        rbtree_insert(&tree, &data[i]);
+    }
+
+    /* nothing to give back while the nodes are in use */
+    test_result(rbtree_pool_trim(&tree) == 0, "pool trim in use");
+
+    for (i = 0; i < 100000; ++i) {
+        rbtree_delete(&tree, &data[i]);
+    }
+
+    test_result(rbtree_pool_trim(&tree) > 0, "pool trim");
+
+    ok = 1;
+    for (i = 0; i < 1000; ++i) {
+        ok &= rbtree_insert(&tree, &data[i]) != NULL;
+    }
+    for (i = 0; i < 1000; ++i) {
+        ok &= rbtree_delete(&tree, &data[i]) == &data[i];
+    }
+    test_result(ok, "pool reuse after trim");
+
+    rbtree_pool_destroy(pool);
+}
+
+typedef struct {
+    int key;
+    int value;
+} pair_t;
+
+typedef struct {
+    rbtree_sync_t *sync;
+    int *ints;
+} sync_arg_t;
+
+/* insert 1000 ints, then delete the odd ones */
+static void *sync_thread(void *arg) {
+    sync_arg_t *a = (sync_arg_t *) arg;
+    long ok = 1;
+    int i;
+
+    for (i = 0; i < 1000; ++i) {
+        ok &= rbtree_sync_insert(a->sync, &a->ints[i]) == &a->ints[i];
+    }
+    for (i = 0; i < 1000; ++i) {
+        ok &= rbtree_sync_find(a->sync, &a->ints[i]) == &a->ints[i];
+    }
+    for (i = 1; i < 1000; i += 2) {
+        ok &= rbtree_sync_delete(a->sync, &a->ints[i]) == &a->ints[i];
+    }
+
+    return (void *) ok;
+}
+
+static void test_Sync() {
+    static int ints[8][1000];
+    static char *names[] = {"sync mutex", "sync rwlock", "sync combining"};
+    rbtree_sync_kind_t kind;
+    pthread_t threads[8];
+    sync_arg_t args[8];
+    rbtree_t tree;
+    int i, j;
+
+    for (i = 0; i < 8; ++i) {
+        for (j = 0; j < 1000; ++j) {
+            ints[i][j] = j * 8 + i;
+        }
+    }
+
+    for (kind = RBTREE_SYNC_MUTEX; kind <= RBTREE_SYNC_COMBINING; ++kind) {
+        bool ok = true;
+        void *thread_ok;
+
+        rbtree_init(&tree, (rbtree_cmp_t *) int_cmp);
+        args[0].sync = rbtree_sync_create(&tree, kind);
+
+        for (i = 0; i < 8; ++i) {
+            args[i].sync = args[0].sync;
+            args[i].ints = ints[i];
+            pthread_create(&threads[i], NULL, sync_thread, &args[i]);
+        }
+        for (i = 0; i < 8; ++i) {
+            pthread_join(threads[i], &thread_ok);
+            ok &= thread_ok != NULL;
+        }
+
+        rbtree_sync_destroy(args[0].sync);
+
+        /* the even positions of each thread's ints are left */
+        ok &= rbtree_size(&tree) == 4000 && treeOk(&tree);
+        for (i = 0; i < 8000; ++i) {
+            int key = i;
+            ok &= (rbtree_find(&tree, &key) != NULL) == ((i / 8) % 2 == 0);
+        }
+        test_result(ok, names[kind]);
+
+        while (tree.root != NULL) {
+            rbtree_delete(&tree, rbtree_first(&tree));
+        }
+    }
+}
+
+static int lr_ints[200];
+static atomic_int lr_writing;
+
+/* the even ints are always in the tree; the odd ones come and go */
+static void *lr_reader(void *arg) {
+    rbtree_lr_t *lr = (rbtree_lr_t *) arg;
+    long ok = 1;
+    int i;
+
+    while (lr_writing) {
+        for (i = 0; i < 200; i += 2) {
+            ok &= rbtree_lr_find(lr, &lr_ints[i]) == &lr_ints[i];
+        }
+    }
+
+    return (void *) ok;
+}
+
+static void test_LeftRight() {
+    rbtree_lr_t *lr = rbtree_lr_create((rbtree_cmp_t *) int_cmp);
+    pthread_t readers[2];
+    void *reader_ok;
+    bool ok = true;
+    int i, round;
+
+    for (i = 0; i < 200; ++i) {
+        lr_ints[i] = i;
+        if (i % 2 == 0) rbtree_lr_insert(lr, &lr_ints[i]);
+    }
+
+    lr_writing = 1;
+    for (i = 0; i < 2; ++i) {
+        pthread_create(&readers[i], NULL, lr_reader, lr);
+    }
+
+    for (round = 0; round < 2; ++round) {
+        for (i = 1; i < 200; i += 2) {
+            ok &= rbtree_lr_insert(lr, &lr_ints[i]) == &lr_ints[i];
+        }
+        for (i = 1; i < 200; i += 2) {
+            ok &= rbtree_lr_find(lr, &lr_ints[i]) == &lr_ints[i];
+            ok &= rbtree_lr_delete(lr, &lr_ints[i]) == &lr_ints[i];
+            ok &= rbtree_lr_find(lr, &lr_ints[i]) == NULL;
+        }
+    }
+    test_result(ok, "left-right write");
+
+    lr_writing = 0;
+    for (i = 0; i < 2; ++i) {
+        pthread_join(readers[i], &reader_ok);
+        ok &= reader_ok != NULL;
+    }
+    test_result(ok, "left-right read");
+
+    rbtree_lr_destroy(lr);
+}
+
+typedef struct {
+    rbtree_lsm_t *lsm;
+    int *ints;
+} lsm_arg_t;
+
+static void *lsm_thread(void *arg) {
+    lsm_arg_t *a = (lsm_arg_t *) arg;
+    long ok = 1;
+    int i;
+
+    for (i = 0; i < 1000; ++i) {
+        ok &= rbtree_lsm_insert(a->lsm, &a->ints[i]) == 0;
+        ok &= rbtree_lsm_find(a->lsm, &a->ints[i]) == &a->ints[i];
+    }
+    for (i = 1; i < 1000; i += 2) {
+        ok &= rbtree_lsm_delete(a->lsm, &a->ints[i]) == 0;
+        ok &= rbtree_lsm_find(a->lsm, &a->ints[i]) == NULL;
+    }
+
+    return (void *) ok;
+}
+
+static void *lsm_finder(void *arg) {
+    lsm_arg_t *a = (lsm_arg_t *) arg;
+
+    return rbtree_lsm_find(a->lsm, a->ints);
+}
+
+static void test_Lsm() {
+    static int ints[4][1000];
+    pthread_t threads[4];
+    lsm_arg_t args[4];
+    rbtree_lsm_level_t level;
+    rbtree_t tree;
+    void *thread_ok, *found;
+    bool ok = true;
+    int i, j, value = 7, same = 7;
+
+    for (i = 0; i < 4; ++i) {
+        for (j = 0; j < 1000; ++j) {
+            ints[i][j] = j * 4 + i;
+        }
+    }
+
+    rbtree_init(&tree, (rbtree_cmp_t *) int_cmp);
+    args[0].lsm = rbtree_lsm_create(&tree, 64, RBTREE_LSM_OWN_WRITES);
+
+    for (i = 0; i < 4; ++i) {
+        args[i].lsm  = args[0].lsm;
+        args[i].ints = ints[i];
+        pthread_create(&threads[i], NULL, lsm_thread, &args[i]);
+    }
+    for (i = 0; i < 4; ++i) {
+        pthread_join(threads[i], &thread_ok);
+        ok &= thread_ok != NULL;
+    }
+
+    /* exiting threads flush their buffers */
+    ok &= rbtree_size(&tree) == 2000 && treeOk(&tree);
+    ok &= rbtree_lsm_destroy(args[0].lsm) == 0;
+    for (i = 0; i < 4000; ++i) {
+        int key = i;
+        ok &= (rbtree_find(&tree, &key) != NULL) == ((i / 4) % 2 == 0);
+    }
+    test_result(ok, "lsm write");
+
+    while (tree.root != NULL) {
+        rbtree_delete(&tree, rbtree_first(&tree));
+    }
+
+    /* another thread sees a buffered insert only at RBTREE_LSM_ALL_WRITES */
+    for (level = RBTREE_LSM_FLUSHED; level <= RBTREE_LSM_ALL_WRITES; ++level) {
+        args[0].lsm  = rbtree_lsm_create(&tree, 100, level);
+        args[0].ints = &value;
+
+        ok &= rbtree_lsm_insert(args[0].lsm, &value) == 0
+              && rbtree_lsm_insert(args[0].lsm, &same) == 1;
+        ok &= (rbtree_lsm_find(args[0].lsm, &value) == &value) == (level != RBTREE_LSM_FLUSHED);
+
+        pthread_create(&threads[0], NULL, lsm_finder, &args[0]);
+        pthread_join(threads[0], &found);
+        ok &= (found == &value) == (level == RBTREE_LSM_ALL_WRITES);
+
+        ok &= rbtree_lsm_flush(args[0].lsm) == 0 && rbtree_find(&tree, &value) == &value;
+
+        rbtree_lsm_delete(args[0].lsm, &value);
+        ok &= rbtree_lsm_destroy(args[0].lsm) == 0 && tree.root == NULL;
+    }
+    test_result(ok, "lsm levels");
+
+    rbtree_set_cache(&tree, (rbtree_hash_t *) int_hash, 64);
+    test_result(rbtree_lsm_create(&tree, 64, RBTREE_LSM_OWN_WRITES) == NULL, "lsm shared finds");
+    rbtree_set_cache(&tree, NULL, 0);
+}
+
+static void test_Inline() {
+    int keys[] = {3,1,4,15,9,2,6,5,35,8,97,93,23,84,62,64};
+    int nkeys = sizeof(keys) / sizeof(keys[0]);
+    rbtree_pool_t *pool;
+    rbtree_iter_t iter;
+    rbtree_t tree;
+    pair_t pair, *found, *prev;
+    int i, ok;
+
+    rbtree_init_inline(&tree, (rbtree_cmp_t *) int_cmp, sizeof(int), sizeof(int));
+    test_result(rbtree_node_size(&tree) == sizeof(rbtree_node_t) + sizeof(pair_t),
+                "inline node size");
+
+    pool = rbtree_pool_create(rbtree_node_size(&tree));
+    test_result(rbtree_set_pool(&tree, pool) == 0, "inline pool");
+
+    ok = 1;
+    for (i = 0; i < nkeys; ++i) {
+        pair.key   = keys[i];
+        pair.value = keys[i] * 10;
+        found = rbtree_insert(&tree, &pair);
+        ok &= found != NULL && found != &pair && found->value == keys[i] * 10;
+    }
+    test_result(ok, "inline insert");
+
+    /* the caller's copy can go away */
+    memset(&pair, 0, sizeof(pair));
+
+    ok = 1;
+    for (i = 0; i < nkeys; ++i) {
+        pair.key = keys[i];
+        found = rbtree_find(&tree, &pair);
+        ok &= found != NULL && found->key == keys[i] && found->value == keys[i] * 10;
+    }
+    test_result(ok, "inline find");
+
+    ok = 1;
+    prev = NULL;
+    iter = rbtree_iter(&tree);
+    while ((found = rbtree_iter_next(&iter)) != NULL) {
+        ok &= prev == NULL || prev->key < found->key;
+        prev = found;
+    }
+    test_result(ok, "inline in order");
+
+    ok = 1;
+    for (i = 0; i < nkeys; ++i) {
+        int j;
+
+        pair.key = keys[i];
+        ok &= rbtree_delete(&tree, &pair) == &pair;
+        ok &= rbtree_find(&tree, &pair) == NULL;
+
+        for (j = i + 1; j < nkeys; ++j) {
+            pair.key = keys[j];
+            found = rbtree_find(&tree, &pair);
+            ok &= found != NULL && found->value == keys[j] * 10;
+        }
+    }
+    test_result(ok && tree.root == NULL, "inline delete");
+
+    rbtree_pool_destroy(pool);
+}
+
 int main(int argc, char **argv) {
     test_Sorted();
     test_DeleteTree();
     test_mallocAndFreeUserData();
+    test_ShiftKeys();
+    test_Rank();
+    test_SplitJoin();
+    test_Build();
+    test_FirstFit();
+    test_Txn();
+    test_Batch();
+    test_Cache();
+    test_SortedBatch();
+    test_Key();
+    test_Rangeset();
+    test_Mapped();
+    test_MappedFile();
+    test_Snapshot();
+    test_Frozen();
+    test_Range2d();
+    test_Trace();
+    test_Perf();
+    test_Workload();
+    test_Pool();
+    test_PoolTrim();
+    test_Sync();
+    test_LeftRight();
+    test_Lsm();
+    test_Inline();
 
     return test_result_value;
 }
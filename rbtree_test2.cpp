@@ -0,0 +1,166 @@
+/* rbtree_test2.cpp, Copyright (C) 2016, Greg Johnson
+ * Released under the terms of the GNU GPL v2.0.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ */
+#include <algorithm>
+#include <atomic>
+#include <cstdio>
+#include <execution>
+#include <numeric>
+#include <ranges>
+#include <string_view>
+#include <vector>
+#include "rbtree.hpp"
+
+/* unit tests for the C++ interface */
+
+/* return value for unit test main routine */
+static int test_result_value = 0;
+
+static void test_result(bool test, const char *title) {
+    printf("%s %s\n", title, test ? "passed" : "failed");
+
+    if (!test) {
+        test_result_value = -1;
+    }
+}
+
+static void test_Tree() {
+    int data[]       = {3,1,4,1,5,9,2,6};
+    int sortedData[] = {1,1,2,3,4,5,6,9};
+    rbtree::tree<int> tree;
+    bool ok = true;
+
+    for (int &datum : data) {
+        ok &= tree.insert(&datum) == &datum;
+    }
+    test_result(ok, "tree insert");
+
+    test_result(tree.find(5) != nullptr && *tree.find(5) == 5, "tree find");
+    test_result(tree.find(7) == nullptr, "tree find missing");
+
+    for (int sorted : sortedData) {
+        int *first = tree.first(), *erased;
+        ok &= first != nullptr && *first == sorted;
+        ok &= (erased = tree.erase(sorted)) != nullptr && *erased == sorted;
+    }
+    test_result(ok && tree.empty(), "tree erase in order");
+
+    /* the cache and the open transaction go with the nodes */
+    auto hash = [](const void *data) -> std::size_t { return *static_cast<const int *>(data); };
+    ok = rbtree_set_cache(tree.get(), hash, 16) == 0 && rbtree_txn_begin(tree.get()) == 0;
+    for (int &datum : data) {
+        tree.insert(&datum);
+    }
+
+    rbtree::tree<int> moved(std::move(tree));
+    ok &= tree.empty() && tree.get()->cache == nullptr && tree.get()->undo == nullptr
+          && !tree.get()->txn_open;
+    ok &= rbtree_txn_commit(moved.get()) == 0 && moved.size() == 8 && *moved.find(9) == 9;
+    test_result(ok, "tree move");
+}
+
+static_assert(std::ranges::bidirectional_range<rbtree::tree<int>>, "tree is a range");
+static_assert(!std::random_access_iterator<rbtree::tree<int>::iterator>, "bidirectional only");
+static_assert(std::ranges::random_access_range<rbtree::tree<int>::ranked_range>, "ranked");
+
+static void test_Iterator() {
+    std::vector<long> data(10000);
+    rbtree::tree<long> tree;
+    bool ok = true;
+
+    /* 0, 1, 2, .. in a scrambled order */
+    for (std::size_t i = 0; i < data.size(); ++i) {
+        data[i] = i * 7919 % data.size();
+        tree.insert(&data[i]);
+    }
+
+    test_result(tree.size() == data.size() && std::is_sorted(tree.begin(), tree.end())
+                && std::distance(tree.begin(), tree.end()) == 10000, "iterator in order");
+
+    auto it = tree.nth(5000);
+    ok &= *it == 5000 && *std::prev(it) == 4999 && *--tree.end() == 9999;
+    ok &= tree.index_of(it) == 5000 && tree.nth(10000) == tree.end()
+          && tree.index_of(tree.end()) == 10000;
+    for (auto back = tree.end(); back != tree.begin(); ) {
+        --back;
+        ok &= *back == (long) tree.index_of(back);
+    }
+    test_result(ok, "iterator by position");
+
+    auto ranked = tree.ranked();
+    auto r = ranked.begin() + 5000;
+    ok = *r == 5000 && r[-5000] == 0 && *(r - 1) == 4999 && *--ranked.end() == 9999;
+    ok &= ranked.begin() < r && r - ranked.begin() == 5000 && (r += 5000) == ranked.end();
+    for (auto back = ranked.end(); back != ranked.begin(); ) {
+        --back;
+        ok &= *back == back - ranked.begin();
+    }
+    test_result(ok, "iterator random access");
+
+    long expected = 9999L * 10000 / 2;
+    std::atomic<long> sum = 0;
+    std::for_each(std::execution::par, ranked.begin(), ranked.end(), [&](long x) { sum += x; });
+    test_result(sum == expected, "iterator parallel for_each");
+    test_result(std::reduce(std::execution::par, ranked.begin(), ranked.end(), 0L) == expected,
+                "iterator parallel reduce");
+
+    auto odd = [](long x) { return x % 2 == 1; };
+    test_result(std::ranges::count_if(tree, odd) == 5000
+                && *std::ranges::lower_bound(ranked, 1234L) == 1234, "iterator ranges");
+}
+
+static constexpr auto opcodes = rbtree::make_frozen_map<std::string_view, int>({
+    {"mul", 3}, {"add", 1}, {"sub", 2}, {"div", 4}, {"mod", 5},
+    {"and", 6}, {"or", 7}, {"xor", 8}, {"not", 9}, {"shl", 10},
+});
+
+static_assert(opcodes.size() == 10, "frozen size");
+static_assert(*opcodes.find("xor") == 8, "frozen find at compile time");
+static_assert(!opcodes.contains("nop"), "frozen missing at compile time");
+
+static void test_Frozen() {
+    static constexpr std::string_view names[] = {
+        "add", "sub", "mul", "div", "mod", "and", "or", "xor", "not", "shl"
+    };
+    bool ok = true;
+
+    for (int i = 0; i < 10; ++i) {
+        const int *op = opcodes.find(names[i]);
+        ok &= op != nullptr && *op == i + 1;
+    }
+    test_result(ok, "frozen find");
+
+    test_result(opcodes.find("") == nullptr && opcodes.find("zzz") == nullptr
+                && opcodes.find("ad") == nullptr, "frozen find missing");
+
+    /* the same comparator orders a runtime tree */
+    constexpr auto squares = rbtree::make_frozen_map<int, int, std::greater<int>>({
+        {1, 1}, {2, 4}, {3, 9}, {4, 16}, {5, 25}, {6, 36}, {7, 49},
+    });
+    rbtree::tree<int, std::greater<int>> tree;
+    int keys[] = {1, 2, 3, 4, 5, 6, 7};
+
+    for (int &key : keys) {
+        tree.insert(&key);
+    }
+
+    ok = *tree.first() == 7;
+    for (int key : keys) {
+        ok &= squares.find(key) != nullptr && *squares.find(key) == key * key;
+        ok &= tree.find(key) != nullptr;
+    }
+    test_result(ok && squares.find(0) == nullptr, "frozen custom compare");
+}
+
+int main(int argc, char **argv) {
+    test_Tree();
+    test_Iterator();
+    test_Frozen();
+
+    return test_result_value;
+}
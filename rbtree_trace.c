@@ -0,0 +1,205 @@
+/* rbtree_trace.c, Copyright (C) 2016, Greg Johnson
+ * Released under the terms of the GNU GPL v2.0.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <string.h>
+#include <time.h>
+#include "rbtree_trace.h"
+
+/* Trace file format:
+ *
+ *     "RBTRACE2", then one record per operation:
+ *
+ *     op            1 byte
+ *     time delta    varint, nanoseconds since the previous record
+ *     key length    varint        (find, insert and delete only)
+ *     key bytes
+ *     iterator      varint        (iter and iter_next only)
+ *
+ * varints are little-endian base-128.  version 1 ("RBTRACE1") had no
+ * iterator field, so iter and iter_next records were just the op and
+ * time delta; such traces are not read.
+ */
+
+#define TRACE_MAGIC "RBTRACE2"
+
+struct _rbtree_trace_t {
+    rbtree_t *tree;
+    rbtree_key_bytes_t *key_bytes;
+    FILE *file;
+
+    unsigned long long last;        /* time of the previous record */
+};
+
+struct _rbtree_trace_reader_t {
+    FILE *file;
+    unsigned long long timestamp;
+
+    unsigned char *key;
+    size_t key_space;
+};
+
+static unsigned long long now_ns() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    return (unsigned long long) ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static bool has_key(rbtree_trace_op_t op) {
+    return op == RBTREE_TRACE_FIND || op == RBTREE_TRACE_INSERT || op == RBTREE_TRACE_DELETE;
+}
+
+static bool has_iter(rbtree_trace_op_t op) {
+    return op == RBTREE_TRACE_ITER || op == RBTREE_TRACE_ITER_NEXT;
+}
+
+static void put_varint(FILE *file, unsigned long long value) {
+    while (value >= 0x80) {
+        putc((int) (value & 0x7f) | 0x80, file);
+        value >>= 7;
+    }
+    putc((int) value, file);
+}
+
+/* return 0 on success, -1 on a truncated value. */
+static int get_varint(FILE *file, unsigned long long *value) {
+    int c, shift = 0;
+
+    *value = 0;
+
+    while ((c = getc(file)) != EOF && shift < 64) {
+        *value |= (unsigned long long) (c & 0x7f) << shift;
+        if (!(c & 0x80)) return 0;
+
+        shift += 7;
+    }
+
+    return -1;
+}
+
+static void record(void *ctx, rbtree_trace_op_t op, const void *data) {
+    rbtree_trace_t *trace = (rbtree_trace_t *) ctx;
+    unsigned long long now = now_ns();
+
+    putc(op, trace->file);
+    put_varint(trace->file, now - trace->last);
+    trace->last = now;
+
+    if (has_key(op)) {
+        const void *bytes;
+        size_t len = trace->key_bytes(data, &bytes);
+
+        put_varint(trace->file, len);
+        fwrite(bytes, 1, len, trace->file);
+
+    } else if (has_iter(op)) {
+        put_varint(trace->file, ((const rbtree_iter_t *) data)->id);
+    }
+}
+
+rbtree_trace_t *rbtree_trace_start(rbtree_t *tree, const char *path,
+                                   rbtree_key_bytes_t *key_bytes) {
+    rbtree_trace_t *trace = (rbtree_trace_t *) malloc(sizeof(rbtree_trace_t));
+
+    if (trace == NULL) return NULL;
+
+    if ((trace->file = fopen(path, "wb")) == NULL) {
+        free(trace);
+        return NULL;
+    }
+
+    fputs(TRACE_MAGIC, trace->file);
+
+    trace->tree      = tree;
+    trace->key_bytes = key_bytes;
+    trace->last      = now_ns();
+
+    rbtree_set_trace(tree, record, trace);
+
+    return trace;
+}
+
+int rbtree_trace_stop(rbtree_trace_t *trace) {
+    int result = ferror(trace->file) ? -1 : 0;
+
+    rbtree_set_trace(trace->tree, NULL, NULL);
+
+    if (fclose(trace->file) != 0) result = -1;
+    free(trace);
+
+    return result;
+}
+
+rbtree_trace_reader_t *rbtree_trace_open(const char *path) {
+    rbtree_trace_reader_t *reader;
+    char magic[sizeof(TRACE_MAGIC) - 1];
+
+    if ((reader = (rbtree_trace_reader_t *) calloc(1, sizeof(*reader))) == NULL)
+        return NULL;
+
+    if ((reader->file = fopen(path, "rb")) == NULL
+            || fread(magic, 1, sizeof(magic), reader->file) != sizeof(magic)
+            || memcmp(magic, TRACE_MAGIC, sizeof(magic)) != 0) {
+        rbtree_trace_close(reader);
+        return NULL;
+    }
+
+    return reader;
+}
+
+int rbtree_trace_read(rbtree_trace_reader_t *reader, rbtree_trace_record_t *record) {
+    unsigned long long delta, len, id;
+    int op;
+
+    if ((op = getc(reader->file)) == EOF) return 0;
+    if (op > RBTREE_TRACE_ITER_NEXT) return -1;
+
+    if (get_varint(reader->file, &delta) < 0) return -1;
+    reader->timestamp += delta;
+
+    record->op        = (rbtree_trace_op_t) op;
+    record->timestamp = reader->timestamp;
+    record->key_len   = 0;
+    record->key       = NULL;
+    record->iter      = 0;
+
+    if (has_iter(record->op)) {
+        if (get_varint(reader->file, &id) < 0) return -1;
+
+        record->iter = (unsigned long) id;
+        return 1;
+    }
+
+    if (!has_key(record->op)) return 1;
+
+    if (get_varint(reader->file, &len) < 0) return -1;
+
+    if (len > reader->key_space) {
+        unsigned char *key = (unsigned char *) realloc(reader->key, len);
+        if (key == NULL) return -1;
+
+        reader->key       = key;
+        reader->key_space = len;
+    }
+
+    if (fread(reader->key, 1, len, reader->file) != len) return -1;
+
+    record->key_len = len;
+    record->key     = reader->key;
+
+    return 1;
+}
+
+void rbtree_trace_close(rbtree_trace_reader_t *reader) {
+    if (reader->file != NULL) fclose(reader->file);
+    free(reader->key);
+    free(reader);
+}
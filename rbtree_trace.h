@@ -0,0 +1,82 @@
+/* rbtree_trace.h, Copyright (C) 2016, Greg Johnson
+ * Released under the terms of the GNU GPL v2.0.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ */
+#ifndef RBTREE_TRACE_H
+#define RBTREE_TRACE_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include "rbtree.h"
+
+/* recording of the operations done on a tree, so that a real workload
+ * can be replayed later with rbtree_replay.
+ *
+ * each record holds the operation, a timestamp, and the key bytes of
+ * the user data value passed to the operation.  key_bytes(data, &bytes)
+ * returns the number of key bytes of data and points bytes at them.
+ *
+ * the replay tool orders keys by memcmp() of their key bytes (shorter
+ * keys first on a tie), so for a faithful replay key bytes should sort
+ * the same way that the tree's cmp function does.  iterations are
+ * recorded with a number for the iterator, so that interleaved
+ * iterations are replayed each on its own iterator.
+ *
+ * Usage:
+ *     rbtree_trace_t *trace = rbtree_trace_start(&tree, "my.trace", my_key_bytes);
+ *     ...
+ *     rbtree_trace_stop(trace);
+ *
+ *     rbtree_trace_reader_t *reader = rbtree_trace_open("my.trace");
+ *     rbtree_trace_record_t record;
+ *     while (rbtree_trace_read(reader, &record) > 0) {
+ *         ...
+ *     }
+ *     rbtree_trace_close(reader);
+ */
+
+typedef size_t (rbtree_key_bytes_t)(const void *data, const void **bytes);
+
+typedef struct _rbtree_trace_t        rbtree_trace_t;
+typedef struct _rbtree_trace_reader_t rbtree_trace_reader_t;
+
+typedef struct {
+    rbtree_trace_op_t   op;
+    unsigned long long  timestamp;   /* nanoseconds since the trace started */
+    size_t              key_len;
+    const void         *key;         /* valid until the next read */
+    unsigned long       iter;        /* which iterator, for iter and iter_next */
+} rbtree_trace_record_t;
+
+/* start recording operations on tree into a new trace file at path.
+ * return NULL on failure.
+ */
+rbtree_trace_t *rbtree_trace_start(rbtree_t *tree, const char *path,
+                                   rbtree_key_bytes_t *key_bytes);
+
+/* stop recording and close the trace file.  return 0 on success,
+ * -1 if any write to the trace failed.
+ */
+int rbtree_trace_stop(rbtree_trace_t *trace);
+
+/* open a trace file for reading.  return NULL on failure. */
+rbtree_trace_reader_t *rbtree_trace_open(const char *path);
+
+/* read the next record.  return 1 on success, 0 at end of trace,
+ * -1 if the trace is damaged.
+ */
+int rbtree_trace_read(rbtree_trace_reader_t *reader, rbtree_trace_record_t *record);
+
+void rbtree_trace_close(rbtree_trace_reader_t *reader);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,255 @@
+/* rbtree_workload.c, Copyright (C) 2016, Greg Johnson
+ * Released under the terms of the GNU GPL v2.0.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ */
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "rbtree_workload.h"
+
+/* Workloads are generated as plain arrays of steps, so a run times
+ * only the tree.  Each step is timed on its own with the monotonic
+ * clock, which adds some tens of ns to every op but keeps the slowest
+ * ones visible.  latencies go into a log-linear histogram:  the bucket
+ * of ns is given by its top SUB_BITS + 1 bits, so buckets are exact up
+ * to 16 ns and 1/16 of their value wide above that, and percentiles
+ * are upper bounds within 6%.
+ */
+
+#define SUB_BITS RBTREE_WORKLOAD_SUB_BITS
+#define SUB      (1 << SUB_BITS)
+
+#define DUPLICATE_KEYS 4
+
+static const char *names[] = {
+    "random", "sorted", "reverse", "zigzag", "cascade", "duplicates"
+};
+
+static const char *op_names[] = {"insert", "find", "delete"};
+
+const char *rbtree_workload_name(rbtree_workload_kind_t kind) {
+    return kind < RBTREE_WORKLOAD_NUM_KINDS ? names[kind] : "?";
+}
+
+/* xorshift64 */
+static unsigned long long next_random(unsigned long long *state) {
+    *state ^= *state << 13;
+    *state ^= *state >> 7;
+    *state ^= *state << 17;
+
+    return *state;
+}
+
+static void shuffle(rbtree_workload_step_t *steps, size_t n, unsigned long long *state) {
+    size_t i;
+
+    for (i = n; i > 1; --i) {
+        size_t j = next_random(state) % i;
+        long key = steps[i - 1].key;
+
+        steps[i - 1].key = steps[j].key;
+        steps[j].key     = key;
+    }
+}
+
+/* the positions 0..n-1 in bit-reversed order:  0, n/2, n/4, 3n/4, .. */
+static void bit_reverse(rbtree_workload_step_t *steps, size_t n) {
+    size_t i, j = 0, bits = 0;
+
+    while (((size_t) 1 << bits) < n) ++bits;
+
+    for (i = 0; i < ((size_t) 1 << bits); ++i) {
+        size_t r = 0, b;
+
+        for (b = 0; b < bits; ++b) {
+            if (i & ((size_t) 1 << b)) r |= (size_t) 1 << (bits - 1 - b);
+        }
+
+        if (r < n) steps[j++].key = (long) r;
+    }
+}
+
+rbtree_workload_step_t *rbtree_workload_create(rbtree_workload_kind_t kind, size_t n,
+                                               unsigned long long seed, size_t *count) {
+    rbtree_workload_step_t *steps, *inserts, *finds, *deletes;
+    unsigned long long state = seed != 0 ? seed : 0x9e3779b97f4a7c15ULL;
+    long range = kind == RBTREE_WORKLOAD_DUPLICATES ? DUPLICATE_KEYS : (long) n;
+    size_t i;
+
+    if (kind >= RBTREE_WORKLOAD_NUM_KINDS) return NULL;
+
+    if ((steps = (rbtree_workload_step_t *) malloc((3 * n + 1) * sizeof(*steps))) == NULL)
+        return NULL;
+
+    inserts = steps;
+    finds   = steps + n;
+    deletes = steps + 2 * n;
+
+    for (i = 0; i < n; ++i) {
+        inserts[i].op  = RBTREE_WORKLOAD_INSERT;
+        inserts[i].key = (long) i % range;
+        finds[i].op    = RBTREE_WORKLOAD_FIND;
+        finds[i].key   = range > 0 ? (long) (next_random(&state) % range) : 0;
+        deletes[i].op  = RBTREE_WORKLOAD_DELETE;
+        deletes[i].key = (long) i % range;
+    }
+
+    switch (kind) {
+        case RBTREE_WORKLOAD_RANDOM:
+        case RBTREE_WORKLOAD_DUPLICATES:
+            shuffle(inserts, n, &state);
+            shuffle(deletes, n, &state);
+            break;
+
+        case RBTREE_WORKLOAD_SORTED:
+            break;
+
+        case RBTREE_WORKLOAD_REVERSE:
+            for (i = 0; i < n; ++i) {
+                inserts[i].key = deletes[i].key = (long) (n - 1 - i);
+            }
+            break;
+
+        case RBTREE_WORKLOAD_ZIGZAG:
+            for (i = 0; i < n; ++i) {
+                inserts[i].key = deletes[i].key
+                               = (long) (i % 2 == 0 ? i / 2 : n - 1 - i / 2);
+            }
+            break;
+
+        case RBTREE_WORKLOAD_CASCADE:
+            bit_reverse(deletes, n);
+            break;
+
+        default:
+            break;
+    }
+
+    *count = 3 * n;
+
+    return steps;
+}
+
+int rbtree_workload_cmp(const void *k1, const void *k2) {
+    long key1 = *(const long *) k1, key2 = *(const long *) k2;
+
+    return key1 < key2 ? -1 : key1 > key2;
+}
+
+static unsigned long long now_ns() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    return (unsigned long long) ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static int bucket(unsigned long long ns) {
+    unsigned long long v = ns;
+    int e = 0;
+
+    if (ns < SUB) return (int) ns;
+
+    /* ns is in [2^e, 2^(e+1)), which is split SUB ways */
+    while (v > 1) { v >>= 1; ++e; }
+
+    return ((e - SUB_BITS + 1) << SUB_BITS) + (int) ((ns >> (e - SUB_BITS)) & (SUB - 1));
+}
+
+/* the largest latency that goes into bucket b. */
+static unsigned long long bucket_max(int b) {
+    int e = (b >> SUB_BITS) + SUB_BITS - 1;
+    unsigned long long low;
+
+    if (b < SUB) return b;
+
+    low = (unsigned long long) (SUB + (b & (SUB - 1))) << (e - SUB_BITS);
+
+    return low + ((1ULL << (e - SUB_BITS)) - 1);
+}
+
+int rbtree_workload_run(rbtree_t *tree, rbtree_workload_step_t *steps, size_t count,
+                        rbtree_workload_stats_t *stats) {
+    long *keys = (long *) malloc((count + 1) * sizeof(long));
+    size_t i;
+
+    memset(stats, 0, sizeof(*stats));
+
+    if (keys == NULL) return -1;
+
+    for (i = 0; i < count; ++i) {
+        keys[i] = steps[i].key;
+    }
+
+    for (i = 0; i < count; ++i) {
+        rbtree_workload_op_t op = steps[i].op;
+        unsigned long long start, ns;
+
+        start = now_ns();
+
+        switch (op) {
+            case RBTREE_WORKLOAD_INSERT: rbtree_insert(tree, &keys[i]); break;
+            case RBTREE_WORKLOAD_FIND:   rbtree_find(tree, &keys[i]);   break;
+            case RBTREE_WORKLOAD_DELETE: rbtree_delete(tree, &keys[i]); break;
+            default:                     continue;
+        }
+
+        ns = now_ns() - start;
+
+        ++stats->count[op];
+        stats->total_ns[op] += ns;
+        ++stats->histogram[op][bucket(ns)];
+
+        if (ns > stats->max_ns[op]) {
+            stats->max_ns[op]   = ns;
+            stats->max_step[op] = i;
+        }
+    }
+
+    /* the values are ours */
+    while (tree->root != NULL) {
+        rbtree_delete(tree, rbtree_first(tree));
+    }
+
+    free(keys);
+
+    return 0;
+}
+
+unsigned long long rbtree_workload_percentile(rbtree_workload_stats_t *stats,
+                                              rbtree_workload_op_t op, double fraction) {
+    unsigned long long seen = 0, want = (unsigned long long) (fraction * stats->count[op]);
+    int b;
+
+    if (want == 0) want = 1;
+
+    for (b = 0; b < RBTREE_WORKLOAD_BUCKETS; ++b) {
+        seen += stats->histogram[op][b];
+
+        if (seen >= want) {
+            unsigned long long bound = bucket_max(b);
+            return bound < stats->max_ns[op] ? bound : stats->max_ns[op];
+        }
+    }
+
+    return stats->max_ns[op];
+}
+
+void rbtree_workload_report(rbtree_workload_stats_t *stats, FILE *out, const char *title) {
+    int op;
+
+    for (op = 0; op < RBTREE_WORKLOAD_NUM_OPS; ++op) {
+        if (stats->count[op] == 0) continue;
+
+        fprintf(out, "%-11s %-7s %9llu %8.0f %8llu %8llu %8llu %9llu %10zu\n",
+                title, op_names[op], stats->count[op],
+                (double) stats->total_ns[op] / stats->count[op],
+                rbtree_workload_percentile(stats, (rbtree_workload_op_t) op, 0.5),
+                rbtree_workload_percentile(stats, (rbtree_workload_op_t) op, 0.99),
+                rbtree_workload_percentile(stats, (rbtree_workload_op_t) op, 0.999),
+                stats->max_ns[op], stats->max_step[op]);
+    }
+}
@@ -0,0 +1,125 @@
+/* rbtree_workload.h, Copyright (C) 2016, Greg Johnson
+ * Released under the terms of the GNU GPL v2.0.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ */
+#ifndef RBTREE_WORKLOAD_H
+#define RBTREE_WORKLOAD_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stdio.h>
+#include "rbtree.h"
+
+/* adversarial workloads for benchmarks, and per-operation latency
+ * statistics, so that the tail can be measured and not just the mean.
+ *
+ * each workload inserts n keys, finds n random keys, and deletes the n
+ * keys again, in an order chosen to stress the tree:
+ *
+ * RBTREE_WORKLOAD_RANDOM:      random orders; the baseline.
+ * RBTREE_WORKLOAD_SORTED:      ascending inserts and deletes.  every
+ *                              insert lands on the right spine, and
+ *                              recolorings run up to the root at each
+ *                              power of two.
+ * RBTREE_WORKLOAD_REVERSE:     the same, descending.
+ * RBTREE_WORKLOAD_ZIGZAG:      inserts alternate between the low and
+ *                              high ends, closing in on the middle, so
+ *                              each new node is an inside child (a double
+ *                              rotation) at the bottom of a long path.
+ * RBTREE_WORKLOAD_CASCADE:     ascending inserts leave an almost all-black
+ *                              tree; deletes in bit-reversed order each
+ *                              hit a part of it no earlier delete touched,
+ *                              where a black leaf's removal propagates up
+ *                              toward the root.
+ * RBTREE_WORKLOAD_DUPLICATES:  n inserts of only 4 distinct keys, which
+ *                              go right of their equals and pile up into
+ *                              long runs.
+ *
+ * Usage:
+ *     steps = rbtree_workload_create(RBTREE_WORKLOAD_ZIGZAG, 100000, seed, &count);
+ *     rbtree_init(&tree, rbtree_workload_cmp);
+ *     rbtree_workload_run(&tree, steps, count, &stats);
+ *     rbtree_workload_report(&stats, stdout, rbtree_workload_name(RBTREE_WORKLOAD_ZIGZAG));
+ *     free(steps);
+ */
+
+typedef enum {
+    RBTREE_WORKLOAD_INSERT,
+    RBTREE_WORKLOAD_FIND,
+    RBTREE_WORKLOAD_DELETE,
+    RBTREE_WORKLOAD_NUM_OPS
+} rbtree_workload_op_t;
+
+typedef enum {
+    RBTREE_WORKLOAD_RANDOM,
+    RBTREE_WORKLOAD_SORTED,
+    RBTREE_WORKLOAD_REVERSE,
+    RBTREE_WORKLOAD_ZIGZAG,
+    RBTREE_WORKLOAD_CASCADE,
+    RBTREE_WORKLOAD_DUPLICATES,
+    RBTREE_WORKLOAD_NUM_KINDS
+} rbtree_workload_kind_t;
+
+typedef struct {
+    rbtree_workload_op_t op;
+    long key;
+} rbtree_workload_step_t;
+
+/* each power of two of ns is split into 2^RBTREE_WORKLOAD_SUB_BITS
+ * buckets of equal width (as in an HDR histogram), so a bucket's bounds
+ * are within 1/16 of each other; below 16 ns, each ns has a bucket.
+ */
+#define RBTREE_WORKLOAD_SUB_BITS 4
+#define RBTREE_WORKLOAD_BUCKETS  ((64 - RBTREE_WORKLOAD_SUB_BITS + 1) << RBTREE_WORKLOAD_SUB_BITS)
+
+typedef struct {
+    unsigned long long count[RBTREE_WORKLOAD_NUM_OPS];
+    unsigned long long total_ns[RBTREE_WORKLOAD_NUM_OPS];
+    unsigned long long max_ns[RBTREE_WORKLOAD_NUM_OPS];
+    size_t max_step[RBTREE_WORKLOAD_NUM_OPS];      /* where the slowest op was */
+
+    /* histogram[op][b] counts the ops whose latency fell in bucket b */
+    unsigned long long histogram[RBTREE_WORKLOAD_NUM_OPS][RBTREE_WORKLOAD_BUCKETS];
+} rbtree_workload_stats_t;
+
+const char *rbtree_workload_name(rbtree_workload_kind_t kind);
+
+/* return a malloc'ed workload of the given kind on n keys, and set
+ * *count to its number of steps; or NULL on failure.
+ */
+rbtree_workload_step_t *rbtree_workload_create(rbtree_workload_kind_t kind, size_t n,
+                                               unsigned long long seed, size_t *count);
+
+/* rbtree_cmp_t for the workload's values, which are longs. */
+int rbtree_workload_cmp(const void *k1, const void *k2);
+
+/* time each step on tree, which must be empty and ordered by
+ * rbtree_workload_cmp; it is empty again afterwards.  return 0, or -1
+ * if memory ran out.
+ */
+int rbtree_workload_run(rbtree_t *tree, rbtree_workload_step_t *steps, size_t count,
+                        rbtree_workload_stats_t *stats);
+
+/* return an upper bound on the latency of the given fraction (0.99 for
+ * the 99th percentile) of the op's steps, in ns; it is at most 1/16
+ * above the true percentile.
+ */
+unsigned long long rbtree_workload_percentile(rbtree_workload_stats_t *stats,
+                                              rbtree_workload_op_t op, double fraction);
+
+/* print a line per op:  count, mean, median, 99th and 99.9th percentile
+ * and max latency, and the step of the max.
+ */
+void rbtree_workload_report(rbtree_workload_stats_t *stats, FILE *out, const char *title);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif